@@ -0,0 +1,518 @@
+/*
+ * AES-128 decryption in software, written from FIPS-197. Two
+ * variants share the key schedule:
+ *
+ *  - T-table: the usual four 256-word tables that merge InvSubBytes,
+ *    InvShiftRows and InvMixColumns into lookups. Fast, but which
+ *    table words are read depends on the key and the data.
+ *
+ *  - Bitsliced: two blocks are held as eight 32-bit bit planes (plane
+ *    b has bit b of each of the 32 bytes) and every step is a fixed
+ *    sequence of word operations, including the S-box, which is a
+ *    boolean circuit. No lookups, no branches.
+ *
+ * Only built for firmware that uses it instead of the XDecrypt core.
+ */
+#include <stdbool.h>
+#include "aes.h"
+#include "memops.h"
+
+#ifdef AES_SW_ENGINE
+
+static uint8_t sbox[256], inv_sbox[256];
+static uint32_t Td[4][256];
+static bool tables_ready;
+
+#define ror32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define rol8(x, n) ((uint8_t)(((x) << (n)) | ((x) >> (8 - (n)))))
+#define GET_32BIT_MSB_FIRST(cp) \
+  (((uint32_t)(cp)[0] << 24) | ((uint32_t)(cp)[1] << 16) | \
+   ((uint32_t)(cp)[2] << 8) | ((uint32_t)(cp)[3]))
+
+static uint8_t xtime(uint8_t x)
+{
+    return (uint8_t)(x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t r = 0;
+    while (b) {
+        if (b & 1)
+            r ^= a;
+        a = xtime(a);
+        b >>= 1;
+    }
+    return r;
+}
+
+/*
+ * The tables are generated rather than written out, which keeps 4.5k
+ * of literals out of the source. Runs once, on public data only.
+ */
+static void aes_tables_init(void)
+{
+    uint8_t p = 1, q = 1, s;
+    int i;
+
+    /* walk the multiplicative group with generator 3; q tracks 1/p */
+    do {
+        p = p ^ xtime(p);
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80)
+            q ^= 0x09;
+        sbox[p] = q ^ rol8(q, 1) ^ rol8(q, 2) ^ rol8(q, 3) ^ rol8(q, 4) ^ 0x63;
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (i = 0; i < 256; i++)
+        inv_sbox[sbox[i]] = i;
+    for (i = 0; i < 256; i++) {
+        s = inv_sbox[i];
+        Td[0][i] = ((uint32_t)gf_mul(s, 0x0e) << 24) | ((uint32_t)gf_mul(s, 0x09) << 16) |
+                   ((uint32_t)gf_mul(s, 0x0d) << 8) | gf_mul(s, 0x0b);
+        Td[1][i] = ror32(Td[0][i], 8);
+        Td[2][i] = ror32(Td[0][i], 16);
+        Td[3][i] = ror32(Td[0][i], 24);
+    }
+    tables_ready = true;
+}
+
+/*
+ * Standard AES-128 key expansion into 44 words. <key> is the region
+ * secret as given to the core; protectSong encrypts with it transposed.
+ */
+static void aes_expand_key(uint32_t w[4 * (AES_ROUNDS + 1)], const uint8_t key[AES_KEYSIZE])
+{
+    uint8_t k[AES_KEYSIZE];
+    uint8_t rcon = 1;
+    uint32_t t;
+    int i;
+
+    for (i = 0; i < AES_KEYSIZE; i++)
+        k[i] = key[((i & 3) << 2) | (i >> 2)];
+    for (i = 0; i < 4; i++)
+        w[i] = GET_32BIT_MSB_FIRST(k + 4 * i);
+    for (i = 4; i < 4 * (AES_ROUNDS + 1); i++) {
+        t = w[i - 1];
+        if ((i & 3) == 0) {
+            t = ((uint32_t)sbox[(t >> 16) & 0xff] << 24) | ((uint32_t)sbox[(t >> 8) & 0xff] << 16) |
+                ((uint32_t)sbox[t & 0xff] << 8) | sbox[t >> 24];
+            t ^= (uint32_t)rcon << 24;
+            rcon = xtime(rcon);
+        }
+        w[i] = w[i - 4] ^ t;
+    }
+    memzero(k, sizeof(k));
+}
+
+/* ----------------------------------------------------------------------
+ * T-table variant.
+ */
+
+static uint32_t inv_mix_column(uint32_t w)
+{
+    /* Td includes InvSubBytes, so undo it with the forward S-box */
+    return Td[0][sbox[w >> 24]] ^ Td[1][sbox[(w >> 16) & 0xff]] ^
+           Td[2][sbox[(w >> 8) & 0xff]] ^ Td[3][sbox[w & 0xff]];
+}
+
+static void ttable_init(aes_sw *ctx, const uint32_t w[4 * (AES_ROUNDS + 1)])
+{
+    uint32_t *rk = ctx->rk.td;
+    int r, j;
+
+    /* equivalent inverse cipher: reversed round keys, InvMixColumns on the middle ones */
+    for (r = 0; r <= AES_ROUNDS; r++)
+        for (j = 0; j < 4; j++) {
+            uint32_t k = w[4 * (AES_ROUNDS - r) + j];
+            rk[4 * r + j] = (r == 0 || r == AES_ROUNDS) ? k : inv_mix_column(k);
+        }
+}
+
+static void ttable_decrypt_block(const aes_sw *ctx, uint8_t *out, const uint8_t *in)
+{
+    const uint32_t *rk = ctx->rk.td;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int r, c;
+
+    s0 = GET_32BIT_MSB_FIRST(in) ^ rk[0];
+    s1 = GET_32BIT_MSB_FIRST(in + 4) ^ rk[1];
+    s2 = GET_32BIT_MSB_FIRST(in + 8) ^ rk[2];
+    s3 = GET_32BIT_MSB_FIRST(in + 12) ^ rk[3];
+
+    for (r = 1; r < AES_ROUNDS; r++) {
+        rk += 4;
+        t0 = Td[0][s0 >> 24] ^ Td[1][(s3 >> 16) & 0xff] ^ Td[2][(s2 >> 8) & 0xff] ^ Td[3][s1 & 0xff] ^ rk[0];
+        t1 = Td[0][s1 >> 24] ^ Td[1][(s0 >> 16) & 0xff] ^ Td[2][(s3 >> 8) & 0xff] ^ Td[3][s2 & 0xff] ^ rk[1];
+        t2 = Td[0][s2 >> 24] ^ Td[1][(s1 >> 16) & 0xff] ^ Td[2][(s0 >> 8) & 0xff] ^ Td[3][s3 & 0xff] ^ rk[2];
+        t3 = Td[0][s3 >> 24] ^ Td[1][(s2 >> 16) & 0xff] ^ Td[2][(s1 >> 8) & 0xff] ^ Td[3][s0 & 0xff] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    rk += 4;
+#define LAST(a, b, c, d) \
+    (((uint32_t)inv_sbox[(a) >> 24] << 24) | ((uint32_t)inv_sbox[((b) >> 16) & 0xff] << 16) | \
+     ((uint32_t)inv_sbox[((c) >> 8) & 0xff] << 8) | inv_sbox[(d) & 0xff])
+    t0 = LAST(s0, s3, s2, s1) ^ rk[0];
+    t1 = LAST(s1, s0, s3, s2) ^ rk[1];
+    t2 = LAST(s2, s1, s0, s3) ^ rk[2];
+    t3 = LAST(s3, s2, s1, s0) ^ rk[3];
+#undef LAST
+
+    /* column c, row r of the state is plaintext byte 4r+c, see Transform in protectSong */
+    for (c = 0; c < 4; c++) {
+        uint32_t t = (c == 0) ? t0 : (c == 1) ? t1 : (c == 2) ? t2 : t3;
+        out[c] = t >> 24;
+        out[4 + c] = t >> 16;
+        out[8 + c] = t >> 8;
+        out[12 + c] = t;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Bitsliced variant. Bit j of every plane is byte j of the pair of
+ * blocks, so bits 0-15 are the first block and 16-31 the second, and
+ * within a block bit 4c+r is column c, row r.
+ */
+
+#define ROW_MASK 0x11111111u
+
+static void bs_load(uint32_t q[8], const uint8_t *in, size_t n)
+{
+    size_t j;
+    int b;
+
+    memzero(q, 8 * sizeof(uint32_t));
+    for (j = 0; j < n; j++)
+        for (b = 0; b < 8; b++)
+            q[b] |= (uint32_t)((in[j] >> b) & 1) << j;
+}
+
+static void bs_store(uint8_t *out, const uint32_t q[8], size_t n)
+{
+    size_t j, i;
+    uint8_t x;
+    int b;
+
+    for (j = 0; j < n; j++) {
+        x = 0;
+        for (b = 0; b < 8; b++)
+            x |= ((q[b] >> j) & 1) << b;
+        i = j & 15;
+        out[(j & ~(size_t)15) | ((i & 3) << 2) | (i >> 2)] = x;
+    }
+}
+
+static void bs_add_round_key(uint32_t q[8], const uint32_t rk[8])
+{
+    int b;
+    for (b = 0; b < 8; b++)
+        q[b] ^= rk[b];
+}
+
+/* moves every column <s>/4 places right, within each block */
+static uint32_t bs_rot_cols(uint32_t x, int s)
+{
+    uint32_t hi = ((0xffffu << s) & 0xffffu) * 0x10001u;
+    return ((x << s) & hi) | ((x >> (16 - s)) & ~hi);
+}
+
+/* row r takes the value of row r+k, within each column */
+static uint32_t bs_rot_rows(uint32_t x, int k)
+{
+    uint32_t lo = (0xfu >> k) * ROW_MASK;
+    return ((x >> k) & lo) | ((x << (4 - k)) & ~lo);
+}
+
+static void bs_inv_shift_rows(uint32_t q[8])
+{
+    int b;
+    for (b = 0; b < 8; b++) {
+        uint32_t x = q[b];
+        q[b] = (x & ROW_MASK) | bs_rot_cols(x & (ROW_MASK << 1), 4) |
+               bs_rot_cols(x & (ROW_MASK << 2), 8) | bs_rot_cols(x & (ROW_MASK << 3), 12);
+    }
+}
+
+static void bs_xtime(uint32_t a[8])
+{
+    uint32_t hi = a[7];
+    a[7] = a[6];
+    a[6] = a[5];
+    a[5] = a[4];
+    a[4] = a[3] ^ hi;
+    a[3] = a[2] ^ hi;
+    a[2] = a[1];
+    a[1] = a[0] ^ hi;
+    a[0] = hi;
+}
+
+static void bs_inv_mix_columns(uint32_t q[8])
+{
+    uint32_t u[8];
+    int b;
+
+    /*
+     * 0e.a0 ^ 0b.a1 ^ 0d.a2 ^ 09.a3 regrouped by powers of x:
+     * x^3(a0^a1^a2^a3) ^ x^2(a0^a2) ^ x(a0^a1) ^ (a1^a2^a3)
+     */
+    for (b = 0; b < 8; b++)
+        u[b] = q[b] ^ bs_rot_rows(q[b], 1) ^ bs_rot_rows(q[b], 2) ^ bs_rot_rows(q[b], 3);
+    bs_xtime(u);
+    for (b = 0; b < 8; b++)
+        u[b] ^= q[b] ^ bs_rot_rows(q[b], 2);
+    bs_xtime(u);
+    for (b = 0; b < 8; b++)
+        u[b] ^= q[b] ^ bs_rot_rows(q[b], 1);
+    bs_xtime(u);
+    for (b = 0; b < 8; b++)
+        q[b] = u[b] ^ bs_rot_rows(q[b], 1) ^ bs_rot_rows(q[b], 2) ^ bs_rot_rows(q[b], 3);
+}
+
+/*
+ * The forward S-box as a 113 gate circuit (Boyar and Peralta, "A depth-16
+ * circuit for the AES S-box"), on planes indexed from the most
+ * significant bit down.
+ */
+static void bs_sbox(uint32_t q[8])
+{
+    uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+    uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11;
+    uint32_t y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+    uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11;
+    uint32_t z12, z13, z14, z15, z16, z17;
+    uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11;
+    uint32_t t12, t13, t14, t15, t16, t17, t18, t19, t20, t21;
+    uint32_t t22, t23, t24, t25, t26, t27, t28, t29, t30, t31;
+    uint32_t t32, t33, t34, t35, t36, t37, t38, t39, t40, t41;
+    uint32_t t42, t43, t44, t45, t46, t47, t48, t49, t50, t51;
+    uint32_t t52, t53, t54, t55, t56, t57, t58, t59, t60, t61;
+    uint32_t t62, t63, t64, t65, t66, t67;
+
+    x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+    x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+    /* top linear transformation */
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    /* non-linear section */
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    /* bottom linear transformation */
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    q[7] = t59 ^ t63;
+    q[1] = t56 ^ ~t62;
+    q[0] = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    q[4] = t53 ^ t66;
+    q[3] = t51 ^ t66;
+    q[2] = t47 ^ t65;
+    q[6] = t64 ^ ~q[4];
+    q[5] = t55 ^ ~t67;
+}
+
+/*
+ * y = A(x^-1) + 63 for the forward S-box, so with the inverse affine map
+ * B(y) = A^-1(y + 63) the field inverse is B(S(x)) and InvSubBytes is B.S.B.
+ */
+static void bs_inv_affine(uint32_t q[8])
+{
+    uint32_t x[8];
+    int i;
+
+    for (i = 0; i < 8; i++)
+        x[i] = q[(i + 2) & 7] ^ q[(i + 5) & 7] ^ q[(i + 7) & 7];
+    for (i = 0; i < 8; i++)
+        q[i] = x[i];
+    q[0] = ~q[0];
+    q[2] = ~q[2];
+}
+
+static void bs_inv_sub_bytes(uint32_t q[8])
+{
+    bs_inv_affine(q);
+    bs_sbox(q);
+    bs_inv_affine(q);
+}
+
+static void bitsliced_init(aes_sw *ctx, const uint32_t w[4 * (AES_ROUNDS + 1)])
+{
+    uint8_t k[2 * AES_BLOCKSIZE];
+    int r, i;
+
+    /* the same round key goes in both block lanes */
+    for (r = 0; r <= AES_ROUNDS; r++) {
+        for (i = 0; i < AES_BLOCKSIZE; i++)
+            k[i] = k[AES_BLOCKSIZE + i] = w[4 * r + (i >> 2)] >> (24 - 8 * (i & 3));
+        bs_load(ctx->rk.bs[r], k, sizeof(k));
+    }
+    memzero(k, sizeof(k));
+}
+
+static void bitsliced_decrypt(const aes_sw *ctx, uint8_t *out, const uint8_t *in, size_t nbytes)
+{
+    uint32_t q[8];
+    int r;
+
+    bs_load(q, in, nbytes);
+    bs_add_round_key(q, ctx->rk.bs[AES_ROUNDS]);
+    for (r = AES_ROUNDS - 1; r > 0; r--) {
+        bs_inv_shift_rows(q);
+        bs_inv_sub_bytes(q);
+        bs_add_round_key(q, ctx->rk.bs[r]);
+        bs_inv_mix_columns(q);
+    }
+    bs_inv_shift_rows(q);
+    bs_inv_sub_bytes(q);
+    bs_add_round_key(q, ctx->rk.bs[0]);
+    bs_store(out, q, nbytes);
+}
+
+/* ---------------------------------------------------------------------- */
+
+bool aes_sw_init(aes_sw *ctx, const uint8_t key[AES_KEYSIZE], int variant)
+{
+    uint32_t w[4 * (AES_ROUNDS + 1)];
+
+    if (variant != AES_SW_TTABLE && variant != AES_SW_BITSLICED)
+        return false;
+    if (!tables_ready)
+        aes_tables_init();
+
+    aes_expand_key(w, key);
+    ctx->variant = variant;
+    if (variant == AES_SW_TTABLE)
+        ttable_init(ctx, w);
+    else
+        bitsliced_init(ctx, w);
+    memzero(w, sizeof(w));
+    return true;
+}
+
+void aes_sw_decrypt_blocks(const aes_sw *ctx, uint8_t *dest, const uint8_t *src, size_t nblocks)
+{
+    size_t n;
+
+    if (ctx->variant == AES_SW_TTABLE) {
+        for (; nblocks; nblocks--, src += AES_BLOCKSIZE, dest += AES_BLOCKSIZE)
+            ttable_decrypt_block(ctx, dest, src);
+        return;
+    }
+    while (nblocks) {
+        n = nblocks > 1 ? 2 : 1;
+        bitsliced_decrypt(ctx, dest, src, n * AES_BLOCKSIZE);
+        src += n * AES_BLOCKSIZE;
+        dest += n * AES_BLOCKSIZE;
+        nblocks -= n;
+    }
+}
+
+#endif // AES_SW_ENGINE
@@ -0,0 +1,43 @@
+#pragma once
+#ifndef AES_H
+#define AES_H
+//see aes.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+software aes-128 decryption, a stand-in for the XDecrypt hls core.
+it is only built with AES_SW_ENGINE defined (AES_SW_TTABLE or AES_SW_BITSLICED), in which case decrypt_data uses it
+instead of the core, eg for a block design without the core or to run the decrypt path off-board.
+
+it decrypts what protectSong writes, the same as the core does: the key and every 16 byte block are stored
+transposed (see Transform in protectSong), so the engine undoes that itself and callers do not Transpose first.
+*/
+
+#define AES_SW_TTABLE 1 //four 1k lookup tables, fastest, but the table reads depend on the key and data
+#define AES_SW_BITSLICED 2 //two blocks at a time as bit planes, no secret dependent memory access or branches
+
+#define AES_BLOCKSIZE 16
+#define AES_KEYSIZE 16
+#define AES_ROUNDS 10
+
+typedef struct {
+    int variant; //AES_SW_xyz
+    union {
+        uint32_t td[4 * (AES_ROUNDS + 1)]; //decryption round keys, last round first, for the t-table rounds
+        uint32_t bs[AES_ROUNDS + 1][8]; //encryption round keys as bit planes, both block lanes filled
+    } rk;
+} aes_sw;
+
+/*
+expands <key> (as stored in the region secrets) for <variant>.
+returns false if <variant> is not one of AES_SW_xyz.
+*/
+bool aes_sw_init(aes_sw *ctx, const uint8_t key[AES_KEYSIZE], int variant);
+/*
+decrypts <nblocks> 16 byte blocks from <src> into <dest>. <dest> may be <src>.
+*/
+void aes_sw_decrypt_blocks(const aes_sw *ctx, uint8_t *dest, const uint8_t *src, size_t nblocks);
+
+#endif // !AES_H
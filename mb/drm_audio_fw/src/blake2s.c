@@ -0,0 +1,172 @@
+/*
+ * BLAKE2s, written from RFC 7693. Only the sequential mode, keyed or not, is
+ * implemented; there is no salt or personalisation.
+ */
+#include "blake2s.h"
+#include "memops.h"
+
+static const uint32_t blake2s_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint8_t blake2s_sigma[10][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+    { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+    { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+    { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+    { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+};
+
+#define ror32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define GET_32BIT_LSB_FIRST(cp) \
+  (((uint32_t)(cp)[0]) | ((uint32_t)(cp)[1] << 8) | \
+   ((uint32_t)(cp)[2] << 16) | ((uint32_t)(cp)[3] << 24))
+
+#define G(a, b, c, d, x, y) do { \
+    v[a] = v[a] + v[b] + (x); v[d] = ror32(v[d] ^ v[a], 16); \
+    v[c] = v[c] + v[d];       v[b] = ror32(v[b] ^ v[c], 12); \
+    v[a] = v[a] + v[b] + (y); v[d] = ror32(v[d] ^ v[a], 8);  \
+    v[c] = v[c] + v[d];       v[b] = ror32(v[b] ^ v[c], 7);  \
+} while (0)
+
+static void blake2s_compress(BLAKE2S_State* s, const uint8_t* block, int last)
+{
+    uint32_t m[16], v[16];
+    int i, r;
+
+    for (i = 0; i < 16; i++)
+        m[i] = GET_32BIT_LSB_FIRST(block + 4 * i);
+    for (i = 0; i < 8; i++) {
+        v[i] = s->h[i];
+        v[i + 8] = blake2s_iv[i];
+    }
+    v[12] ^= s->t[0];
+    v[13] ^= s->t[1];
+    if (last)
+        v[14] = ~v[14];
+
+    for (r = 0; r < 10; r++) {
+        const uint8_t *sg = blake2s_sigma[r];
+        G(0, 4, 8, 12, m[sg[0]], m[sg[1]]);
+        G(1, 5, 9, 13, m[sg[2]], m[sg[3]]);
+        G(2, 6, 10, 14, m[sg[4]], m[sg[5]]);
+        G(3, 7, 11, 15, m[sg[6]], m[sg[7]]);
+        G(0, 5, 10, 15, m[sg[8]], m[sg[9]]);
+        G(1, 6, 11, 12, m[sg[10]], m[sg[11]]);
+        G(2, 7, 8, 13, m[sg[12]], m[sg[13]]);
+        G(3, 4, 9, 14, m[sg[14]], m[sg[15]]);
+    }
+
+    for (i = 0; i < 8; i++)
+        s->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void blake2s_count(BLAKE2S_State* s, uint32_t n)
+{
+    s->t[0] += n;
+    s->t[1] += (s->t[0] < n);
+}
+
+void blake2s_init_key(BLAKE2S_State* s, size_t outlen, const uint8_t* key, size_t keylen)
+{
+    int i;
+
+    memzero(s, sizeof(*s));
+    for (i = 0; i < 8; i++)
+        s->h[i] = blake2s_iv[i];
+    //parameter block: digest length, key length, fanout 1, depth 1
+    s->h[0] ^= 0x01010000 ^ (keylen << 8) ^ outlen;
+    s->outlen = outlen;
+
+    //the key is the first block of the message, zero padded
+    if (keylen) {
+        memcpy(s->buf, key, keylen);
+        s->buflen = BLAKE2S_BLOCKSIZE;
+    }
+}
+
+void blake2s_update(BLAKE2S_State* s, const uint8_t* msg, size_t msgsize)
+{
+    size_t n;
+
+    /*
+     * The final block is compressed differently, so a full buffer
+     * is only flushed once we know more data follows it.
+     */
+    while (msgsize) {
+        if (s->buflen == BLAKE2S_BLOCKSIZE) {
+            blake2s_count(s, BLAKE2S_BLOCKSIZE);
+            blake2s_compress(s, s->buf, 0);
+            s->buflen = 0;
+        }
+        if (s->buflen == 0) {
+            while (msgsize > BLAKE2S_BLOCKSIZE) {
+                blake2s_count(s, BLAKE2S_BLOCKSIZE);
+                blake2s_compress(s, msg, 0);
+                msg += BLAKE2S_BLOCKSIZE;
+                msgsize -= BLAKE2S_BLOCKSIZE;
+            }
+        }
+        n = BLAKE2S_BLOCKSIZE - s->buflen;
+        if (n > msgsize)
+            n = msgsize;
+        memcpy(s->buf + s->buflen, msg, n);
+        s->buflen += n;
+        msg += n;
+        msgsize -= n;
+    }
+}
+
+void blake2s_copy_update(BLAKE2S_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize)
+{
+    size_t n, i;
+
+    /*
+     * Copy a block at a time and compress it from the local copy
+     * while it is still fresh; the source is never read twice.
+     * A block with more data after it is compressed straight from
+     * dest rather than going through s->buf.
+     */
+    while (msgsize) {
+        n = msgsize < BLAKE2S_BLOCKSIZE ? msgsize : BLAKE2S_BLOCKSIZE;
+        if (n == BLAKE2S_BLOCKSIZE && !(((unsigned long) dest | (unsigned long) src) & 3)) {
+            for (i = 0; i < BLAKE2S_BLOCKSIZE / 4; i++)
+                ((uint32_t *) dest)[i] = ((const volatile uint32_t *) src)[i];
+        } else {
+            for (i = 0; i < n; i++)
+                dest[i] = src[i];
+        }
+        if (s->buflen == BLAKE2S_BLOCKSIZE) {
+            blake2s_count(s, BLAKE2S_BLOCKSIZE);
+            blake2s_compress(s, s->buf, 0);
+            s->buflen = 0;
+        }
+        if (s->buflen == 0 && msgsize > BLAKE2S_BLOCKSIZE) {
+            blake2s_count(s, BLAKE2S_BLOCKSIZE);
+            blake2s_compress(s, dest, 0);
+        } else {
+            blake2s_update(s, dest, n);
+        }
+        dest += n;
+        src += n;
+        msgsize -= n;
+    }
+}
+
+void blake2s_final(BLAKE2S_State* s, uint8_t* out)
+{
+    uint32_t i;
+
+    blake2s_count(s, s->buflen);
+    memzero(s->buf + s->buflen, BLAKE2S_BLOCKSIZE - s->buflen);
+    blake2s_compress(s, s->buf, 1);
+
+    for (i = 0; i < s->outlen; i++)
+        out[i] = (uint8_t)(s->h[i >> 2] >> (8 * (i & 3)));
+}
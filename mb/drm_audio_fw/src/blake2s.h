@@ -0,0 +1,41 @@
+#pragma once
+#ifndef BLAKE2S_H
+#define BLAKE2S_H
+//see blake2s.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+keyed blake2s (rfc 7693). all of its arithmetic is on 32-bit words, which suits the microblaze far better than sha2-512,
+and unlike hmac it takes the key directly, so a mac is one pass over the data instead of two hashes.
+*/
+
+#define BLAKE2S_BLOCKSIZE 64
+#define BLAKE2S_OUTSIZE 32 //the largest digest
+#define BLAKE2S_KEYSIZE 32 //the largest key
+
+typedef struct {
+    uint32_t h[8];
+    uint32_t t[2]; //bytes compressed so far
+    uint8_t buf[BLAKE2S_BLOCKSIZE];
+    uint32_t buflen;
+    uint32_t outlen;
+} BLAKE2S_State;
+
+/*
+starts a mac with a <keylen> byte key (1..BLAKE2S_KEYSIZE, or 0 for a plain hash) and an <outlen> byte digest
+(1..BLAKE2S_OUTSIZE).
+the digest size is part of the parameter block, so a 20 byte blake2s is not a truncated 32 byte one.
+*/
+void blake2s_init_key(BLAKE2S_State* s, size_t outlen, const uint8_t* key, size_t keylen);
+void blake2s_update(BLAKE2S_State* s, const uint8_t* msg, size_t msgsize);
+/*
+blake2s_update over <msgsize> bytes copied from <src> to <dest>, reading <src> only once.
+*/
+void blake2s_copy_update(BLAKE2S_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize);
+/*
+writes s->outlen bytes of digest to <out>.
+*/
+void blake2s_final(BLAKE2S_State* s, uint8_t* out);
+
+#endif // !BLAKE2S_H
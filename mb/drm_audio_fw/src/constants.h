@@ -20,6 +20,8 @@
 #define HMAC_SIG_SIZE 64
 
 #define SHARED_DDR_BASE (0x20000000 + 0x1CC00000)
+#define SHARED_DDR_SIZE (1<<25) //the reserved ddr the client maps through /dev/uio0. mipod_buffer has to fit in it.
+#define SHARED_DDR_NEXT_SLOT (SHARED_DDR_BASE + offsetof(mipod_buffer, next)) //the playlist slot, the second half of the song buffer
 
 // definition of sizes
 #define SONGID_LEN 16
@@ -31,12 +33,38 @@
 #define INVALID_UID -1
 #define INVALID_RID -1
 
+// drm file format versions
+#define DRM_VERSION_1 1 //original format: byte-per-entry acls, 84 byte segment trailers
+#define DRM_VERSION_2 2 //compact format: bitmap acls, 28 byte segment trailers
+#define DRM_MAGIC_V2 0x324d5244 //"DRM2". v1 headers start with the ascii song id, so they never match.
+#define USER_BITMAP_WORDS (MAX_SHARED_USERS / 32)
+#define MAX_SHARE_TARGETS 16 //the most users a single share command can take
+#define PHF_NONE 0xFFFF //an empty slot in the lookup tables createDevice generates
+#define SEG_CODEC_PCM 0 //segments hold the audio as it is
+#define SEG_CODEC_LPC 1 //segments hold lossless lpc blocks, see lpc.h
+#define SEG_CODEC_COUNT 2
+#define seg_format_mac(f) ((f) & 0x0F) //drm_header_v2.seg_format -> SEG_MAC_xyz
+#define seg_format_codec(f) ((f) >> 4) //drm_header_v2.seg_format -> SEG_CODEC_xyz
+
+// bitmaps are arrays of 32-bit words so the checks stay native on the microblaze
+#define bitmap_test(bm, i) ((bm)[(i) >> 5] & (1u << ((i) & 31)))
+#define bitmap_set(bm, i) ((bm)[(i) >> 5] |= (1u << ((i) & 31)))
+
 // song stuffs
-#define MAX_SONG_SZ (1<<25) //33554432 == 32 mib
-#define SEGMENT_BUF_SIZE 32000 //32000 + 128 KB
-#define CHUNK_SZ 16000
-#define SONGLEN_30S (mb_state.current_song_header.len_250ms * 4 * 30)
-#define SONGLEN_5S (mb_state.current_song_header.len_250ms * 4 * 5)
+#define MAX_SONG_SZ ((1<<25) - (1<<16)) //the largest file the client loads whole. the rest of SHARED_DDR_SIZE holds the control words and the trace.
+#define SONG_SLOT_SZ (MAX_SONG_SZ / 2) //each of the two slots a playlist alternates between, see mipod_song_slot
+#define SEGMENT_BUF_SIZE 32000 //the largest segment (without trailer) a song may use. v1 songs always use this size.
+#define SEGMENT_ALIGN 128 //segment data sizes are a multiple of this
+#define CHUNK_SZ 16000 //the largest dma chunk, ie half of the dma bram
+#define DMA_SLICE_SZ 2048 //bytes per dma transfer. playback commands wait at most this long (~11ms of 48khz 16 bit stereo)
+#define HEADER_CACHE_ENTRIES 4 //recently verified song headers kept in bram, see header_cache_find
+
+//scheduler events, see sched.h
+#define EV_COMMAND (1 << 0) //the client raised an interrupt
+#define EV_DMA (1 << 1) //the dma is idle, or there is a verified segment to decrypt into the bram
+#define EV_INGEST (1 << 2) //segment_buffer is free for the next segment
+#define SONGLEN_30S (mb_state.current_song.len_250ms * 4 * 30)
+#define SONGLEN_5S (mb_state.current_song.len_250ms * 4 * 5)
 
 #define PCM_DRV_BUFFER_SIZE 16000  // 0x3e80
 #define FIFO_CAP 4096*4
@@ -134,7 +162,26 @@ enum mipod_state {
     STATE_SUCCESS, //indicates an operation has completed successfully
     STATE_FAILED, //indicates an operation has failed
     STATE_PLAYING, //indicates that the firmware has started playing audio
-    STATE_PAUSED
+    STATE_PAUSED,
+    STATE_REJECTED //a command other than a playback one arrived while a song plays. it was not run, the song goes on.
+};
+
+// per-user outcome of a share command, see mipod_buffer.share_result
+enum share_result {
+    SHARE_NOT_DONE=0, //the command failed before this user was looked at
+    SHARE_OK, //the song is now shared with the user
+    SHARE_ALREADY, //the song was already shared with the user
+    SHARE_BADUSER //the user does not exist on this device, or owns the song
+};
+
+/*
+playlist handshake for gapless playback. the song being played lives in one slot and the next one is staged in the other.
+*/
+enum mipod_next_state {
+    NEXT_NONE=0, //nothing staged. set by the client before play, and by the firmware once it has switched to the staged song
+    NEXT_STAGED, //set by the client once the next song is loaded into the free slot
+    NEXT_READY, //set by the firmware once the staged header has been verified
+    NEXT_FAILED //set by the firmware if the staged song is invalid. it will not be played.
 };
 
 typedef struct __attribute__((__packed__)) {
@@ -170,6 +217,56 @@ typedef struct __attribute__((__packed__)) { //sizeof() 297
     uint8_t owner_sig[HMAC_SIG_SIZE]; //a signature (using the owner's private key) for all preceeding data. resets whenever new user is shared with.
 } drm_header;
 
+typedef struct __attribute__((__packed__)) { //sizeof() 220
+    uint32_t magic; //DRM_MAGIC_V2
+    uint8_t version; //DRM_VERSION_2
+    uint8_t ownerID; //the owner's uid.
+    uint8_t segment_units; //the data size of a full segment, in SEGMENT_ALIGN units. chosen at protect time.
+    uint8_t seg_format; //SEG_MAC_xyz, the algorithm the segment trailers are signed with, | SEG_CODEC_xyz << 4
+    uint8_t song_id[SONGID_LEN]; //a per-song unique ID.
+    uint32_t regions; //bitmap, bit <rid> is set if the song may be played in region <rid>.
+    //song metadata
+    uint32_t len_250ms;
+    uint32_t nr_segments;
+    uint32_t first_segment_size; //INcluding the (v2) trailer.
+    wav_header wavdata;
+    //validation and sharing
+    uint8_t mp_sig[HMAC_SIG_SIZE]; //a signature (using the mipod private key) for all preceeding data
+    uint32_t shared_users[USER_BITMAP_WORDS]; //bitmap, bit <uid> is set if the owner has shared the song with <uid>.
+    uint8_t owner_sig[HMAC_SIG_SIZE]; //a signature (using the owner's private key) for all preceeding data.
+} drm_header_v2;
+
+/*
+the on-disk header, in either format. only trusted once it has been copied into bram and verified.
+*/
+typedef union {
+    drm_header v1;
+    drm_header_v2 v2;
+} drm_file_header;
+
+/*
+format independent view of a drm header, filled in by load_song_header.
+*/
+typedef struct {
+    uint8_t version; //DRM_VERSION_x
+    uint8_t ownerID;
+    uint8_t song_id[SONGID_LEN];
+    uint32_t regions; //bitmap of rids
+    uint32_t shared_users[USER_BITMAP_WORDS]; //bitmap of uids
+    uint32_t len_250ms;
+    uint32_t nr_segments;
+    uint32_t first_segment_size;
+    uint32_t segment_size; //data size of a full segment, <= SEGMENT_BUF_SIZE
+    uint32_t chunk_size; //bytes handed to the dma at a time, <= CHUNK_SZ
+    uint32_t header_size; //on-disk size of the header, ie the offset of the first segment
+    uint32_t trailer_size; //on-disk size of each segment trailer
+    uint8_t seg_mac; //SEG_MAC_xyz
+    uint8_t codec; //SEG_CODEC_xyz
+    uint8_t channels, sample_bits; //of the audio, only checked for coded songs
+    uint32_t samplerate; //of the audio, songs at another rate than AUDIO_SAMPLING_RATE are resampled while playing
+    uint32_t audio_size; //bytes of audio, from the wav header
+} song_info;
+
 typedef struct {
     bool logged_in_user; // whether or not a user is logged on
     bool shared_current_song;
@@ -178,7 +275,11 @@ typedef struct {
     uint8_t pin_buffer[PIN_SIZE];   // logged on pin
     int32_t current_uid;
     uint32_t current_operation;
-    drm_header current_song_header; // current song metadata
+    drm_file_header current_song_header; // current song metadata, as loaded
+    song_info current_song; // current song metadata, parsed
+    drm_file_header next_song_header; // staged playlist song, verified while the current song plays
+    song_info next_song;
+    int32_t next_song_access; // SONG_xyz result for the staged song
     uint8_t music_op;
 } internal_state;
 
@@ -190,8 +291,15 @@ struct segment_trailer {  //sizeof() 84
     char _pad_[40]; //do not use this. for cryptographic padding purposes only. //40
 };
 
+struct segment_trailer_v2 { //sizeof() 28
+    uint32_t idx;           //4
+    uint32_t next_segment_size; //4
+    uint8_t sig[SEG_MAC_SIZE]; //20, mac of data || idx || next_segment_size || song id, see drm_header_v2.seg_format
+};
+
 struct {
     char a[0-!(sizeof(struct segment_trailer) == 84 && CIPHER_BLOCKSIZE == 64)]; //if the segment trailer requirements fail, this will break.
+    char b[0-!(sizeof(struct segment_trailer_v2) == 28 && sizeof(drm_header_v2) == 220)];
 };
 
 typedef struct {
@@ -210,6 +318,10 @@ typedef struct {
     char regions[MAX_SHARED_REGIONS * REGION_NAME_SZ];
     char song_regions[MAX_SHARED_REGIONS * REGION_NAME_SZ];
     char users_list[TOTAL_USERS][UNAME_SIZE]; //holds all valid users.
+    //every user and region this device knows by id, "" for unused ids. the client names song acls with these.
+    char user_names[MAX_SHARED_USERS][UNAME_SIZE];
+    char region_names[MAX_SHARED_REGIONS][REGION_NAME_SZ];
+    uint32_t region_mask; //the rids the device is provisioned for
     /*
     Initial boot output :
         mP> Regions: USA, Canada, Mexico\r\n` `mP> Authorized users: alice, bob, charlie, donna\r\n
@@ -221,6 +333,7 @@ typedef struct {
 
 typedef struct __attribute__((__packed__)) {
     uint32_t wav_size; //OUT: the used size. will always be <= the file size.
+    uint32_t ring_slots; //IN, 0 if the whole file is loaded. otherwise the song is streamed, see mipod_buffer.ring_head.
     mipod_play_data play_data;
 } mipod_digital_data ;
 
@@ -229,17 +342,93 @@ typedef struct __attribute__((__packed__)) {
     drm_header drm; //we don't actually need anything but the file header for this.
 } mipod_share_data;
 
+// trace events both sides record for the client to dump, see mipod_buffer.trace
+#define TRACE_EVENTS 1024 //per processor
+#define TRACE_TICK_MS 1 //how often the client publishes its clock while a song plays, see mipod_trace
+enum trace_id {
+    TRACE_DOORBELL=0, //the client ringing the gpio interrupt, arg is the operation
+    TRACE_WAIT, //the client waiting for a command to complete, arg is the operation
+    TRACE_LOAD, //the client reading a song into shared memory, arg is the slot
+    TRACE_REFILL, //the client streaming a segment into the ring, arg is its index
+    TRACE_COMMAND, //the firmware handling a command, from picking it up to completing it. arg is the operation.
+    TRACE_HEADER, //the firmware verifying a song header
+    TRACE_SEGMENT, //the firmware copying in and authenticating a segment, arg is its index
+    TRACE_FIRST_DMA, //the firmware starting the first dma transfer of a play command
+    TRACE_FIRST_SAMPLE, //that transfer is done, ie the first audio is in the codec's fifo
+    TRACE_PLAYBACK, //the firmware playing a song, arg is its slot
+    NR_TRACE_IDS
+};
+enum trace_phase { //the "ph" of the event in a chrome trace
+    TRACE_BEGIN='B',
+    TRACE_END='E',
+    TRACE_INSTANT='i'
+};
+
+typedef struct __attribute__((__packed__)) { //sizeof() = 12
+    uint32_t ts; //microseconds on the client's clock, see mipod_trace.clock
+    uint16_t id; //enum trace_id
+    uint8_t ph; //enum trace_phase
+    uint8_t pad;
+    uint32_t arg;
+} trace_record;
+
+/*
+one ring of events per processor, each with a single writer. the firmware has no timer, so the client publishes its
+clock in <clock> whenever it waits on the firmware, and the firmware stamps its events with the last value it saw.
+*/
+typedef struct __attribute__((__packed__)) {
+    uint32_t clock; //IN, microseconds since the client started
+    uint32_t arm_head; //IN, the number of events the client has recorded. event i is in arm[i % TRACE_EVENTS].
+    uint32_t mb_head; //OUT, the same for the firmware's events
+    trace_record arm[TRACE_EVENTS];
+    trace_record mb[TRACE_EVENTS];
+} mipod_trace;
+
+//the next song of a playlist, staged while the current one plays. see mipod_buffer.play_slot.
+typedef volatile struct __attribute__((__packed__)) {
+    union {
+        mipod_digital_data digital_data;
+        char buf[SONG_SLOT_SZ];
+    };
+}mipod_song_slot;
+
 typedef volatile struct __attribute__((__packed__)) {
     uint32_t operation; //IN, the operation id from enum mipod_ops
     uint32_t status; //OUT, the completion status of the command. DO NOT read this field.
-    char shared_user[UNAME_SIZE];
+    uint32_t share_count; //IN, the number of names in shared_users
+    char shared_users[MAX_SHARE_TARGETS][UNAME_SIZE]; //IN, the users to share the song with
+    uint8_t share_result[MAX_SHARE_TARGETS]; //OUT, enum share_result for each of shared_users
+    uint32_t play_slot; //OUT, the slot the song being played is in. 0 is digital_data below, 1 is the mipod_song_slot.
+    uint32_t next_state; //IN/OUT, enum mipod_next_state
+    uint32_t ring_head; //IN, the segments of a streamed song before this one are in the ring
+    uint32_t ring_tail; //OUT, the first segment still needed. the ring slots of the ones before it may be refilled.
+    uint32_t ring_seek; //OUT, bumped when playback jumps to ring_tail. ring_head is not trusted until it is acked.
+    uint32_t ring_ack; //IN, set to ring_seek once ring_head has been moved to ring_tail
     union {
         mipod_login_data login_data;
         mipod_query_data query_data;
         mipod_digital_data digital_data;
         char buf[MAX_SONG_SZ];
+        struct __attribute__((__packed__)) {
+            char slot0[SONG_SLOT_SZ]; //digital_data, when it is slot 0 of a playlist
+            mipod_song_slot next; //slot 1. a song loaded whole outside of a playlist may run into it.
+        };
     };
+    mipod_trace trace; //IN/OUT, see mipod_trace. the client does not clear it at startup.
 }mipod_buffer;
+#define MIPOD_CTRL_SZ offsetof(mipod_buffer, buf) //the control words in front of the payload, polled by both sides
+_Static_assert(sizeof(mipod_buffer) <= SHARED_DDR_SIZE, "the shared buffer does not fit the reserved ddr");
+
+/*
+a streamed song only keeps its header and a ring of <ring_slots> segments in its slot, so songs of any length play
+from a fixed amount of shared memory. segment <i> sits at ring slot i % ring_slots, each slot holding a full
+segment (the first_segment_size of the song) right after the header.
+the client writes segments in order and bumps ring_head after each one, as long as ring_head - ring_tail < ring_slots.
+the firmware only loads segment <i> once i < ring_head, and bumps ring_tail once its copy of it is done.
+a seek moves ring_tail to wherever playback continues and bumps ring_seek. the client then restarts from there by
+setting ring_head = ring_tail and only then ring_ack = ring_seek, so a ring_head written before the seek is never used.
+*/
+#define ring_segment_offset(idx, slots, stride) ((size_t)((idx) % (slots)) * (stride))
 
 
 #endif // !CONSTANTS_H
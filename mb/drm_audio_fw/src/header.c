@@ -0,0 +1,130 @@
+#include "header.h"
+#include "memops.h"
+
+bool parse_song_header(drm_file_header *hdr, song_info *song) {
+    clear_obj(*song);
+    if (hdr->v2.magic == DRM_MAGIC_V2) {
+        if (hdr->v2.version != DRM_VERSION_2)
+            return false;
+        song->version = DRM_VERSION_2;
+        song->ownerID = hdr->v2.ownerID;
+        memcpy(song->song_id, hdr->v2.song_id, SONGID_LEN);
+        song->regions = hdr->v2.regions;
+        memcpy(song->shared_users, hdr->v2.shared_users, sizeof(song->shared_users));
+        song->len_250ms = hdr->v2.len_250ms;
+        song->nr_segments = hdr->v2.nr_segments;
+        song->first_segment_size = hdr->v2.first_segment_size;
+        song->segment_size = hdr->v2.segment_units * SEGMENT_ALIGN;
+        song->seg_mac = seg_format_mac(hdr->v2.seg_format);
+        song->codec = seg_format_codec(hdr->v2.seg_format);
+        if (song->seg_mac >= SEG_MAC_COUNT || song->codec >= SEG_CODEC_COUNT)
+            return false;
+        song->channels = hdr->v2.wavdata.n_channels;
+        song->sample_bits = hdr->v2.wavdata.bits_per_sample;
+        song->samplerate = hdr->v2.wavdata.samplerate;
+        song->audio_size = hdr->v2.wavdata.chunk_size - sizeof(wav_header) + 8;
+        song->header_size = sizeof(drm_header_v2);
+        song->trailer_size = sizeof(struct segment_trailer_v2);
+    } else {
+        song->version = DRM_VERSION_1;
+        song->ownerID = hdr->v1.ownerID;
+        memcpy(song->song_id, hdr->v1.song_id, SONGID_LEN);
+        //v1 region lists are zero padded, and the padding has always matched region 0.
+        for (size_t i = 0; i < MAX_SHARED_REGIONS; ++i)
+            if (hdr->v1.regions[i] < MAX_SHARED_REGIONS)
+                song->regions |= 1u << hdr->v1.regions[i];
+        for (size_t i = 0; i < MAX_SHARED_USERS; ++i)
+            if (hdr->v1.shared_users[i] == 1)
+                bitmap_set(song->shared_users, i);
+        song->len_250ms = hdr->v1.len_250ms;
+        song->nr_segments = hdr->v1.nr_segments;
+        song->first_segment_size = hdr->v1.first_segment_size;
+        song->segment_size = SEGMENT_BUF_SIZE;
+        song->seg_mac = SEG_MAC_HMAC_SHA1;
+        song->codec = SEG_CODEC_PCM;
+        song->channels = hdr->v1.wavdata.n_channels;
+        song->sample_bits = hdr->v1.wavdata.bits_per_sample;
+        song->samplerate = hdr->v1.wavdata.samplerate;
+        song->audio_size = hdr->v1.wavdata.chunk_size - sizeof(wav_header) + 8;
+        song->header_size = sizeof(drm_header);
+        song->trailer_size = sizeof(struct segment_trailer);
+    }
+
+    //the segment size sets our buffering, so it must fit what we have room for
+    if (!song->segment_size || song->segment_size > SEGMENT_BUF_SIZE)
+        return false;
+    //the decoder only knows the formats protectSong codes
+    if (song->codec == SEG_CODEC_LPC && ((song->channels != 1 && song->channels != 2) || (song->sample_bits != 8 && song->sample_bits != 16)))
+        return false;
+    //ping-pong the dma bram in halves of a segment, so smaller segments get lower command latency
+    song->chunk_size = min(song->segment_size / 2, CHUNK_SZ);
+    return true;
+}
+
+size_t mp_sig_offset(song_info *song) {
+    return (song->version == DRM_VERSION_2) ? offsetof(drm_header_v2, mp_sig) : offsetof(drm_header, mp_sig);
+}
+
+size_t owner_sig_offset(song_info *song) {
+    return (song->version == DRM_VERSION_2) ? offsetof(drm_header_v2, owner_sig) : offsetof(drm_header, owner_sig);
+}
+
+/*
+headers whose signatures were checked recently, so replaying a song does not redo the sha512 hmacs.
+entries are only ever copied from, and compared against, the bram copy of a header, never shared memory.
+an entry is keyed by the header's mipod signature (itself a digest of the header) and only matches
+if every byte of the header is identical.
+*/
+static struct {
+    drm_file_header hdr;
+    uint32_t size; //header_size of the cached header, 0 for an unused entry
+    bool user_ok; //the owner signature was verified as well, not just the mipod one
+} header_cache[HEADER_CACHE_ENTRIES];
+static uint32_t header_cache_next; //round robin replacement
+static uint32_t header_cache_hits, header_cache_misses;
+
+int header_cache_find(drm_file_header *hdr, song_info *song) {
+    size_t sig = mp_sig_offset(song);
+
+    for (int i = 0; i < HEADER_CACHE_ENTRIES; i++) {
+        if (header_cache[i].size != song->header_size)
+            continue;
+        if (memcmp((uint8_t *)&header_cache[i].hdr + sig, (uint8_t *)hdr + sig, HMAC_SIG_SIZE))
+            continue;
+        if (!memcmp(&header_cache[i].hdr, hdr, song->header_size)) {
+            header_cache_hits++;
+            return i;
+        }
+    }
+    header_cache_misses++;
+    return -1;
+}
+
+int header_cache_add(drm_file_header *hdr, song_info *song, bool user_ok) {
+    int i = header_cache_next++ % HEADER_CACHE_ENTRIES;
+
+    memcpy(&header_cache[i].hdr, hdr, song->header_size);
+    header_cache[i].size = song->header_size;
+    header_cache[i].user_ok = user_ok;
+    return i;
+}
+
+void header_cache_clear(void) {
+    clear_obj(header_cache);
+#ifdef HEADER_CACHE_STATS
+    mb_debug("header cache: %d hits, %d misses\r\n", header_cache_hits, header_cache_misses);
+#endif
+}
+
+bool header_cache_user_ok(int i) {
+    return header_cache[i].user_ok;
+}
+
+void header_cache_set_user_ok(int i) {
+    header_cache[i].user_ok = true;
+}
+
+void header_cache_stats(uint32_t *hits, uint32_t *misses) {
+    *hits = header_cache_hits;
+    *misses = header_cache_misses;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#ifndef HEADER_H
+#define HEADER_H
+//see header.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "constants.h"
+
+/*
+song headers in both drm file formats, as far as they can be handled without the keys.
+the signatures themselves are checked in main.c, this only knows where they are and which headers passed.
+*/
+
+/*
+fills in <song> from the raw header <hdr>.
+this does NOT check any signatures.
+returns false if the header is not in a known format.
+*/
+bool parse_song_header(drm_file_header *hdr, song_info *song);
+/*
+offset of the mipod signature within a song header.
+*/
+size_t mp_sig_offset(song_info *song);
+/*
+offset of the owner signature within a song header.
+*/
+size_t owner_sig_offset(song_info *song);
+
+/*
+the cache of song headers whose signatures were checked, in bram (HEADER_CACHE_ENTRIES of them).
+*/
+
+/*
+returns the cache entry holding exactly <hdr>, parsed into <song>, or -1.
+*/
+int header_cache_find(drm_file_header *hdr, song_info *song);
+/*
+remembers that <hdr> passed the mipod signature check, and the owner one if <user_ok>.
+returns the entry used.
+*/
+int header_cache_add(drm_file_header *hdr, song_info *song, bool user_ok);
+/*
+whether the owner signature of the header in entry <i> was verified as well.
+*/
+bool header_cache_user_ok(int i);
+/*
+records that the owner signature of the header in entry <i> was verified.
+*/
+void header_cache_set_user_ok(int i);
+/*
+forgets all verified headers, on logout and when a share re-signs the current one.
+*/
+void header_cache_clear(void);
+/*
+the number of header_cache_find calls that hit and missed since boot.
+*/
+void header_cache_stats(uint32_t *hits, uint32_t *misses);
+
+#endif // !HEADER_H
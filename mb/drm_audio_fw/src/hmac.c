@@ -75,3 +75,82 @@ void hmac(uint8_t key[HASH_BLKSIZE], const uint8_t* msg, size_t msgsize, uint8_t
     SHA512_Final(&state, out);
 }
 
+
+void hmac_sha1_init(HMAC_SHA1_State* s, uint8_t key[HASH_BLKSIZE]) {
+    unsigned char k_ipad[KEY_IOPAD_SIZE];
+    unsigned char k_opad[KEY_IOPAD_SIZE];
+
+    memcpy(k_ipad, key, HASH_BLKSIZE);
+    memcpy(k_opad, key, HASH_BLKSIZE);
+    for (int i = 0; i < KEY_IOPAD_SIZE; i++) {
+        k_ipad[i] ^= 0x36;
+        k_opad[i] ^= 0x5c;
+    }
+
+    //both pads are absorbed up front so the key does not need to be kept around
+    SHA_Init(&s->inner);
+    SHA_Bytes(&s->inner, k_ipad, KEY_IOPAD_SIZE);
+    SHA_Init(&s->outer);
+    SHA_Bytes(&s->outer, k_opad, KEY_IOPAD_SIZE);
+}
+
+void hmac_sha1_update(HMAC_SHA1_State* s, const uint8_t* msg, size_t msgsize) {
+    SHA_Bytes(&s->inner, msg, msgsize);
+}
+
+void hmac_sha1_copy_update(HMAC_SHA1_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize) {
+    SHA_CopyBytes(&s->inner, dest, src, msgsize);
+}
+
+void hmac_sha1_final(HMAC_SHA1_State* s, uint8_t out[SHA1_DIGEST_SIZE]) {
+    SHA_Final(&s->inner, out);
+    SHA_Bytes(&s->outer, out, SHA1_DIGEST_SIZE);
+    SHA_Final(&s->outer, out);
+}
+
+
+static void seg_sha1_init(SEG_MAC_State* s, uint8_t key[HASH_BLKSIZE]) {
+    hmac_sha1_init(&s->u.sha1, key);
+}
+
+static void seg_sha1_update(SEG_MAC_State* s, const uint8_t* msg, size_t msgsize) {
+    hmac_sha1_update(&s->u.sha1, msg, msgsize);
+}
+
+static void seg_sha1_copy_update(SEG_MAC_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize) {
+    hmac_sha1_copy_update(&s->u.sha1, dest, src, msgsize);
+}
+
+static void seg_sha1_final(SEG_MAC_State* s, uint8_t out[SEG_MAC_SIZE]) {
+    hmac_sha1_final(&s->u.sha1, out);
+}
+
+static void seg_b2s_init(SEG_MAC_State* s, uint8_t key[HASH_BLKSIZE]) {
+    blake2s_init_key(&s->u.b2s, SEG_MAC_SIZE, key, BLAKE2S_KEYSIZE);
+}
+
+static void seg_b2s_update(SEG_MAC_State* s, const uint8_t* msg, size_t msgsize) {
+    blake2s_update(&s->u.b2s, msg, msgsize);
+}
+
+static void seg_b2s_copy_update(SEG_MAC_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize) {
+    blake2s_copy_update(&s->u.b2s, dest, src, msgsize);
+}
+
+static void seg_b2s_final(SEG_MAC_State* s, uint8_t out[SEG_MAC_SIZE]) {
+    blake2s_final(&s->u.b2s, out);
+}
+
+//indexed by SEG_MAC_xyz
+static const seg_mac_ops seg_macs[SEG_MAC_COUNT] = {
+    { seg_sha1_init, seg_sha1_update, seg_sha1_copy_update, seg_sha1_final },
+    { seg_b2s_init, seg_b2s_update, seg_b2s_copy_update, seg_b2s_final },
+};
+
+bool seg_mac_init(SEG_MAC_State* s, uint8_t alg, uint8_t key[HASH_BLKSIZE]) {
+    if (alg >= SEG_MAC_COUNT)
+        return false;
+    s->ops = &seg_macs[alg];
+    s->ops->init(s, key);
+    return true;
+}
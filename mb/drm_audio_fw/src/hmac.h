@@ -5,6 +5,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include "sha1.h"
+#include "blake2s.h"
 
 //below uses SHA2-512 from libsodium. would like to use SHA3-512 at some point but oh well
 #define   SHA1_DIGEST_SIZE  20
@@ -26,4 +29,54 @@ computes a sha2-512 hmac of <msg> using <key> into <out>
 void hmac(uint8_t key[HASH_BLKSIZE], const uint8_t* msg, size_t msgsize, uint8_t out[SHA512_DIGEST_SIZE]);
 void hmac_sha1(uint8_t key[HASH_BLKSIZE], const uint8_t* msg, size_t msgsize, uint8_t out[SHA1_DIGEST_SIZE]);
 
+/*
+incremental sha1 hmac, for messages that are not contiguous in memory.
+hmac_sha1_init + any number of hmac_sha1_update + hmac_sha1_final == hmac_sha1 over the concatenated pieces.
+*/
+typedef struct {
+    SHA_State inner;
+    SHA_State outer;
+} HMAC_SHA1_State;
+void hmac_sha1_init(HMAC_SHA1_State* s, uint8_t key[HASH_BLKSIZE]);
+void hmac_sha1_update(HMAC_SHA1_State* s, const uint8_t* msg, size_t msgsize);
+void hmac_sha1_final(HMAC_SHA1_State* s, uint8_t out[SHA1_DIGEST_SIZE]);
+/*
+hmac_sha1_update over <msgsize> bytes copied from <src> to <dest>, reading <src> only once.
+the mac covers exactly what was written to <dest>.
+*/
+void hmac_sha1_copy_update(HMAC_SHA1_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize);
+
+/*
+segment macs. the algorithm is picked per song (drm_header_v2.seg_format), every one of them is keyed with the
+mipod key and produces SEG_MAC_SIZE bytes, so the trailer layout does not depend on the choice.
+adding an algorithm is a new SEG_MAC_xyz id, a member of the state union and an entry in seg_macs (hmac.c).
+*/
+#define SEG_MAC_SIZE SHA1_DIGEST_SIZE
+#define SEG_MAC_HMAC_SHA1 0 //hmac-sha1, the only choice for v1 songs
+#define SEG_MAC_BLAKE2S 1 //keyed blake2s with a 20 byte digest, keyed with the first 32 bytes of the key
+#define SEG_MAC_COUNT 2
+
+typedef struct seg_mac_ops seg_mac_ops;
+typedef struct {
+    const seg_mac_ops* ops;
+    union {
+        HMAC_SHA1_State sha1;
+        BLAKE2S_State b2s;
+    } u;
+} SEG_MAC_State;
+struct seg_mac_ops {
+    void (*init)(SEG_MAC_State* s, uint8_t key[HASH_BLKSIZE]);
+    void (*update)(SEG_MAC_State* s, const uint8_t* msg, size_t msgsize);
+    void (*copy_update)(SEG_MAC_State* s, uint8_t* dest, const volatile uint8_t* src, size_t msgsize);
+    void (*final)(SEG_MAC_State* s, uint8_t out[SEG_MAC_SIZE]);
+};
+
+/*
+starts a segment mac with algorithm <alg>. returns false if <alg> is not one we know.
+*/
+bool seg_mac_init(SEG_MAC_State* s, uint8_t alg, uint8_t key[HASH_BLKSIZE]);
+#define seg_mac_update(s_, msg_, n_) ((s_)->ops->update((s_), (msg_), (n_)))
+#define seg_mac_copy_update(s_, dest_, src_, n_) ((s_)->ops->copy_update((s_), (dest_), (src_), (n_)))
+#define seg_mac_final(s_, out_) ((s_)->ops->final((s_), (out_)))
+
 #endif // !PBKDF2_H
@@ -0,0 +1,72 @@
+#include "ingest.h"
+#include "memops.h"
+#include "xparameters.h"
+#include "xil_types.h"
+#include "xil_mem.h"
+
+/*
+the transfer in flight, and how far the copy has got.
+*/
+static struct {
+    bool busy;
+    uint8_t *dest;
+    const volatile uint8_t *src;
+    size_t len, done;
+    SEG_MAC_State *mac;
+    size_t mac_len;
+    ingest_stats stats;
+} xfer;
+static ingest_stats last;
+
+bool ingest_init(void) {
+    memzero(&xfer, sizeof(xfer));
+    memzero(&last, sizeof(last));
+    return true;
+}
+
+bool ingest_start_mac(void *local_dest, const volatile void *arm_src, size_t n, SEG_MAC_State *mac, size_t mac_len) {
+    while (!ingest_poll()); //never let two transfers write the same buffer
+
+    xfer.dest = local_dest;
+    xfer.src = arm_src;
+    xfer.len = n;
+    xfer.done = 0;
+    xfer.mac = mac;
+    xfer.mac_len = mac ? (mac_len < n ? mac_len : n) : 0;
+    memzero(&xfer.stats, sizeof(xfer.stats));
+    xfer.stats.bytes = n;
+
+    shm_invalidate(arm_src, n);
+    xfer.busy = true;
+    return true;
+}
+
+bool ingest_poll(void) {
+    if (!xfer.busy)
+        return true;
+    xfer.stats.polls++;
+
+    size_t n = xfer.len - xfer.done, m = 0;
+    if (n > INGEST_SLICE_SZ)
+        n = INGEST_SLICE_SZ;
+    if (xfer.done < xfer.mac_len) { //the part that is covered by the mac is hashed as it is copied
+        m = xfer.mac_len - xfer.done;
+        if (m > n)
+            m = n;
+        seg_mac_copy_update(xfer.mac, xfer.dest + xfer.done, xfer.src + xfer.done, m);
+        xfer.stats.mac_bytes += m;
+    }
+    if (n > m)
+        Xil_MemCpy(xfer.dest + xfer.done + m, (const void *)(xfer.src + xfer.done + m), n - m);
+    xfer.done += n;
+    xfer.stats.cpu_bytes += n;
+    if (xfer.done < xfer.len)
+        return false;
+    xfer.busy = false;
+    last = xfer.stats;
+    return true;
+}
+
+const ingest_stats *ingest_last_stats(void) {
+    return &last;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#ifndef INGEST_H
+#define INGEST_H
+//see ingest.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "hmac.h"
+
+/*
+segment ingest: moves a segment out of the shared ddr window into local memory.
+a transfer is kicked with ingest_start_mac and driven to completion by ingest_poll, so the caller can do other work
+(commands, dma refill, verifying something else) while it runs.
+
+the engine is the cpu, copying INGEST_SLICE_SZ bytes per ingest_poll call. it can also mac the data on the way
+in (see seg_mac_copy_update), so the shared memory is read once and the mac is ready when the copy ends.
+*/
+
+#define INGEST_SLICE_SZ 4096 //bytes the software engine copies per poll. a multiple of the sha1 block size.
+
+/*
+what the last transfer cost the cpu.
+*/
+typedef struct {
+    uint32_t bytes; //size of the transfer
+    uint32_t cpu_bytes; //bytes the cpu had to move itself
+    uint32_t polls; //ingest_poll calls until the transfer was done
+    uint32_t mac_bytes; //bytes absorbed into the mac while copying
+} ingest_stats;
+
+/*
+sets up the copy engine. returns false if it could not be initialised.
+*/
+bool ingest_init(void);
+/*
+starts copying <n> bytes from the shared memory at <arm_src> to <local_dest>. the first <mac_len> bytes are also
+absorbed into <mac>, which has to be initialised already, unless <mac> is NULL.
+the mac only ever covers the local copy, never the shared memory.
+a transfer that is still running is finished first.
+returns false if the transfer could not be started.
+*/
+bool ingest_start_mac(void *local_dest, const volatile void *arm_src, size_t n, SEG_MAC_State *mac, size_t mac_len);
+/*
+moves the current transfer along. returns true once no transfer is running.
+*/
+bool ingest_poll(void);
+/*
+the cost of the last completed transfer.
+*/
+const ingest_stats *ingest_last_stats(void);
+
+#endif // !INGEST_H
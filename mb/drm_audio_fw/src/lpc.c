@@ -0,0 +1,195 @@
+/*
+ * Decoder for the lossless LPC codec, see lpc.h for the format.
+ *
+ * Each channel of a block is rebuilt in a 32-bit work buffer, then
+ * interleaved into the output as pcm bytes. The reader keeps up to 32
+ * bits read ahead, msb first, so a rice code is a count of leading
+ * zeros plus one shift, and the predictor is unrolled by order.
+ */
+#include "lpc.h"
+#include "memops.h"
+#include "pcm.h"
+
+#define min(a,b) (((a)<(b))?(a):(b))
+#define sign_extend(v, n) ((int32_t)((v) << (32 - (n))) >> (32 - (n)))
+
+static int32_t work[2][LPC_BLOCK_FRAMES];
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//tops the read ahead up to at least 25 bits. past the end it reads zeros, lpc_decode checks for that once per block.
+static inline void fill(lpc_segment *s)
+{
+    while (s->nbits <= 24) {
+        uint32_t c = 0;
+        if (s->pos < s->end)
+            c = *s->pos++;
+        else
+            s->pad += 8;
+        s->bits |= c << (24 - s->nbits);
+        s->nbits += 8;
+    }
+}
+
+//reads <n> (up to 24) bits
+static inline uint32_t get_bits(lpc_segment *s, unsigned n)
+{
+    uint32_t v;
+    if (!n)
+        return 0;
+    fill(s);
+    v = s->bits >> (32 - n);
+    s->bits <<= n;
+    s->nbits -= n;
+    return v;
+}
+
+//reads a rice code with parameter <k>: the quotient in unary (zeros ended by a one), then k low bits
+static inline uint32_t get_rice(lpc_segment *s, unsigned k)
+{
+    uint32_t q = 0;
+    int z;
+
+    fill(s);
+    while (!s->bits) { //every bit read ahead is a zero
+        q += s->nbits;
+        s->nbits = 0;
+        if (s->pad > 32)
+            return 0; //ran off the end of the segment
+        fill(s);
+    }
+    z = __builtin_clz(s->bits);
+    q += z;
+    s->bits = (s->bits << z) << 1;
+    s->nbits -= z + 1;
+    return (q << k) | get_bits(s, k);
+}
+
+/*
+decodes one channel of a block into <x>.
+*/
+static bool decode_channel(lpc_segment *s, int32_t *x, unsigned frames)
+{
+    int32_t c[LPC_MAX_ORDER];
+    uint8_t rice[LPC_BLOCK_FRAMES / LPC_PARTITION];
+    unsigned order, shift = 0, i, j, part, end;
+    int wbits = s->sample_bits + 1; //a side channel needs one more bit than the samples
+
+    order = get_bits(s, 4);
+    if (order > LPC_MAX_ORDER || order > frames)
+        return false;
+    if (order) {
+        shift = get_bits(s, 4);
+        for (j = 0; j < order; j++)
+            c[j] = sign_extend(get_bits(s, LPC_COEF_BITS), LPC_COEF_BITS);
+        for (j = 0; j < order; j++)
+            x[j] = sign_extend(get_bits(s, wbits), wbits);
+    }
+    for (part = 0; part * LPC_PARTITION < frames; part++) {
+        rice[part] = get_bits(s, 5);
+        if (rice[part] > LPC_MAX_RICE)
+            return false;
+    }
+
+    i = order;
+    for (part = 0; i < frames; part++) {
+        unsigned k = rice[part];
+        end = min((part + 1) * LPC_PARTITION, frames);
+        for (; i < end; i++) {
+            uint32_t u = get_rice(s, k);
+            int32_t sum = 0;
+            switch (order) {
+            case 8: sum += c[7] * x[i - 8]; /* fall through */
+            case 7: sum += c[6] * x[i - 7]; /* fall through */
+            case 6: sum += c[5] * x[i - 6]; /* fall through */
+            case 5: sum += c[4] * x[i - 5]; /* fall through */
+            case 4: sum += c[3] * x[i - 4]; /* fall through */
+            case 3: sum += c[2] * x[i - 3]; /* fall through */
+            case 2: sum += c[1] * x[i - 2]; /* fall through */
+            case 1: sum += c[0] * x[i - 1]; /* fall through */
+            default: break;
+            }
+            x[i] = (int32_t)((u >> 1) ^ -(u & 1)) + (sum >> shift);
+        }
+    }
+    return true;
+}
+
+bool lpc_open(lpc_segment *seg, const uint8_t *data, size_t len, int channels, int sample_bits, bool native)
+{
+    memzero(seg, sizeof(*seg));
+    if (len < LPC_SEG_HDR_SIZE || (channels != 1 && channels != 2) || (sample_bits != 8 && sample_bits != 16))
+        return false;
+    seg->raw_start = get_le32(data);
+    seg->raw_len = get_le32(data + 4);
+    seg->pos = data + LPC_SEG_HDR_SIZE;
+    seg->end = data + len;
+    seg->channels = channels;
+    seg->sample_bits = sample_bits;
+    seg->native = native;
+    return seg->raw_len && seg->raw_len % (channels * sample_bits / 8) == 0;
+}
+
+bool lpc_decode(lpc_segment *seg, uint8_t *dest, size_t room, size_t *written)
+{
+    size_t frame_size = pcm_frame_size(seg->channels, seg->sample_bits), n = 0, size, out_size;
+    unsigned frames, i, ch;
+    bool side;
+
+    *written = 0;
+    if (seg->raw_done >= seg->raw_len)
+        return false;
+
+    do {
+        fill(seg);
+        frames = (seg->bits >> 16) + 1;
+        size = frames * frame_size;
+        out_size = seg->native ? frames * PCM_NATIVE_FRAME : size;
+        if (n && n + out_size > room)
+            break;
+        if (frames > LPC_BLOCK_FRAMES || size > seg->raw_len - seg->raw_done)
+            return false;
+        get_bits(seg, 16);
+        side = seg->channels == 2 && get_bits(seg, 1);
+
+        for (ch = 0; ch < seg->channels; ch++)
+            if (!decode_channel(seg, work[ch], frames))
+                return false;
+        if (seg->pad > seg->nbits)
+            return false; //the block ran past the end of the segment
+        //the next block starts on a byte boundary
+        seg->bits <<= seg->nbits & 7;
+        seg->nbits &= ~7;
+
+        if (side)
+            for (i = 0; i < frames; i++)
+                work[1][i] = work[0][i] - work[1][i];
+        if (seg->native) { //a word per frame, mono goes to both channels
+            uint32_t *out = (uint32_t *)dest;
+            uint32_t *left = (uint32_t *)work[0], *right = (uint32_t *)work[seg->channels - 1];
+            int up = 16 - seg->sample_bits;
+            for (i = 0; i < frames; i++)
+                *out++ = ((left[i] << up) & 0xFFFF) | (right[i] << (16 + up));
+            dest += out_size;
+        } else if (seg->sample_bits == 16) {
+            for (i = 0; i < frames; i++)
+                for (ch = 0; ch < seg->channels; ch++) {
+                    *dest++ = (uint8_t)work[ch][i];
+                    *dest++ = (uint8_t)(work[ch][i] >> 8);
+                }
+        } else {
+            for (i = 0; i < frames; i++)
+                for (ch = 0; ch < seg->channels; ch++)
+                    *dest++ = (uint8_t)(work[ch][i] + 128); //8 bit wav samples are unsigned
+        }
+
+        n += out_size;
+        seg->raw_done += size;
+    } while (seg->raw_done < seg->raw_len);
+
+    *written = n;
+    return true;
+}
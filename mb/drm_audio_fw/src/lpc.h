@@ -0,0 +1,57 @@
+#pragma once
+#ifndef LPC_H
+#define LPC_H
+//see lpc.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+lossless decoder for the segments protectSong writes with --codec lpc (SEG_CODEC_LPC).
+the plaintext of such a segment is a LPC_SEG_HDR_SIZE byte header (little endian u32 raw_start, the offset of its
+first audio byte in the song, and u32 raw_len, the audio bytes it decodes to) followed by blocks of at most
+LPC_BLOCK_FRAMES frames, then zero padding up to the segment size.
+
+every block starts on a byte boundary and is an msb first bitstream:
+    frames - 1 (16 bits), and for stereo whether the second channel is left - right (1 bit)
+    then per channel:
+        order (4 bits, 0..LPC_MAX_ORDER), and if it is not 0 the shift (4 bits), order coefficients
+        (LPC_COEF_BITS bits, two's complement) and order warmup samples (sample bits + 1, two's complement)
+        a rice parameter (5 bits) for every LPC_PARTITION frames of the block
+        the rice coded (zigzag) residuals of the remaining samples
+each sample is its residual plus (sum of coef[j] * sample[i - 1 - j]) >> shift, all of it fits in 32 bits.
+*/
+
+#define LPC_SEG_HDR_SIZE 8
+#define LPC_BLOCK_FRAMES 1024 //at 16 bit stereo a block decodes to 4k, well within a bram half
+#define LPC_PARTITION 256
+#define LPC_MAX_ORDER 8
+#define LPC_COEF_BITS 12
+#define LPC_MAX_RICE 24
+
+typedef struct {
+    const uint8_t *pos, *end; //the next unread byte of the segment
+    uint32_t bits; //read ahead bits, msb first
+    int nbits;
+    int pad; //zero bits read ahead from past the end
+    uint32_t raw_start, raw_len, raw_done;
+    uint8_t channels, sample_bits;
+    bool native; //write 16 bit stereo whatever the song's format, see pcm.h
+} lpc_segment;
+
+/*
+starts decoding the decrypted segment of <len> bytes at <data>, which holds audio with <channels> (1 or 2)
+channels of <sample_bits> (8 or 16) bits. <data> must stay in place until the segment is decoded.
+the audio is written in that format, or as native 16 bit stereo frames if <native> is set.
+returns false if the segment header does not make sense.
+*/
+bool lpc_open(lpc_segment *seg, const uint8_t *data, size_t len, int channels, int sample_bits, bool native);
+/*
+decodes whole blocks into <dest> while they fit in <room> bytes, but always at least one, so <dest> must have room
+for a full block (LPC_BLOCK_FRAMES frames), and be 4 byte aligned for native output. <written> is set to the
+number of bytes of audio written.
+returns false if a block is corrupt or the segment has already been decoded.
+*/
+bool lpc_decode(lpc_segment *seg, uint8_t *dest, size_t room, size_t *written);
+
+#endif // !LPC_H
@@ -7,9 +7,15 @@
 #include "hmac.h"
 #include "pbkdf2-hmac-sha512.h"
 
+#include "xparameters.h"
+#ifdef AES_SW_ENGINE
+#include "aes.h"
+#elif defined(XPAR_DECRYPT_0_DEVICE_ID)
 #include "xdecrypt.h"
+#else
+#error "no decrypt core in the block design, build with AES_SW_ENGINE"
+#endif
 
-#include "xparameters.h"
 #include "platform.h"
 #include "xstatus.h"
 #include "xaxidma.h"
@@ -17,16 +23,33 @@
 #include "util.h"
 #include "xintc.h"
 #include "sha512.h"
+#include "sched.h"
+#include "ingest.h"
+#include "lpc.h"
+#include "resample.h"
+#include "pcm.h"
+#include "trace.h"
+#include "header.h"
+#include "phf.h"
 
 //HW global state stuff
 static XAxiDma sAxiDma;
 
 // static drm_header current_song_header;
 volatile mipod_buffer *mipod_in = (mipod_buffer *)SHARED_DDR_BASE;  //this ends up as a constant address
-volatile static int InterruptProcessed = false;
+volatile mipod_song_slot *mipod_next = (mipod_song_slot *)SHARED_DDR_NEXT_SLOT; //where the client stages the next song of a playlist
 static XIntc InterruptController;
-static uint8_t segment_buffer[SEGMENT_BUF_SIZE + sizeof(struct segment_trailer)]; //the memory buffer that we copy our data to (either constant address or array, idk yet)
+static uint8_t segment_buffer[SEGMENT_BUF_SIZE + sizeof(struct segment_trailer)] __attribute__((aligned(4))); //the memory buffer that we copy our data to (either constant address or array, idk yet)
+static SEG_MAC_State segment_mac; //absorbs the segment while it is copied into segment_buffer
+static uint8_t resample_stage[LPC_BLOCK_FRAMES * 4] __attribute__((aligned(4))); //audio on its way from segment_buffer to the resampler. holds a whole lpc block.
 int DMA_flag = 0;
+static u32 DMA_half = 0; //which half of the dma bram the next chunk goes to. kept across segments and songs so an in-flight chunk is never overwritten.
+
+// publishes the status of the current command to the client
+static void set_status(uint32_t status) {
+    mipod_in->status = status;
+    shm_flush_obj(mipod_in->status);
+}
 
 internal_state mb_state;
 void initialize_mb_State () {
@@ -45,15 +68,20 @@ static bool startup_query(void);
 static bool query_song(void);
 static bool digitize_song(void);
 static bool share_song(void);
+static void command_task(void);
+static void dma_refill_task(void);
+static void segment_ingest_task(void);
+static void prefetch_task(void);
+static void poll_hw(void);
+static void playback_command(int op);
 
 // interrupt handler
 void gpio_entry(void) {
-    InterruptProcessed = true;
+    sched_post(EV_COMMAND);
 }
 
 int main() {
     uint32_t status = XST_FAILURE;
-    bool res = true;
     init_platform();
 
     mb_printf("Setup our interrupt handler\r\n");
@@ -75,45 +103,28 @@ int main() {
         return XST_FAILURE;
     }
 
+    if (!ingest_init()) {
+        mb_printf("Segment ingest setup ERROR\r\n");
+        return XST_FAILURE;
+    }
+
     initialize_mb_State();
     mipod_in->operation = MIPOD_STOP;
 
     // clear mipod_buffer channel
     memset((void *)mipod_in, 0, sizeof(mipod_buffer));
+    shm_flush(mipod_in, sizeof(mipod_buffer));
+
+    //everything below is event driven. tasks are listed most latency sensitive first.
+    sched_init(poll_hw);
+    sched_add(command_task, EV_COMMAND);
+    sched_add(dma_refill_task, EV_DMA);
+    sched_add(segment_ingest_task, EV_INGEST);
+    sched_add_idle(prefetch_task);
 
     // Handle commands forever
     while(1){
-        if (InterruptProcessed)
-        {
-            InterruptProcessed = false;
-
-            res = true;
-            mipod_in->status = STATE_WORKING;
-            mb_state.current_operation = mipod_in->operation;
-            switch (mipod_in->operation) {
-                case MIPOD_PLAY: res = play_song(); break;
-                case MIPOD_LOGIN: res = login_user(); break;
-                case MIPOD_LOGOUT: res = logout_user(); break;
-                case MIPOD_QUERY: 
-                    res = startup_query(); 
-                    break;
-                case MIPOD_QUERY_SONG:
-                    res = query_song();
-                    break;
-                case MIPOD_DIGITAL: res = digitize_song(); break;
-                case MIPOD_SHARE: res = share_song(); break;
-                default: goto fail;
-                // default: break;
-            }
-            if (!res) {
-                fail:;
-                    mipod_in->status = STATE_FAILED;
-            }
-            else mipod_in->status = STATE_SUCCESS;
-            usleep(500);
-            mipod_in->operation = MIPOD_STOP;
-        }
-        
+        sched_run_once();
     }
 
     clear_obj(mipod_in);
@@ -126,20 +137,16 @@ check to see if the region rid is provisioned for the player
 returns true/false for success/fail
 */
 static bool valid_region(uint8_t rid) {
-    for (int i = 0; i < NUM_PROVISIONED_REGIONS; ++i) 
-        if (PROVISIONED_RIDS[i] == rid)
-            return true;
-    return false;
+    return rid < MAX_SHARED_REGIONS && (PROVISIONED_REGION_MASK & (1u << rid));
 }
 
 // looks up the region name corresponding to the rid
 static bool rid_to_region_name(char rid, char **region_name, int provisioned_only) {
-    for (int i = 0; i < NUM_REGIONS; i++) {
-        if (rid == REGION_IDS[i] &&
-            (!provisioned_only || valid_region(rid))) {
-            *region_name = (char *)REGION_NAMES[i];
-            return true;
-        }
+    uint16_t i = ((uint8_t)rid < REGION_INDEX_SIZE) ? REGION_INDEX_BY_ID[(uint8_t)rid] : PHF_NONE;
+
+    if (i != PHF_NONE && (!provisioned_only || valid_region(rid))) {
+        *region_name = (char *)REGION_NAMES[i];
+        return true;
     }
 
     mb_printf("Could not find region ID '%d'\r\n", rid);
@@ -149,12 +156,12 @@ static bool rid_to_region_name(char rid, char **region_name, int provisioned_onl
 
 // looks up the rid corresponding to the region name
 static bool region_name_to_rid(char *region_name, char *rid, int provisioned_only) {
-    for (int i = 0; i < NUM_REGIONS; i++) {
-        if (!strcmp(region_name, REGION_NAMES[i]) &&
-            (!provisioned_only || valid_region(REGION_IDS[i]))) {
-            *rid = REGION_IDS[i];
-            return true;
-        }
+    uint16_t i = phf_find(region_name, REGION_PHF_SEEDS, REGION_PHF_BUCKETS, REGION_PHF_SLOTS, REGION_PHF_SIZE);
+
+    if (i != PHF_NONE && !strcmp(region_name, REGION_NAMES[i]) &&
+        (!provisioned_only || valid_region(REGION_IDS[i]))) {
+        *rid = REGION_IDS[i];
+        return true;
     }
 
     mb_printf("Could not find region name '%s'\r\n", region_name);
@@ -163,20 +170,16 @@ static bool region_name_to_rid(char *region_name, char *rid, int provisioned_onl
 }
 
 static bool valid_user(uint8_t uid) {
-    for (int i = 0; i < NUM_PROVISIONED_USERS; ++i) 
-        if (PROVISIONED_UIDS[i] == uid)
-            return true;
-    return false;
+    return uid < MAX_SHARED_USERS && bitmap_test(PROVISIONED_USER_MASK, uid);
 }
 
 // looks up the username corresponding to the uid
 int uid_to_username(char uid, char **username, int provisioned_only) {
-    for (int i = 0; i < NUM_USERS; i++) {
-        if (uid == USER_IDS[i] &&
-            (!provisioned_only || valid_user(uid))) {
-            *username = (char *)users[i].name;
-            return TRUE;
-        }
+    uint16_t i = ((uint8_t)uid < USER_INDEX_SIZE) ? USER_INDEX_BY_ID[(uint8_t)uid] : PHF_NONE;
+
+    if (i != PHF_NONE && (!provisioned_only || valid_user(uid))) {
+        *username = (char *)users[i].name;
+        return TRUE;
     }
 
     mb_printf("Could not find uid '%d'\r\n", uid);
@@ -187,12 +190,12 @@ int uid_to_username(char uid, char **username, int provisioned_only) {
 
 // looks up the uid corresponding to the username
 int username_to_uid(char *username, char *uid, int provisioned_only) {
-    for (int i = 0; i < NUM_USERS; i++) {
-        if (!strcmp(username, users[USER_IDS[i]].name) &&
-            (!provisioned_only || valid_user(USER_IDS[i]))) {
-            *uid = USER_IDS[i];
-            return TRUE;
-        }
+    uint16_t i = phf_find(username, USER_PHF_SEEDS, USER_PHF_BUCKETS, USER_PHF_SLOTS, USER_PHF_SIZE);
+
+    if (i != PHF_NONE && !strcmp(username, users[i].name) &&
+        (!provisioned_only || valid_user(USER_IDS[i]))) {
+        *uid = USER_IDS[i];
+        return TRUE;
     }
 
     mb_printf("Could not find username '%s'\r\n", username);
@@ -200,12 +203,25 @@ int username_to_uid(char *username, char *uid, int provisioned_only) {
     return FALSE;
 }
 
-static bool verify_seg_blocksig(void *data_start, size_t sig_offset) {
-    uint8_t sig[SHA1_DIGEST_SIZE];
-    memset(sig, 0, SHA1_DIGEST_SIZE);
-    hmac_sha1(mipod_key, data_start, sig_offset, sig);
+/*
+verify a segment signature using the MIPOD key.
+<state> has already absorbed the data, see start_segment_ingest.
+<bind> (may be NULL) is authenticated after the data without being stored in the segment,
+which is how v2 segments are tied to their song id.
+returns true if it is valid.
+data layout looks like:
+[....data....][signature]
+              ^-sig
+*/
+static bool verify_seg_blocksig(SEG_MAC_State *state, const uint8_t *sig, const uint8_t *bind, size_t bind_len) {
+    uint8_t mac[SEG_MAC_SIZE];
+
+    memset(mac, 0, SEG_MAC_SIZE);
+    if (bind)
+        seg_mac_update(state, bind, bind_len);
+    seg_mac_final(state, mac);
 
-    return !memcmp(sig, (uint8_t *)data_start + sig_offset, SHA1_DIGEST_SIZE);
+    return !memcmp(mac, sig, SEG_MAC_SIZE);
 }
 
 /*
@@ -234,17 +250,13 @@ data layout looks like:
 static bool verify_user_blocksig(void *data_start, size_t sig_offset, uint8_t uid) {
     uint8_t sig[HASH_OUTSIZE];
 
-    for (int i = 0; i < NUM_PROVISIONED_USERS; i++)
-    {
-        if (uid == PROVISIONED_UIDS[i])
-        {
-            memset(sig, 0, HASH_OUTSIZE);
-            hmac(users[uid].hash, data_start, sig_offset, sig);
+    if (!valid_user(uid))
+        return false;
 
-            return !memcmp(sig, (uint8_t *)data_start + sig_offset, HASH_OUTSIZE);
-        }
-    }
-    return false;
+    memset(sig, 0, HASH_OUTSIZE);
+    hmac(users[uid].hash, data_start, sig_offset, sig);
+
+    return !memcmp(sig, (uint8_t *)data_start + sig_offset, HASH_OUTSIZE);
 }
 
 /*
@@ -261,52 +273,69 @@ static bool sign_user_block(void *data_start, size_t sig_offset) {
 
 
 /*
-decrypts <len> bytes at <start> using the hardware-stored keys.
-returns the actual length of the decrypted data (removing padding, for example)
-<len> = size of segment, including trailer and padding.
-<start> = start of segment.
+decrypts <len> bytes at <src> into <dest> using the hardware-stored keys.
+<dest> may be <src> to decrypt in place, or eg a dma bram half so the plaintext never takes a detour through segment_buffer.
+<src> may be clobbered (the hardware core needs its blocks transposed).
+with AES_SW_ENGINE the software engine in aes.c stands in for the core, keyed from secrets.h.
+returns the actual length of the decrypted data (removing padding, for example), 0 on failure.
 */
-static size_t decrypt_segment_data(void *start, size_t len) {
-
-    //Initialize the AES module
-	int status = 0, block_offset = 0, count = 0;
+static size_t decrypt_data(void *dest, void *src, size_t len) {
+    static bool ready = false;
+    int count = len / 16;
+#ifdef AES_SW_ENGINE
+    static aes_sw engine;
+
+    if (!ready) {
+        if (!aes_sw_init(&engine, aes_key, AES_SW_ENGINE)) {
+            mb_printf("Error initializing the software AES engine\r\n");
+            return 0;
+        }
+        ready = true;
+    }
+    aes_sw_decrypt_blocks(&engine, dest, src, count);
+#else
+    static XDecrypt myDecrypt;
+	int status = 0, block_offset = 0;
     uint8_t *block_start = NULL;
-    XDecrypt myDecrypt;
     XDecrypt_Config *myDecrypt_cfg;
 
-    myDecrypt_cfg = XDecrypt_LookupConfig(XPAR_DECRYPT_0_DEVICE_ID);
-    if (!myDecrypt_cfg) {
-        mb_printf("Error loading configuration for component XDecrypt\r\n");
-        return status;
-    }
+    //Initialize the AES module, once
+    if (!ready) {
+        myDecrypt_cfg = XDecrypt_LookupConfig(XPAR_DECRYPT_0_DEVICE_ID);
+        if (!myDecrypt_cfg) {
+            mb_printf("Error loading configuration for component XDecrypt\r\n");
+            return 0;
+        }
 
-    status = XDecrypt_CfgInitialize(&myDecrypt, myDecrypt_cfg);
-    if (status != XST_SUCCESS) {
-        mb_printf("Error initializing configuration for component XDecrypt\r\n");
-        return status;
-    }
-    else {
+        status = XDecrypt_CfgInitialize(&myDecrypt, myDecrypt_cfg);
+        if (status != XST_SUCCESS) {
+            mb_printf("Error initializing configuration for component XDecrypt\r\n");
+            return 0;
+        }
         status = XDecrypt_Initialize(&myDecrypt, XPAR_DECRYPT_0_DEVICE_ID);
         if (status != XST_SUCCESS) {
             mb_printf("Error initializing component XDecrypt\r\n");
-            return status;
+            return 0;
         }
+        ready = true;
     }
 
-    count = len/16;  //55936
-
     for (int i = 0; i < count; i++)
     {
         block_offset = i*16;
-        block_start = start + block_offset;
+        block_start = src + block_offset;
 
         Transpose(block_start);
            
         XDecrypt_Write_CipherText_Bytes(&myDecrypt, 0, block_start, 16);
         XDecrypt_Start(&myDecrypt);
         while (!XDecrypt_IsDone(&myDecrypt));
-        XDecrypt_Read_PlainText_Bytes(&myDecrypt, 0, block_start, 16);
+        XDecrypt_Read_PlainText_Bytes(&myDecrypt, 0, (uint8_t *)dest + block_offset, 16);
     }
+#endif
+    //a partial block at the end is passed through as is, same as when decrypting in place
+    if (dest != src && len % 16)
+        memcpy((uint8_t *)dest + count * 16, (uint8_t *)src + count * 16, len % 16);
     return len;
 }
 
@@ -335,7 +364,7 @@ bool login_user(void)
         mb_printf("Already logged in. Please logout first.\r\n");
         return true;
     } else {
-        memcpy(tmpnam, mipod_in->login_data.name, UNAME_SIZE);
+        copytolocal(tmpnam, mipod_in->login_data.name, UNAME_SIZE);
         mb_printf("User Name is: %s\r\n", tmpnam);
         // username_to_uid(tmpnam, &user, TRUE);
         // mb_printf("%x \r\n", user);
@@ -344,7 +373,7 @@ bool login_user(void)
             mb_printf("Invalid user!\r\n");
             return false;
         }
-        memcpy(mb_state.pin_buffer, (void *)mipod_in->login_data.pin, sizeof(mb_state.pin_buffer));
+        copytolocal(mb_state.pin_buffer, mipod_in->login_data.pin, sizeof(mb_state.pin_buffer));
         if (!gen_check_user_secret(user)) {
             mb_printf("Wrong PIN!\r\n");
             return false;
@@ -366,8 +395,10 @@ bool logout_user(void) {
         mb_state.current_uid = INVALID_UID;
         mb_state.logged_in_user = false;
         mb_printf("User logout.\r\n");
+        header_cache_clear();
         memset((void*)mipod_in->login_data.name, 0, UNAME_SIZE);
         memset((void*)mipod_in->login_data.pin, 0, PIN_SIZE);
+        shm_flush_obj(mipod_in->login_data);
         return true;
     }
     else {
@@ -379,68 +410,70 @@ bool logout_user(void) {
 
 
 /*
-loads the drm header from arm shared memory into fpga-only bram and ensures that it is valid.
-returns one of the SONG_xyz constants
-OWNER => the header is valid, and the current user owns it.
-SHARED => the song is valid, and the current user has it shared with them.
-BADREGION => the song may not be played in the current region, but appears to be a valid song.
-BADUSER => the song is neither owned by or shared with the current user, but appears to be a valid song.
-BADSIG => the song is invalid and may be discarded (mb_state.current_song_header and other state will be cleared).
+unloads the current song drm header, clears the song owners
 */
-int32_t load_song_header(drm_header *arm_drm) {
-    memcpy(&mb_state.current_song_header, arm_drm, sizeof(drm_header));
+void unload_song_header(void) {
+    clear_obj(mb_state.current_song_header);
+    clear_obj(mb_state.current_song);
+    mb_state.own_current_song = false;
+    mb_state.shared_current_song = false;
+}
 
-    //check the edc signature of the mipod application
-    if (!verify_mp_blocksig(&mb_state.current_song_header, offsetof(drm_header, mp_sig))) {
+/*
+copies the drm header at <arm_drm> into the bram header <hdr>, parses it into <song> and ensures that it is valid.
+both the v1 and v2 file formats are accepted.
+returns one of the SONG_xyz constants (see load_song_header). on SONG_BADSIG, <hdr> and <song> are cleared.
+*/
+static int32_t verify_song_header(volatile void *arm_drm, drm_file_header *hdr, song_info *song) {
+    int cached = 0;
+
+    copytolocal(hdr, arm_drm, sizeof(drm_file_header));
+
+    //check the edc signature of the mipod application, unless this exact header passed it before
+    if (!parse_song_header(hdr, song)
+        || ((cached = header_cache_find(hdr, song)) < 0 && !verify_mp_blocksig(hdr, mp_sig_offset(song)))) {
         mb_printf("Invalid song!\r\n");
-        clear_obj(mb_state.current_song_header);
+        clear_obj(*hdr);
+        clear_obj(*song);
         return SONG_BADSIG;
     }
+    if (cached < 0)
+        cached = header_cache_add(hdr, song, false);
 
-    //check each region in the song to see if it is a valid region that we can play.
-    for (size_t i = 0; i < MAX_SHARED_REGIONS; ++i) {
-        uint32_t _rid = mb_state.current_song_header.regions[i];
-        if (valid_region(_rid))
-            goto region_success;
-        if (_rid == INVALID_RID)
-            break;
+    //check the song regions against the regions we can play.
+    if (!(song->regions & PROVISIONED_REGION_MASK)) {
+        mb_printf("Bad region.\r\n");
+        return SONG_BADREGION;
     }
-    mb_printf("Bad region.\r\n");
-    return SONG_BADREGION;
-region_success:;
 
     //check to see if the owner exists
-    uint8_t uid = mb_state.current_song_header.ownerID;
+    uint8_t uid = song->ownerID;
     if (uid == INVALID_UID){
         mb_printf("Invalid user. You don't have the access to the full song, only 30s.\r\n");
         return SONG_BADUSER;
     }
         
     //check the edc signature of the shared section against the owners key
-    if (!verify_user_blocksig(&mb_state.current_song_header, offsetof(drm_header, owner_sig), uid)) {
-        clear_obj(mb_state.current_song_header);
-        mb_printf("User verify faild!\r\n");
-        return SONG_BADSIG;
+    if (!header_cache_user_ok(cached)) {
+        if (!verify_user_blocksig(hdr, owner_sig_offset(song), uid)) {
+            clear_obj(*hdr);
+            clear_obj(*song);
+            mb_printf("User verify faild!\r\n");
+            return SONG_BADSIG;
+        }
+        header_cache_set_user_ok(cached);
     }
 
     //check to see if we own the current song
     if (uid == mb_state.current_uid) {
-        mb_state.own_current_song = true;
         mb_printf("You have the access to this song.\r\n");
         return SONG_OWNER;
     }
 
     //check to see if we have the song shared with us
-    for (size_t i = 0; i < MAX_SHARED_USERS; ++i) {
-    	uid = INVALID_UID;
-    	if (mb_state.current_song_header.shared_users[i]==1)
-    		uid = i;
-        if (uid == INVALID_UID)
-            break;
-        if (uid == mb_state.current_uid){
-            mb_printf("You have the access to this song.\r\n");
-            return SONG_SHARED;
-        }        
+    if (mb_state.logged_in_user && bitmap_test(song->shared_users, mb_state.current_uid)) {
+        mb_printf("You have the access to this song.\r\n");
+        return SONG_SHARED;
     }
 
     //the song is total valid, but the user isn't allowed to play it
@@ -449,38 +482,93 @@ region_success:;
 }
 
 /*
-unloads the current song drm header, clears the song owners
+loads the drm header from arm shared memory into fpga-only bram and ensures that it is valid.
+returns one of the SONG_xyz constants
+OWNER => the header is valid, and the current user owns it.
+SHARED => the song is valid, and the current user has it shared with them.
+BADREGION => the song may not be played in the current region, but appears to be a valid song.
+BADUSER => the song is neither owned by or shared with the current user, but appears to be a valid song.
+BADSIG => the song is invalid and may be discarded (mb_state.current_song_header and other state will be cleared).
 */
-void unload_song_header(void) {
-    clear_obj(mb_state.current_song_header);
-    mb_state.own_current_song = false;
-    mb_state.shared_current_song = false;
+int32_t load_song_header(volatile void *arm_drm) {
+    int32_t res;
+
+    trace_begin(TRACE_HEADER, 0);
+    res = verify_song_header(arm_drm, &mb_state.current_song_header, &mb_state.current_song);
+    trace_end(TRACE_HEADER, res);
+    mb_state.own_current_song = (res == SONG_OWNER);
+    mb_state.shared_current_song = (res == SONG_SHARED);
+    return res;
 }
 
 /*
-loads a segment of the current song from arm shared memory to fpga memory and ensures it is valid.
-segidx is the index in the file of the loaded segment (ie the 5th segment would have segidx==5).
-the function currently assumes a static buffer somewhere (either defined in the file or a reserved hardware block)
-rather than one being passed in.
+where the signature starts in a segment with <sdata_size> bytes of audio.
 */
-static bool load_song_segment(void *arm_start, size_t segsize, uint32_t segidx) {
-    size_t sdata_size = segsize - sizeof(struct segment_trailer);
-    if (sdata_size > SEGMENT_BUF_SIZE) {
+static size_t seg_sig_offset(size_t sdata_size) {
+    if (mb_state.current_song.version == DRM_VERSION_2)
+        return sdata_size + offsetof(struct segment_trailer_v2, sig);
+    return sdata_size + offsetof(struct segment_trailer, sig);
+}
+
+/*
+starts copying a segment of the current song from arm shared memory into segment_buffer, see ingest.h.
+everything up to the signature is macced as it lands in segment_buffer, so the shared memory is only read once
+and the mac only ever covers our own copy.
+the copy is not trusted until verify_song_segment has checked it.
+*/
+static bool start_segment_ingest(void *arm_start, size_t segsize) {
+    size_t sdata_size = segsize - mb_state.current_song.trailer_size;
+    if (sdata_size > mb_state.current_song.segment_size) {
         return *(char *)NULL;
     }
 
-    //load the segment
-    Xil_MemCpy(segment_buffer, arm_start, segsize);  
+    while (!ingest_poll()); //a transfer dropped by a seek may still be feeding segment_mac
+    if (!seg_mac_init(&segment_mac, mb_state.current_song.seg_mac, (uint8_t *)mipod_key))
+        return false;
+    return ingest_start_mac(segment_buffer, arm_start, segsize, &segment_mac, seg_sig_offset(sdata_size));
+}
+
+/*
+ensures the segment that was ingested into segment_buffer is valid.
+segidx is the index in the file of the loaded segment (ie the 5th segment would have segidx==5).
+on success, <next_size> is set to the size of the following segment (0 for the last one).
+*/
+static bool verify_song_segment(size_t segsize, uint32_t segidx, uint32_t *next_size) {
+    size_t sdata_size = segsize - mb_state.current_song.trailer_size;
+
+#ifdef INGEST_STATS
+    const ingest_stats *st = ingest_last_stats();
+    mb_debug("segment %d: %d bytes, %d copied by the cpu, %d macced on the way, %d polls\r\n",
+             segidx, st->bytes, st->cpu_bytes, st->mac_bytes, st->polls);
+#endif
+
+    if (mb_state.current_song.version == DRM_VERSION_2) {
+        struct segment_trailer_v2 *trailer = (struct segment_trailer_v2 *) ((uint8_t *)segment_buffer + sdata_size);
+
+        //v2 trailers do not carry the song id. it is bound into the signature instead.
+        if (trailer->idx != segidx) {
+            mb_printf("Error song segment.\r\n");
+            return false;
+        }
+        if (!verify_seg_blocksig(&segment_mac, trailer->sig, mb_state.current_song.song_id, SONGID_LEN)) {
+            mb_printf("Invalid segment.\r\n");
+            return false;
+        }
+        *next_size = trailer->next_segment_size;
+        return true;
+    }
+
     struct segment_trailer *trailer = (struct segment_trailer *) ((uint8_t *)segment_buffer + sdata_size);
 
     //if there is an index mismatch or the segment does not belong to the current song, somebody is being naughty
-    if (trailer->idx != segidx || memcmp(mb_state.current_song_header.song_id, trailer->id, SONGID_LEN)) {
+    if (trailer->idx != segidx || memcmp(mb_state.current_song.song_id, trailer->id, SONGID_LEN)) {
         mb_printf("Error song segment.\r\n");
         return false;
     }
 
     //make sure the segment is something we actually signed and hasn't been swapped around
-   if (verify_seg_blocksig(segment_buffer, sdata_size + offsetof(struct segment_trailer, sig))) {
+   if (verify_seg_blocksig(&segment_mac, trailer->sig, NULL, 0)) {
+       *next_size = trailer->next_segment_size;
        return true;
    }
    else {
@@ -490,170 +578,633 @@ static bool load_song_segment(void *arm_start, size_t segsize, uint32_t segidx)
 }
 
 /*
+loads a segment of the current song from arm shared memory to fpga memory and ensures it is valid.
+this waits for the copy, the playback tasks use start_segment_ingest/verify_song_segment directly instead.
+*/
+static bool load_song_segment(void *arm_start, size_t segsize, uint32_t segidx, uint32_t *next_size) {
+    if (!start_segment_ingest(arm_start, segsize))
+        return false;
+    while (!ingest_poll());
+    return verify_song_segment(segsize, segidx, next_size);
+}
+
+/*
+the audio of the verified segment in segment_buffer, handed out a chunk at a time. raw audio is decrypted straight
+to wherever it goes. a coded segment is decrypted in place once, since it is smaller than the audio, and then decoded
+block by block. so is raw audio that has to be widened to the codec's format, which then happens as it is copied out.
+*/
+typedef struct {
+    size_t len, pos; //bytes of audio in the segment, and how many of them have been handed out
+    uint32_t start; //the offset of the first of them in the song. only coded segments carry it.
+    lpc_segment lpc;
+    pcm_widen_fn widen; //raw audio is widened to native frames with this, if set. see segment_audio_format.
+    uint8_t ratio; //bytes handed out per byte of audio
+} segment_audio;
+
+/*
+sets the format <a> hands out the current song's audio in from the next segment on: the codec's native one if
+<native>, else the song's own.
+*/
+static void segment_audio_format(segment_audio *a, bool native) {
+    a->widen = native ? pcm_widener(mb_state.current_song.channels, mb_state.current_song.sample_bits) : NULL;
+    a->ratio = a->widen ? PCM_NATIVE_FRAME / pcm_frame_size(mb_state.current_song.channels, mb_state.current_song.sample_bits) : 1;
+}
+
+/*
+starts handing out the audio of the verified segment in segment_buffer, which has <sdata_size> bytes of data.
+returns false if a coded segment does not make sense.
+*/
+static bool segment_audio_open(segment_audio *a, size_t sdata_size) {
+    a->pos = 0;
+    if (mb_state.current_song.codec == SEG_CODEC_PCM) {
+        a->len = sdata_size;
+        if (a->widen)
+            decrypt_data(segment_buffer, segment_buffer, sdata_size);
+        return true;
+    }
+    decrypt_data(segment_buffer, segment_buffer, sdata_size);
+    if (!lpc_open(&a->lpc, segment_buffer, sdata_size, mb_state.current_song.channels, mb_state.current_song.sample_bits, a->widen != NULL))
+        return false;
+    a->start = a->lpc.raw_start;
+    a->len = a->lpc.raw_len;
+    return true;
+}
+
+/*
+writes the next (at most) <room> bytes of audio to <dest>. coded audio comes in whole blocks, at least one even if it
+is more than <room>, so <dest> must have room for a block (LPC_BLOCK_FRAMES frames) too.
+native frames are written a word at a time, so <dest> must be 4 byte aligned for them.
+returns the number of bytes written, 0 if a coded block is corrupt.
+*/
+static size_t segment_audio_read(segment_audio *a, void *dest, size_t room) {
+    size_t n = min(a->len - a->pos, room / a->ratio);
+
+    if (mb_state.current_song.codec != SEG_CODEC_PCM) {
+        if (!lpc_decode(&a->lpc, dest, room, &n))
+            return 0;
+        a->pos = a->lpc.raw_done;
+        return n;
+    }
+    a->pos += n;
+    if (a->widen) //the segment was decrypted in place, this is the copy into dest
+        return a->widen(dest, (const uint32_t *)(segment_buffer + a->pos - n), n);
+    decrypt_data(dest, segment_buffer + a->pos - n, n);
+    return n;
+}
+
+// the shared memory slot a song is played from, see mipod_buffer.play_slot
+static volatile mipod_digital_data *song_slot(uint32_t slot) {
+    return slot ? &mipod_next->digital_data : &mipod_in->digital_data;
+}
+
+/*
+returns how many bytes of the current song may be played, given its load_song_header result.
+*/
+static size_t song_play_limit(int32_t access, volatile mipod_digital_data *data) {
+    shm_invalidate_obj(data->wav_size);
+    switch (access) {
+    case(SONG_BADUSER):;
+    case(SONG_BADREGION):; //we can play 30s, but no more
+        return SONGLEN_30S;
+    case(SONG_OWNER): ;
+    case(SONG_SHARED): ; //we can play the full song
+        return data->wav_size;
+    default:
+        return 0;
+    }
+}
+
+/*
+verifies the header of a song the client has staged in the slot we are not playing from.
+this runs between segments, so the expensive header checks happen while the dma is still busy with the current song.
+*/
+static void prefetch_next_song(uint32_t slot) {
+    shm_invalidate_obj(mipod_in->next_state);
+    if (mipod_in->next_state != NEXT_STAGED)
+        return;
+
+    trace_begin(TRACE_HEADER, 1);
+    mb_state.next_song_access = verify_song_header(&song_slot(!slot)->play_data.drm, &mb_state.next_song_header, &mb_state.next_song);
+    trace_end(TRACE_HEADER, mb_state.next_song_access);
+    mipod_in->next_state = (mb_state.next_song_access == SONG_BADSIG) ? NEXT_FAILED : NEXT_READY;
+    shm_flush_obj(mipod_in->next_state);
+}
+
+/*
+makes the verified staged song the current song, without touching the dma.
+returns false if there is no staged song to switch to.
+*/
+static bool switch_to_next_song(uint32_t *slot, size_t *bytes_max) {
+    prefetch_next_song(*slot); //it may have been staged during the last segment
+    if (mipod_in->next_state != NEXT_READY)
+        return false;
+
+    memcpy(&mb_state.current_song_header, &mb_state.next_song_header, sizeof(mb_state.current_song_header));
+    memcpy(&mb_state.current_song, &mb_state.next_song, sizeof(mb_state.current_song));
+    mb_state.own_current_song = (mb_state.next_song_access == SONG_OWNER);
+    mb_state.shared_current_song = (mb_state.next_song_access == SONG_SHARED);
+    clear_obj(mb_state.next_song_header);
+    clear_obj(mb_state.next_song);
+
+    *slot = !*slot;
+    *bytes_max = song_play_limit(mb_state.next_song_access, song_slot(*slot));
+    mipod_in->play_slot = *slot;
+    mipod_in->next_state = NEXT_NONE; //the slot we just finished is free for the client again
+    shm_flush(mipod_in, MIPOD_CTRL_SZ);
+    mb_printf("Playing next song.\r\n");
+    return true;
+}
+
+/*
+the state of the song being played. play_song only sets this up, the scheduler tasks below move it along
+one bounded step at a time, so commands and background work get the cpu while the dma is busy.
+*/
+enum seg_state {
+    SEG_FREE = 0, //segment_buffer may take the next segment
+    SEG_LOADING, //the next segment is being copied into segment_buffer
+    SEG_VERIFIED //segment_buffer holds an authenticated segment, decrypted chunk by chunk straight into the bram
+};
+
+static struct {
+    bool active;
+    bool paused;
+    bool eos; //there is nothing more to load, playback ends once the bram runs dry
+    uint32_t slot; //the shared memory slot of the current song
+    size_t offset, bytes_max; //the number of audio bytes loaded so far, and the maximum we may play
+    uint32_t idx, segsize; //index and size of the next segment to load
+    uint32_t playing; //index of the segment whose audio goes to the bram now, what seeks are relative to
+    uint32_t stride, stride_raw; //every segment but the last one has this size. coded ones only on disk, see playback_start_song.
+    uint32_t ring; //the number of ring slots if the song is streamed, 0 if all of it is in the shared memory
+    enum seg_state seg;
+    segment_audio audio; //the audio in segment_buffer, and how much of it is in the bram already
+    bool resample; //the song is not at AUDIO_SAMPLING_RATE, so its audio goes through rs
+    resampler rs;
+    size_t stage_len, stage_pos; //the audio in resample_stage, and how much of it rs has taken
+    u32 cur_off, cur_len, cur_pos; //the bram chunk the dma is working through
+    u32 next_off, next_len; //the chunk staged in the other bram half
+    bool seg_traced; //a TRACE_SEGMENT span is open
+    uint8_t first_audio; //for the trace: 0 until the first dma transfer starts, 1 until it is done, then 2
+} play;
+
+/*
+completes the command the superloop is working on.
+*/
+static void finish_command(bool res) {
+    trace_end(TRACE_COMMAND, mb_state.current_operation);
+    set_status(res ? STATE_SUCCESS : STATE_FAILED);
+    usleep(500);
+    mipod_in->operation = MIPOD_STOP;
+    shm_flush_obj(mipod_in->operation);
+}
+
+/*
+command intake.
+outside of playback the whole command runs here. while a song plays, only playback commands are taken
+and they just steer the playback tasks. any other command is refused with STATE_REJECTED.
+*/
+static void command_task(void) {
+    bool res = true;
+
+    shm_invalidate(mipod_in, MIPOD_CTRL_SZ); //the arm just wrote the command
+    if (play.active) {
+        trace_mark(TRACE_COMMAND, mipod_in->operation);
+        playback_command(mipod_in->operation);
+        return;
+    }
+
+    trace_begin(TRACE_COMMAND, mipod_in->operation);
+    set_status(STATE_WORKING);
+    mb_state.current_operation = mipod_in->operation;
+    switch (mipod_in->operation) {
+        case MIPOD_PLAY:
+            if ((res = play_song()))
+                return; //stop_playing completes the command once the song is done
+            break;
+        case MIPOD_LOGIN: res = login_user(); break;
+        case MIPOD_LOGOUT: res = logout_user(); break;
+        case MIPOD_QUERY: 
+            res = startup_query(); 
+            break;
+        case MIPOD_QUERY_SONG:
+            res = query_song();
+            break;
+        case MIPOD_DIGITAL: res = digitize_song(); break;
+        case MIPOD_SHARE: res = share_song(); break;
+        default: res = false; break;
+    }
+    finish_command(res);
+}
+
+/*
+ends playback and completes the play command.
+*/
+static void stop_playing(bool res) {
+    play.active = false;
+    if (play.seg_traced)
+        trace_end(TRACE_SEGMENT, play.idx);
+    trace_end(TRACE_PLAYBACK, play.slot);
+    clear_obj(mb_state.next_song_header);
+    clear_obj(mb_state.next_song);
+    unload_song_header();
+    finish_command(res);
+}
+
+/*
+where segment <idx> of the current song is in the shared memory, see ring_segment_offset for streamed songs.
+*/
+static uint8_t *playback_segment(uint32_t idx) {
+    uint8_t *data = (uint8_t *)&song_slot(play.slot)->play_data.drm + mb_state.current_song.header_size;
+    if (play.ring)
+        return data + ring_segment_offset(idx, play.ring, play.stride);
+    return data + (size_t)play.stride * idx;
+}
+
+/*
+whether segment <idx> of the current song may be loaded yet. only a streamed song ever has to wait for the client.
+*/
+static bool playback_segment_ready(uint32_t idx) {
+    if (!play.ring)
+        return true;
+    shm_invalidate_obj(mipod_in->ring_head);
+    shm_invalidate_obj(mipod_in->ring_ack);
+    return mipod_in->ring_ack == mipod_in->ring_seek && idx < mipod_in->ring_head;
+}
+
+/*
+hands the ring slot of segment <idx> back to the client, once our copy of it is done.
+*/
+static void playback_segment_release(uint32_t idx) {
+    if (!play.ring)
+        return;
+    mipod_in->ring_tail = idx + 1;
+    shm_flush_obj(mipod_in->ring_tail);
+}
+
+/*
+continues loading the current song at segment <idx>.
+audio that is already buffered is left alone, see playback_seek.
+*/
+static void playback_goto(uint32_t idx) {
+    play.idx = idx;
+    play.playing = idx;
+    play.offset = (size_t)play.stride_raw * idx;
+    play.segsize = idx ? play.stride : mb_state.current_song.first_segment_size;
+    play.eos = false;
+    sched_post(EV_INGEST);
+}
+
+/*
+sets up the current song to be played from its first segment.
+returns false if the stream ring the client asked for does not fit the slot.
+*/
+static bool playback_start_song(void) {
+    volatile mipod_digital_data *data = song_slot(play.slot);
+
+    play.stride = mb_state.current_song.first_segment_size;
+    //a song at the codec's rate, or at one the resampler cannot do, goes to the bram as it is
+    play.resample = mb_state.current_song.samplerate != AUDIO_SAMPLING_RATE &&
+        resample_init(&play.rs, mb_state.current_song.samplerate, AUDIO_SAMPLING_RATE, mb_state.current_song.channels, mb_state.current_song.sample_bits);
+    play.stage_len = play.stage_pos = 0;
+    //the resampler writes native frames itself, otherwise they are widened on the way into the bram
+    segment_audio_format(&play.audio, !play.resample);
+    play.stride_raw = play.stride - mb_state.current_song.trailer_size;
+    if (mb_state.current_song.codec != SEG_CODEC_PCM) //only on average, but that is all seeking by time needs
+        play.stride_raw = max(mb_state.current_song.audio_size / max(mb_state.current_song.nr_segments, 1), 1);
+    shm_invalidate_obj(data->ring_slots);
+    play.ring = data->ring_slots;
+    if (play.ring) {
+        if (!play.stride || play.ring > (SONG_SLOT_SZ - offsetof(mipod_digital_data, play_data) - mb_state.current_song.header_size) / play.stride)
+            return false;
+        mipod_in->ring_tail = 0; //the client filled the ring from the first segment
+        shm_flush_obj(mipod_in->ring_tail);
+    }
+    playback_goto(0);
+    return true;
+}
+
+/*
+drops all buffered audio and continues at segment <idx>.
+the slice the dma is playing right now still finishes, so its bram half must not be staged into next.
+*/
+static void playback_seek(uint32_t idx) {
+    play.seg = SEG_FREE;
+    play.audio.len = play.audio.pos = 0;
+    play.stage_len = play.stage_pos = 0;
+    if (play.resample)
+        resample_reset(&play.rs);
+    play.cur_len = play.cur_pos = 0;
+    play.next_len = 0;
+    DMA_half = (play.cur_off == 0);
+    if (play.ring) { //have the client refill the ring from the new position
+        mipod_in->ring_tail = idx;
+        mipod_in->ring_seek++;
+        shm_flush(&mipod_in->ring_tail, 2 * sizeof(uint32_t));
+    }
+    playback_goto(idx);
+}
+
+/*
+handles a control command that arrived while playing.
+pausing only stops new dma transfers, so playback picks up at exactly the byte it stopped at
+and the idle tasks keep running in the meantime.
+*/
+static void playback_command(int op) {
+    size_t jump = (size_t)(SONGLEN_5S / play.stride_raw);
+
+    switch (op) {
+        case(MIPOD_PLAY): //this is the default, continue playing the song
+        case(MIPOD_RESUME): //continue playing
+            play.paused = false;
+            set_status(STATE_PLAYING); //notify caller the resume operation has succeeded.
+            sched_post(EV_DMA);
+            return;
+        case(MIPOD_PAUSE): //no more dma is queued until the next command arrives
+            play.paused = true;
+            set_status(STATE_PAUSED);
+            return;
+        case(MIPOD_STOP): //we are done playing the song
+            stop_playing(true);
+            return;
+        case(MIPOD_RESTART): //reset the song state to the beginning and then start playing again
+            playback_seek(0);
+            break;
+        case(MIPOD_FORWARD): //play.idx is already past the segment being played
+            playback_seek(play.playing + jump);
+            break;
+        case(MIPOD_REWIND): 
+            playback_seek(play.playing < jump ? 0 : play.playing - jump);
+            break;
+        default: //not a playback command. it is refused, so a client waiting on it sees that it will never run.
+            set_status(STATE_REJECTED);
+            mipod_in->operation = MIPOD_PLAY;
+            shm_flush_obj(mipod_in->operation);
+            return;
+    }
+    play.paused = false;
+    set_status(STATE_PLAYING);
+    mipod_in->operation = MIPOD_PLAY;
+    shm_flush_obj(mipod_in->operation);
+}
+
+/*
+the dma's completion interrupt is not wired to the intc in this design, so whether it is idle
+is polled once per scheduler pass, and only while there is audio waiting for it.
+*/
+static void poll_dma(void) {
+    if (!play.active || play.paused)
+        return;
+    if (play.cur_pos == play.cur_len && !play.next_len)
+        return;
+    if (!DMA_flag || !XAxiDma_Busy(&sAxiDma, XAXIDMA_DMA_TO_DEVICE))
+        sched_post(EV_DMA);
+}
+
+/*
+moves a segment copy along, and hands the segment to the ingest task once it is in.
+*/
+static void poll_ingest(void) {
+    if (!play.active)
+        return;
+    if (play.seg == SEG_LOADING && ingest_poll())
+        sched_post(EV_INGEST);
+    //a streamed song may be waiting on the client to refill the ring
+    else if (play.ring && play.seg == SEG_FREE && !play.eos && playback_segment_ready(play.idx))
+        sched_post(EV_INGEST);
+}
+
+// the scheduler's poll hook, for hardware that does not raise an interrupt
+static void poll_hw(void) {
+    poll_dma();
+    poll_ingest();
+}
+
+/*
+writes up to <room> bytes of the verified segment's audio, at AUDIO_SAMPLING_RATE, to <dest>.
+returns the number of bytes written, 0 if a coded block is corrupt or the segment is used up (see playback_drained).
+*/
+static size_t playback_read(uint8_t *dest, size_t room) {
+    size_t n = 0, used;
+
+    if (!play.resample)
+        return segment_audio_read(&play.audio, dest, room);
+    while (n < room) {
+        if (play.stage_pos == play.stage_len) {
+            if (play.audio.pos == play.audio.len)
+                break;
+            if (!(play.stage_len = segment_audio_read(&play.audio, resample_stage, sizeof(resample_stage))))
+                return 0;
+            play.stage_pos = 0;
+        }
+        used = play.stage_len - play.stage_pos;
+        n += resample_run(&play.rs, resample_stage + play.stage_pos, &used, dest + n, room - n);
+        play.stage_pos += used;
+        if (!used && play.stage_pos < play.stage_len)
+            break; //dest is full
+    }
+    return n;
+}
+
+// whether all of the verified segment's audio has been handed out
+static bool playback_drained(void) {
+    return play.audio.pos == play.audio.len && play.stage_pos == play.stage_len;
+}
+
+/*
+keeps the dma fed.
 song playing currently depends on the following:
 .wav files are able to be separated into chunks based on the time to play them
 memory segments contain a multiple of that data size
+each chunk is decrypted straight into one bram half while the dma still plays the other one,
+so the plaintext is written exactly once. songs at another rate take a detour through resample_stage.
+the dma is fed DMA_SLICE_SZ bytes at a time, so a command takes effect after at most one slice
+(plus whatever is already in the audio fifo).
 */
-static void play_segment_bytes(void *start, uint32_t idx, size_t size) {
-    u32 cp_xfil_cnt, *fifo_fill, offset, rem, cp_num, counter = 0;
-    rem = size;
-    fifo_fill = (u32 *)XPAR_FIFO_COUNT_AXI_GPIO_0_BASEADDR;
+static void dma_refill_task(void) {
+    u32 cp_num, dma_cnt, off;
+
+    if (!play.active || play.paused)
+        return;
+
+    //decrypt (or decode, or resample) the next chunk straight into the bram half the dma is not using
+    if (!play.next_len && play.seg == SEG_VERIFIED) {
+        off = (DMA_half % 2 == 0) ? 0 : CHUNK_SZ;
+        cp_num = playback_read((uint8_t *)XPAR_MB_DMA_AXI_BRAM_CTRL_0_S_AXI_BASEADDR + off, mb_state.current_song.chunk_size);
+        if (!cp_num && !playback_drained()) {
+            stop_playing(false);
+            return;
+        }
+        if (cp_num) { //the resampler may keep the last few frames of a segment until the next one arrives
+            play.next_off = off;
+            play.next_len = cp_num;
+            DMA_half++;
+        }
+        if (playback_drained()) { //all of it is in the bram, the buffer can take the next segment
+            play.seg = SEG_FREE;
+            sched_post(EV_INGEST);
+        }
+    }
 
-    while (rem > 0)
-    {
-        cp_num = (rem > CHUNK_SZ) ? CHUNK_SZ : rem;
-        offset = (counter++ % 2 == 0) ? 0 : CHUNK_SZ;
-
-        //load the data into the pcm driver buffer
-        Xil_MemCpy((void *)(XPAR_MB_DMA_AXI_BRAM_CTRL_0_S_AXI_BASEADDR + offset), start + size -rem, (u32)(cp_num));
-        cp_xfil_cnt = cp_num;
-        while (cp_xfil_cnt > 0) {
-            if (DMA_flag == 0){
-                DMA_flag = 1;
+    if (play.cur_pos == play.cur_len) {
+        if (!play.next_len) {
+            if (play.eos && play.seg == SEG_FREE)
+                stop_playing(true);
+            return;
+        }
+    }
+
+    if (DMA_flag && XAxiDma_Busy(&sAxiDma, XAXIDMA_DMA_TO_DEVICE))
+        return; //poll_dma posts us again once it is idle
+    if (play.first_audio == 1) {
+        trace_mark(TRACE_FIRST_SAMPLE, 0);
+        play.first_audio = 2;
+    }
+
+    if (play.cur_pos == play.cur_len) { //move on to the staged chunk, and stage the one after it
+        play.cur_off = play.next_off;
+        play.cur_len = play.next_len;
+        play.cur_pos = 0;
+        play.next_len = 0;
+        sched_post(EV_DMA);
+    }
+
+    // do DMA
+    dma_cnt = min(play.cur_len - play.cur_pos, DMA_SLICE_SZ);
+    DMA_flag = 1;
+    if (!play.first_audio) {
+        trace_mark(TRACE_FIRST_DMA, dma_cnt);
+        play.first_audio = 1;
+    }
+    fnAudioPlay(sAxiDma, play.cur_off + play.cur_pos, dma_cnt);
+    play.cur_pos += dma_cnt;
+}
+
+/*
+starts copying the next segment once segment_buffer is free, and authenticates it once the copy is done.
+the cpu is free for the other tasks while the copy runs.
+at the end of the song this continues straight into a staged next song, or marks the end of the stream.
+*/
+static void segment_ingest_task(void) {
+    uint32_t next_size = 0;
+
+    if (!play.active || play.eos)
+        return;
+
+    if (play.seg == SEG_LOADING) {
+        if (!ingest_poll())
+            return;
+        trace_end(TRACE_SEGMENT, play.idx);
+        play.seg_traced = false;
+        playback_segment_release(play.idx);
+        if (!verify_song_segment(play.segsize, play.idx, &next_size)) {
+            stop_playing(play.idx != 0);
+            return;
+        }
+
+        if (!segment_audio_open(&play.audio, play.segsize - mb_state.current_song.trailer_size)) {
+            stop_playing(play.idx != 0);
+            return;
+        }
+        //update our position in the loaded song
+        play.playing = play.idx;
+        play.segsize = next_size;
+        play.idx++;
+        if (mb_state.current_song.codec != SEG_CODEC_PCM) {
+            //coded segments vary in length, so after a seek the offset was a guess until now
+            play.offset = play.audio.start;
+            if (play.bytes_max && play.offset >= play.bytes_max) { //past the preview, leave it to the end of song check
+                play.seg = SEG_FREE;
+                sched_post(EV_INGEST);
+                return;
             }
-            else
-                while (XAxiDma_Busy(&sAxiDma, XAXIDMA_DMA_TO_DEVICE) && *fifo_fill < (FIFO_CAP - 32));
-            #pragma message("idk about this....it seems to imply that the dma resets between songs, which seems wrong")
-
-            // do DMA
-            u32 dma_cnt = (FIFO_CAP - *fifo_fill > cp_xfil_cnt)
-                ? FIFO_CAP - *fifo_fill
-                : cp_xfil_cnt;
-            fnAudioPlay(sAxiDma, offset, dma_cnt);
-            cp_xfil_cnt -= dma_cnt;
         }
-    	if (mipod_in->operation == MIPOD_RESTART)
-    		rem = 0;
-    	else
-    		rem -= cp_num;
-    } 
-    return;
+        play.seg = SEG_VERIFIED;
+        play.offset += play.audio.len;
+        sched_post(EV_DMA);
+        return;
+    }
+
+    if (play.seg != SEG_FREE)
+        return;
+
+    if (play.idx >= mb_state.current_song.nr_segments || (play.bytes_max && play.offset >= play.bytes_max)) { //make sure we aren't playing too much audio
+        if (switch_to_next_song(&play.slot, &play.bytes_max)) {
+            trace_end(TRACE_PLAYBACK, !play.slot);
+            trace_begin(TRACE_PLAYBACK, play.slot);
+            if (!playback_start_song())
+                stop_playing(false);
+            return;
+        }
+        mb_printf("Done playing song.\r\n");
+        play.eos = true;
+        sched_post(EV_DMA);
+        return;
+    }
+
+    if (!playback_segment_ready(play.idx))
+        return; //poll_ingest posts us again once the client has streamed it in
+    if (!start_segment_ingest(playback_segment(play.idx), play.segsize)) {
+        stop_playing(play.idx != 0);
+        return;
+    }
+    trace_begin(TRACE_SEGMENT, play.idx);
+    play.seg_traced = true;
+    play.seg = SEG_LOADING;
+}
+
+/*
+background work for time the cpu would otherwise spend waiting on the dma or a paused song.
+*/
+static void prefetch_task(void) {
+    //use the time the dma spends on this song to check the next one, if there is one
+    if (play.active)
+        prefetch_next_song(play.slot);
 }
 
 static bool play_song(void) {
     /*
-    load the header
-    assuming that passes, load each segment,
-    then decrypt and play that segment inside bram.
-    unload the song.
-    every so often we should poll for state changes (pause, stop, restart, etc) and change based on those
+    load the header and set up the playback state.
+    the scheduler tasks then load each segment, decrypt it inside bram and feed it to the dma.
+    if the client has staged another song, they continue straight into it without stopping the dma.
+    playback commands (pause, stop, restart, etc) are taken by command_task in between.
+    returns false if the song could not be started. otherwise stop_playing completes the command.
     */
-
-    size_t offset = 0, bytes_max = 0; //the maximum number of bytes to play in the song, and the total number we have already played.
+    int32_t access;
     
+    //the last slice of the previous song may still be playing, and setting up the dma again would cut it off
+    while (DMA_flag && XAxiDma_Busy(&sAxiDma, XAXIDMA_DMA_TO_DEVICE));
+
     // Configure the DMA
     uint32_t status = XST_FAILURE;
     status = fnConfigDma(&sAxiDma);
     if (status != XST_SUCCESS) {
         mb_printf("DMA configuration ERROR\r\n");
-        return XST_FAILURE;
+        return false;
     }
 
     mb_printf("Audio DRM Module has Booted\r\n");
 
-    switch (load_song_header(&mipod_in->digital_data.play_data.drm)) {
-    case(SONG_BADUSER):;
-    case(SONG_BADREGION):; //we can play 30s, but no more
-        bytes_max = SONGLEN_30S;
-        mipod_in->status = STATE_PLAYING;
-        break;
-    case(SONG_BADSIG):;
+    clear_obj(play);
+    mipod_in->play_slot = play.slot;
+    shm_flush_obj(mipod_in->play_slot);
+    access = load_song_header(&song_slot(play.slot)->play_data.drm);
+    if (access == SONG_BADSIG) {
         unload_song_header();
-        mipod_in->status = STATE_FAILED;
+        set_status(STATE_FAILED);
         return false;
-    case(SONG_OWNER): ;
-    case(SONG_SHARED): ; //we can play the full song
-        bytes_max = mipod_in->digital_data.wav_size;
-        mipod_in->status = STATE_PLAYING;
-        break;
-    #ifdef __GNUC__
-    default:__builtin_unreachable();
-    #endif
     }
-restart_playing:;
-    mipod_in->status = STATE_PLAYING;
-
-    uint8_t *fseg = &(mipod_in->digital_data.play_data.filedata[0]); //a pointer to the start of the segment to load within the shared memory section
-    size_t i = 0, ff = 0, rw = 0;
-    uint32_t idx = 0, segsize = mb_state.current_song_header.first_segment_size;
-    //loop through all the segments in the file, make sure the update size is correct
+    play.bytes_max = song_play_limit(access, song_slot(play.slot));
     DMA_flag = 0;
+    DMA_half = 0;
 
-    for (; i < mb_state.current_song_header.nr_segments; i++) {
-    	uint32_t raw = segsize - sizeof(struct segment_trailer);
-        // check for interrupt to stop playback
-        while (InterruptProcessed){
-            InterruptProcessed = false;
-
-            switch (mipod_in->operation) {
-                case(MIPOD_PLAY):break; //this is the default, continue playing the song
-                case(MIPOD_PAUSE): //stop playing, wait for <!play, !pause> (possibly block on interrupt, but idk if that works with gpio)
-                    mipod_in->status == STATE_PAUSED;
-                    while(!InterruptProcessed) continue;
-                    break;
-                case(MIPOD_RESUME): //continue playing
-                    mipod_in->status = STATE_PLAYING; //notify caller the resume operation has succeeded.
-                    break;
-                case(MIPOD_STOP): //we are done playing the song, exit on out of here
-                    mipod_in->status = STATE_SUCCESS; 
-                    goto unload;
-                case(MIPOD_RESTART): //reset the song state to the beginning and then start playing again
-                    mipod_in->status = STATE_PLAYING;
-                    mipod_in->operation = MIPOD_PLAY;
-                    goto restart_playing; //sets state to playing
-                case(MIPOD_FORWARD): 
-                    mipod_in->status = STATE_PLAYING;
-                    mipod_in->operation = MIPOD_PLAY;
-                    ff = (size_t)(SONGLEN_5S / raw);
-                    i += ff;
-                    offset += (size_t)(raw * ff);
-                    fseg += segsize * ff;
-                    break;
-                case(MIPOD_REWIND): 
-                    mipod_in->status = STATE_PLAYING;
-                    mipod_in->operation = MIPOD_PLAY;
-                    rw = (size_t)(SONGLEN_5S / raw);
-                    if (i < rw){
-                        goto restart_playing;
-                    }
-                    i -= rw;
-                    offset -= (size_t)(raw * rw);
-                    fseg -= segsize * rw;
-                    break;
-            #ifdef __GNUC__
-            default:__builtin_unreachable();
-            #endif
-            }
-        }
-        
-        if (bytes_max && offset >= bytes_max) { //make sure we aren't playing too much audio
-            mb_printf("Done playing song.\r\n");
-            goto unload;
-        }
-
-        if (!load_song_segment(fseg, segsize, i)){
-            if (i == 0) {
-                unload_song_header();
-                return false;
-            }
-            else
-            {
-                return true;
-            }
-        }
-        decrypt_segment_data(segment_buffer, raw);
-
-        offset += raw;
-        //update our position in the loaded song
-        fseg += segsize;
-        //get next segment size
-        segsize = ((struct segment_trailer *) & (segment_buffer[raw]))->next_segment_size;
-        idx = ((struct segment_trailer *) & (segment_buffer[raw]))->idx;
-        play_segment_bytes(segment_buffer, idx, raw);
+    play.active = true;
+    if (!playback_start_song()) {
+        play.active = false;
+        unload_song_header();
+        set_status(STATE_FAILED);
+        return false;
     }
-
-unload:;
-    unload_song_header();
+    trace_begin(TRACE_PLAYBACK, play.slot);
+    set_status(STATE_PLAYING);
     return true;
 }
 
@@ -666,28 +1217,46 @@ bool startup_query(void) {
         strncpy((char *)q_user_lookup(mipod_in->query_data, j), users[PROVISIONED_UIDS[j]].name, UNAME_SIZE);
     }
 
+    //and by id, so the client can name the users and regions of a song header without asking us
+    for (size_t uid = 0; uid < MAX_SHARED_USERS; uid++) {
+        uint16_t i = (uid < USER_INDEX_SIZE) ? USER_INDEX_BY_ID[uid] : PHF_NONE;
+        strncpy((char *)mipod_in->query_data.user_names[uid], i != PHF_NONE ? users[i].name : "", UNAME_SIZE);
+    }
+    for (size_t rid = 0; rid < MAX_SHARED_REGIONS; rid++) {
+        uint16_t i = (rid < REGION_INDEX_SIZE) ? REGION_INDEX_BY_ID[rid] : PHF_NONE;
+        strncpy((char *)mipod_in->query_data.region_names[rid], i != PHF_NONE ? REGION_NAMES[i] : "", REGION_NAME_SZ);
+    }
+    mipod_in->query_data.region_mask = PROVISIONED_REGION_MASK;
+
+    shm_flush_obj(mipod_in->query_data);
+
     mb_printf("Queried player (%d regions, %d users)\r\n", NUM_PROVISIONED_REGIONS, NUM_PROVISIONED_USERS);
-    mipod_in->status = STATE_SUCCESS;
+    set_status(STATE_SUCCESS);
     return true;
 }
 
 bool query_song(void) {
     char *name = NULL;
     int count = 0;
-    memcpy(&mb_state.current_song_header, &mipod_in->digital_data.play_data.drm, sizeof(drm_header));
-
-    mb_printf("Song Owner: %s \r\n", users[mb_state.current_song_header.ownerID].name);
-    rid_to_region_name(mb_state.current_song_header.regions[0], &name, false);
-	xil_printf("MB> Regions: %s", name);
-    for (int i = 1; i < NUM_REGIONS; i++){
-    	if (mb_state.current_song_header.regions[i]) {
-        rid_to_region_name(mb_state.current_song_header.regions[i], &name, false);
-        xil_printf(", %s", name);
+    copytolocal(&mb_state.current_song_header, &mipod_in->digital_data.play_data.drm, sizeof(drm_file_header));
+    if (!parse_song_header(&mb_state.current_song_header, &mb_state.current_song)) {
+        mb_printf("Invalid song!\r\n");
+        unload_song_header();
+        return false;
+    }
+
+    mb_printf("Song Owner: %s \r\n", users[mb_state.current_song.ownerID].name);
+	xil_printf("MB> Regions: ");
+    for (int i = 0; i < MAX_SHARED_REGIONS; i++){
+    	if (mb_state.current_song.regions & (1u << i)) {
+        rid_to_region_name(i, &name, false);
+        xil_printf(count++ ? ", %s" : "%s", name);
     	}
     } 
+    count = 0;
     mb_printf("Shared Users: ");
-    for (size_t j = 0; j < TOTAL_USERS; j++) {
-    	if (mb_state.current_song_header.shared_users[j]) {
+    for (size_t j = 0; j < NUM_USERS; j++) {
+    	if (bitmap_test(mb_state.current_song.shared_users, j)) {
     		count++;
     		if (count==1) {
     			xil_printf("%s ", users[j].name);
@@ -700,6 +1269,23 @@ bool query_song(void) {
     	xil_printf("No Shared Users");
     }
     xil_printf("\r\n");
+    unload_song_header();
+    return true;
+}
+
+/*
+writes the audio of the opened segment_audio <a> out to <arm_dest> in the shared memory.
+the copy engine is the cpu (see ingest.h), so a write back through bram would only copy everything a second time.
+the segment is decrypted (or decoded) straight into the shared memory instead.
+returns false if a coded block is corrupt.
+*/
+static bool digitize_segment(volatile uint8_t *arm_dest, segment_audio *a) {
+    size_t off, n;
+
+    for (off = 0; a->pos < a->len; off += n)
+        if (!(n = segment_audio_read(a, (void *)(arm_dest + off), a->len - a->pos)))
+            return false;
+    shm_flush(arm_dest, a->len);
     return true;
 }
 
@@ -716,6 +1302,10 @@ bool digitize_song(void) {
 
     size_t offset = 0, bytes_max = 0;
 
+    shm_invalidate_obj(mipod_in->digital_data.ring_slots);
+    if (mipod_in->digital_data.ring_slots) //the decrypted song is written back over the file, so all of it must be here
+        return false;
+
     switch (load_song_header(&mipod_in->digital_data.play_data.drm))
     {
     case(SONG_BADUSER):;
@@ -724,10 +1314,11 @@ bool digitize_song(void) {
         break;
     case(SONG_BADSIG):;
         unload_song_header();
-        mipod_in->status = STATE_FAILED;
+        set_status(STATE_FAILED);
         return false;
     case(SONG_OWNER): ;
     case(SONG_SHARED): ; //we can play the full song
+        shm_invalidate_obj(mipod_in->digital_data.wav_size);
         bytes_max = mipod_in->digital_data.wav_size;
         break;
     #ifdef __GNUC__
@@ -735,25 +1326,35 @@ bool digitize_song(void) {
     #endif
     }
 
-    uint8_t *fseg = &(mipod_in->digital_data.play_data.filedata[0]); //a pointer to the start of the segment to load within the shared memory section
-    uint8_t *arm_decrypted = fseg; //a pointer to the next byte in the shared memory to write decrypted file to
-    size_t decrypted_mem = 0, i = 0, raw = 0;
-    size_t segsize = mb_state.current_song_header.first_segment_size;
+    uint8_t *fseg = (uint8_t *)&mipod_in->digital_data.play_data.drm + mb_state.current_song.header_size; //a pointer to the start of the segment to load within the shared memory section
+    /*
+    raw audio is written back over the segments it came from. coded audio is bigger than its segments and would
+    overrun the ones not loaded yet, so it goes to the start of the next song slot instead, and the song itself
+    has to fit in front of it.
+    */
+    uint8_t *arm_decrypted = mb_state.current_song.codec == SEG_CODEC_PCM ? fseg : (uint8_t *)mipod_next->buf;
+    size_t i = 0;
+    uint32_t segsize = mb_state.current_song.first_segment_size, next_size = 0;
+    segment_audio audio;
+
+    clear_obj(audio);
+    segment_audio_format(&audio, false); //digital out gets the song as it was
 
     //load and decrypt all the segments
     mb_printf("Start to load the song, please wait...\r\n");
     
-    for (; i < mb_state.current_song_header.nr_segments; i++) {
+    for (; i < mb_state.current_song.nr_segments; i++) {
         if (bytes_max && offset >= bytes_max) {
             // mb_debug("End loading the song.\r\n");
             break;
         }
-        if (!load_song_segment(fseg, segsize, i)) {
+        if (mb_state.current_song.codec != SEG_CODEC_PCM && fseg + segsize > arm_decrypted)
+            break; //the audio decoded so far would have overwritten it
+        if (!load_song_segment(fseg, segsize, i, &next_size)) {
             if (i == 0)
             {
                 // mb_debug("Load song segment failed.\r\n");
                 unload_song_header();
-                memzero(mipod_in->digital_data.play_data.filedata, decrypted_mem); 
                 return false;
             }
             else
@@ -762,22 +1363,30 @@ bool digitize_song(void) {
             }          
         }
         //decrypt and remove padding/trailers
-        raw = segsize - sizeof(struct segment_trailer);
-        decrypt_segment_data(segment_buffer, raw);
+        if (!segment_audio_open(&audio, segsize - mb_state.current_song.trailer_size))
+            break;
+        if (mb_state.current_song.codec != SEG_CODEC_PCM) {
+            if (audio.start != offset || audio.len > SONG_SLOT_SZ - offset)
+                break; //coded segments have to follow on from each other, like raw ones do
+        }
+        if (!digitize_segment(arm_decrypted + offset, &audio))
+            break;
 
-        offset += raw;
+        offset += audio.len;
         fseg += segsize;
-        segsize = ((struct segment_trailer *)((uint8_t *)segment_buffer + segsize - sizeof(struct segment_trailer)))->next_segment_size;
-        Xil_MemCpy(arm_decrypted, segment_buffer, raw);
-        decrypted_mem += raw;
-        arm_decrypted += raw;
+        segsize = next_size;
     }
     mb_printf("Song decryption ready, start to write into file.\r\n");
-    mipod_in->digital_data.wav_size = decrypted_mem;
+    mipod_in->digital_data.wav_size = offset;
+    shm_flush_obj(mipod_in->digital_data.wav_size);
     return true;
 }
 
 /*
+shares the song with every user in mipod_in->shared_users.
+the header is verified once, all bits are set, and it is signed and written back once, however many users there are.
+the outcome for each user is reported in mipod_in->share_result.
+fails if nobody new was added.
 note: assumes that all possible users will exist on the local device (ie no cross-device song sharing, those users will be overwritten).
 this seems to be in accordance with the spec, but I am not 100% sure.
 */
@@ -788,32 +1397,56 @@ bool share_song(void)
     int32_t res = NULL;
     int8_t targetuid = NULL;
     uint8_t tempOwner = NULL;
+    uint8_t results[MAX_SHARE_TARGETS];
+    uint32_t count, added = 0;
+
+    memset(results, SHARE_NOT_DONE, sizeof(results));
+    shm_invalidate_obj(mipod_in->shared_users);
+    count = min(mipod_in->share_count, MAX_SHARE_TARGETS);
     if (!mb_state.logged_in_user) {
         mb_printf("Need to login first!!!!\r\n");
         goto fail;
     }
-    memcpy(target, mipod_in->shared_user, UNAME_SIZE);
     res = load_song_header(&mipod_in->digital_data.play_data.drm);
     if (res != SONG_OWNER) {
         mb_printf("You are not owner of the song!!!\r\n");
         goto fail;
     }
-    // username_to_uid(target, &targetuid, TRUE);
-    tempOwner = mb_state.current_song_header.ownerID;
-    if ((! username_to_uid(target, &targetuid, TRUE)) || targetuid == tempOwner) {
-        mb_printf("Invalid Target.\r\n");
-        goto fail;
+    tempOwner = mb_state.current_song.ownerID;
+
+    for (uint32_t i = 0; i < count; i++) {
+        copytolocal(target, mipod_in->shared_users[i], UNAME_SIZE);
+        target[UNAME_SIZE - 1] = '\0';
+        if ((! username_to_uid(target, (char *)&targetuid, TRUE)) || targetuid == tempOwner) {
+            mb_printf("Invalid Target: %s\r\n", target);
+            results[i] = SHARE_BADUSER;
+            continue;
+        }
+        if (bitmap_test(mb_state.current_song.shared_users, targetuid)) {
+            mb_printf("Song is already shared with user: %s \r\n", target);
+            results[i] = SHARE_ALREADY;
+            continue;
+        }
+        //the parsed bitmap is updated too, so a name listed twice is reported as already shared
+        bitmap_set(mb_state.current_song.shared_users, targetuid);
+        if (mb_state.current_song.version == DRM_VERSION_2)
+            bitmap_set(mb_state.current_song_header.v2.shared_users, targetuid);
+        else
+            mb_state.current_song_header.v1.shared_users[targetuid] = 1;
+        results[i] = SHARE_OK;
+        added++;
     }
-    if (mb_state.current_song_header.shared_users[targetuid]) {
-        mb_printf("Song is already shared with user: %s \r\n", target);
+    if (!added)
         goto fail;
-    }
-    mb_state.current_song_header.shared_users[targetuid] = 1;
-    sign_user_block(&mb_state.current_song_header, offsetof(drm_header, owner_sig));
-    memcpy(&mipod_in->digital_data.play_data.drm, &mb_state.current_song_header, sizeof(mb_state.current_song_header));
+
+    sign_user_block(&mb_state.current_song_header, owner_sig_offset(&mb_state.current_song));
+    header_cache_clear(); //the old header is superseded
+    copyfromlocal(&mipod_in->digital_data.play_data.drm, &mb_state.current_song_header, mb_state.current_song.header_size);
+    mb_printf("Shared with %d of %d users.\r\n", added, count);
     rcode = true;
 
     fail:;
+    copyfromlocal(mipod_in->share_result, results, sizeof(results));
     unload_song_header();
     return rcode;
 }
@@ -4,6 +4,13 @@
 
 #include "xil_types.h"
 #include "xil_mem.h"
+#include "xil_cache.h"
+#include "xparameters.h"
+
+//the shared ddr window lies inside the cacheable range, so the data cache has to be kept coherent by hand
+#if defined(XPAR_MICROBLAZE_USE_DCACHE) && (XPAR_MICROBLAZE_USE_DCACHE == 1)
+#define SHM_CACHED
+#endif
 
 #ifndef _MSC_VER //msvc has these as builtin functions
 
@@ -124,16 +131,35 @@ void* memzero(void* buf, size_t n) {
 	return buf;
 }
 
-void* copytolocal(void* fpga_dest, const void* arm_src, size_t n) {
+void shm_invalidate(const volatile void* arm_src, size_t n) {
+#ifdef SHM_CACHED
+	Xil_DCacheInvalidateRange((u32)(UINTPTR)arm_src, (u32)n);
+#else
+	(void)arm_src; (void)n;
+#endif
+}
+
+void shm_flush(const volatile void* arm_dest, size_t n) {
+#ifdef SHM_CACHED
+	Xil_DCacheFlushRange((u32)(UINTPTR)arm_dest, (u32)n);
+#else
+	(void)arm_dest; (void)n;
+#endif
+}
+
+void* copytolocal(void* fpga_dest, const volatile void* arm_src, size_t n) {
 	//return memmove(fpga_dest, arm_src, n);
-	Xil_MemCpy(fpga_dest,arm_src,n);
+	//drop stale lines first, the copy then reads the source in whole cache line bursts
+	shm_invalidate(arm_src, n);
+	Xil_MemCpy(fpga_dest,(const void*)arm_src,n);
 	return fpga_dest;
 }
 
-void* copyfromlocal(void* arm_dest, const void* fpga_src, size_t n) {
+void* copyfromlocal(volatile void* arm_dest, const void* fpga_src, size_t n) {
 	//	return memmove(arm_dest, fpga_src, n);
-	Xil_MemCpy(arm_dest,fpga_src,n);
-	return arm_dest;
+	Xil_MemCpy((void*)arm_dest,fpga_src,n);
+	shm_flush(arm_dest, n);
+	return (void*)arm_dest;
 }
 
 //taken from utils.c
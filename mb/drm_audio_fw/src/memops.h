@@ -32,12 +32,27 @@ zeroes the memory at buf
 */
 void* memzero(void* buf, size_t n);
 /*
+drops any cached copy of a shared memory range, so the next read sees what the arm wrote.
+a no-op when the microblaze has no data cache.
+*/
+void shm_invalidate(const volatile void* arm_src, size_t n);
+/*
+pushes our writes to a shared memory range out to ddr before the arm looks at it.
+a no-op when the microblaze has no data cache.
+*/
+void shm_flush(const volatile void* arm_dest, size_t n);
+//keeps a single field of a shared struct coherent
+#define shm_invalidate_obj(obj_) shm_invalidate(&(obj_), sizeof(obj_))
+#define shm_flush_obj(obj_) shm_flush(&(obj_), sizeof(obj_))
+/*
 copies memory from fpga-only memory to a shared memory section the arm processor can access.
+the range is flushed afterwards.
 */
-void* copyfromlocal(void* arm_dest, const void* fpga_src, size_t n);
+void* copyfromlocal(volatile void* arm_dest, const void* fpga_src, size_t n);
 /*
 copies memory from shared arm-accessible space to fpga-only ram.
+the range is invalidated first, so the copy never sees stale cache lines.
 */
-void* copytolocal(void* fpga_dest, const void* arm_src, size_t n);
+void* copytolocal(void* fpga_dest, const volatile void* arm_src, size_t n);
 
 #endif // !MEMOPS_H
@@ -0,0 +1,64 @@
+/*
+Kernels widening wav pcm to the codec's 16 bit stereo, see pcm.h.
+
+Each loop reads one word of input and writes one output word per frame it holds. 8 bit wav samples are unsigned,
+flipping the top bit of every byte makes them signed, and shifting a byte into the top of a 16 bit half then
+widens it.
+*/
+#include "pcm.h"
+
+//16 bit mono: 2 frames per word, each sample goes to both channels
+static size_t widen_mono16(uint32_t *dest, const uint32_t *src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n / 4; i++) {
+        uint32_t w = src[i];
+        *dest++ = (w & 0xFFFF) | (w << 16);
+        *dest++ = (w >> 16) | (w & 0xFFFF0000);
+    }
+    return n * 2;
+}
+
+//8 bit stereo: 2 frames per word
+static size_t widen_stereo8(uint32_t *dest, const uint32_t *src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n / 4; i++) {
+        uint32_t w = src[i] ^ 0x80808080;
+        *dest++ = ((w & 0xFF) << 8) | ((w & 0xFF00) << 16);
+        *dest++ = ((w >> 8) & 0xFF00) | (w & 0xFF000000);
+    }
+    return n * 2;
+}
+
+//8 bit mono: 4 frames per word
+static size_t widen_mono8(uint32_t *dest, const uint32_t *src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n / 4; i++) {
+        uint32_t w = src[i] ^ 0x80808080, s;
+        s = (w << 8) & 0xFF00;
+        *dest++ = s | (s << 16);
+        s = w & 0xFF00;
+        *dest++ = s | (s << 16);
+        s = (w >> 8) & 0xFF00;
+        *dest++ = s | (s << 16);
+        s = (w >> 16) & 0xFF00;
+        *dest++ = s | (s << 16);
+    }
+    return n * 4;
+}
+
+pcm_widen_fn pcm_widener(int channels, int sample_bits)
+{
+    if (channels == 1 && sample_bits == 16)
+        return widen_mono16;
+    if (channels == 2 && sample_bits == 8)
+        return widen_stereo8;
+    if (channels == 1 && sample_bits == 8)
+        return widen_mono8;
+    return NULL;
+}
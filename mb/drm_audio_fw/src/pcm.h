@@ -0,0 +1,32 @@
+#pragma once
+#ifndef PCM_H
+#define PCM_H
+//see pcm.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+the codec takes 16 bit stereo: each frame is one little endian word, the left sample in the low half.
+songs in any other wav format are widened to that on their way into the dma bram, by a kernel picked once per song.
+the kernels work a word at a time, since the bram sits behind axi and every access costs the same whatever its width.
+*/
+
+#define PCM_NATIVE_CHANNELS 2
+#define PCM_NATIVE_BITS 16
+#define PCM_NATIVE_FRAME 4 //bytes per native frame
+#define pcm_frame_size(channels, bits) ((channels) * (bits) / 8)
+
+/*
+widens the <n> bytes of pcm at <src> into native frames at <dest>.
+both must be 4 byte aligned, and <n> a multiple of 4.
+returns the number of bytes written, PCM_NATIVE_FRAME / pcm_frame_size times <n>.
+*/
+typedef size_t (*pcm_widen_fn)(uint32_t *dest, const uint32_t *src, size_t n);
+
+/*
+returns the kernel for audio with <channels> channels of <sample_bits> bits, NULL if that is the native format
+already or one we do not know, which is then played as it is.
+*/
+pcm_widen_fn pcm_widener(int channels, int sample_bits);
+
+#endif // !PCM_H
@@ -0,0 +1,15 @@
+#include "phf.h"
+
+uint32_t phf_hash(const char *s, uint32_t seed) {
+    uint32_t h = 0x811c9dc5 ^ seed;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+uint16_t phf_find(const char *name, const uint16_t *seeds, uint32_t nr_seeds, const uint16_t *slots, uint32_t nr_slots) {
+    uint16_t seed = seeds[phf_hash(name, 0) % nr_seeds];
+    return slots[phf_hash(name, seed) % nr_slots];
+}
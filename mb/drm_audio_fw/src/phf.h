@@ -0,0 +1,22 @@
+#pragma once
+#ifndef PHF_H
+#define PHF_H
+//see phf.c for implementation
+#include <stdint.h>
+
+/*
+the perfect hash tables tools/createDevice writes into secrets.h, for looking user and region names up in
+constant time.
+*/
+
+/*
+seeded fnv-1a. createDevice builds the tables with the same function.
+*/
+uint32_t phf_hash(const char *s, uint32_t seed);
+/*
+looks <name> up in a perfect hash table generated by createDevice.
+returns the only table index <name> can be at, or PHF_NONE. the caller still has to compare the name.
+*/
+uint16_t phf_find(const char *name, const uint16_t *seeds, uint32_t nr_seeds, const uint16_t *slots, uint32_t nr_slots);
+
+#endif // !PHF_H
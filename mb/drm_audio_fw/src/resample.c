@@ -0,0 +1,195 @@
+/*
+Polyphase sample rate converter, see resample.h.
+
+The bank is designed in double precision (soft float on the microblaze, but only when the rates change) without
+libm: sin comes from a short taylor series and the bessel function of the window from its power series, which is
+plenty for 16 bit coefficients. Each phase is a Kaiser windowed sinc, rounded so its taps sum to exactly
+1 << RS_COEF_BITS and silence stays silence.
+*/
+#include "resample.h"
+#include "memops.h"
+#include "pcm.h"
+
+#define RS_CUTOFF 0.95 //the passband edge, relative to the nyquist frequency of the lower of the two rates
+#define RS_KAISER_BETA 7.0 //trades the width of the transition band for stopband attenuation
+#define RS_MAX_DOWN 4 //the filter is too short to bandlimit anything lower than in_rate / RS_MAX_DOWN
+#define PI 3.14159265358979323846
+
+static int16_t bank[RS_MAX_PHASES][RS_TAPS];
+static uint32_t bank_l, bank_m, bank_phases; //what bank was built for, 0 if nothing
+
+//sin(pi * x)
+static double sin_pi(double x)
+{
+    double y, y2, term, sum;
+    int i;
+
+    x -= 2.0 * (double)(int64_t)(x / 2.0); //-2 < x < 2
+    if (x > 1.0)
+        x -= 2.0;
+    else if (x < -1.0)
+        x += 2.0;
+    if (x > 0.5) //fold into -0.5 .. 0.5, where the series converges fast
+        x = 1.0 - x;
+    else if (x < -0.5)
+        x = -1.0 - x;
+
+    y = PI * x;
+    y2 = y * y;
+    term = sum = y;
+    for (i = 1; i < 9; i++) {
+        term *= -y2 / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+//the zeroth order modified bessel function of the first kind, I0(x), from <x2> = x * x
+static double bessel_i0(double x2)
+{
+    double term = 1.0, sum = 1.0;
+    int k;
+
+    for (k = 1; k < 25; k++) {
+        term *= x2 / (4.0 * k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+fills bank with <phases> phases of the filter for converting by <fc> (out_rate / in_rate, at most 1).
+tap k of phase p weighs input frame n - RS_TAPS / 2 + 1 + k for an output frame at n + p / phases.
+*/
+static void build_bank(uint32_t phases, double fc)
+{
+    double h[RS_TAPS], sum, t, w, norm = bessel_i0(RS_KAISER_BETA * RS_KAISER_BETA);
+    int32_t q[RS_TAPS], total;
+    uint32_t p;
+    int k;
+
+    fc *= RS_CUTOFF;
+    for (p = 0; p < phases; p++) {
+        sum = 0;
+        for (k = 0; k < RS_TAPS; k++) {
+            t = k - (RS_TAPS / 2 - 1) - (double)p / phases; //-RS_TAPS / 2 < t <= RS_TAPS / 2
+            h[k] = fc * t == 0 ? fc : sin_pi(fc * t) / (PI * t);
+            w = 2 * t / RS_TAPS;
+            h[k] *= bessel_i0(RS_KAISER_BETA * RS_KAISER_BETA * (1 - w * w)) / norm;
+            sum += h[k];
+        }
+        total = 0;
+        for (k = 0; k < RS_TAPS; k++) {
+            t = h[k] / sum * (1 << RS_COEF_BITS);
+            q[k] = (int32_t)(t < 0 ? t - 0.5 : t + 0.5);
+            total += q[k];
+        }
+        q[RS_TAPS / 2 - 1 + (p * 2 >= phases)] += (1 << RS_COEF_BITS) - total; //the rounding error goes to the biggest tap
+        for (k = 0; k < RS_TAPS; k++)
+            bank[p][k] = (int16_t)q[k];
+    }
+}
+
+bool resample_init(resampler *rs, uint32_t in_rate, uint32_t out_rate, int channels, int sample_bits)
+{
+    uint32_t g;
+
+    memzero(rs, sizeof(*rs));
+    if (!in_rate || !out_rate || in_rate > out_rate * RS_MAX_DOWN)
+        return false;
+    if ((channels != 1 && channels != 2) || (sample_bits != 8 && sample_bits != 16))
+        return false;
+
+    g = gcd(in_rate, out_rate);
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->l = out_rate / g;
+    rs->m = in_rate / g;
+    rs->phases = rs->l < RS_MAX_PHASES ? rs->l : RS_MAX_PHASES;
+    rs->phase_mul = ((uint64_t)rs->phases << 32) / rs->l;
+    rs->channels = channels;
+    rs->sample_bits = sample_bits;
+
+    if (bank_l != rs->l || bank_m != rs->m || bank_phases != rs->phases) {
+        build_bank(rs->phases, in_rate > out_rate ? (double)out_rate / in_rate : 1.0);
+        bank_l = rs->l;
+        bank_m = rs->m;
+        bank_phases = rs->phases;
+    }
+    resample_reset(rs);
+    return true;
+}
+
+void resample_reset(resampler *rs)
+{
+    memzero(rs->hist, sizeof(rs->hist));
+    rs->acc = 0;
+    rs->pos = 0;
+    rs->need = RS_TAPS / 2 + 1; //the first output frame is centred on the first input frame
+}
+
+size_t resample_run(resampler *rs, const uint8_t *src, size_t *src_len, uint8_t *dest, size_t room)
+{
+    size_t frame = pcm_frame_size(rs->channels, rs->sample_bits), in = 0, out = 0;
+    uint32_t *native = (uint32_t *)dest;
+    const int16_t *h, *x;
+    int32_t sum, y[2];
+    int ch, k;
+
+    while (out + PCM_NATIVE_FRAME <= room) {
+        if (rs->need) { //take in the next input frame
+            if (in + frame > *src_len)
+                break;
+            for (ch = 0; ch < rs->channels; ch++) {
+                int16_t v;
+                if (rs->sample_bits == 16) {
+                    v = (int16_t)(src[in] | (src[in + 1] << 8));
+                    in += 2;
+                } else {
+                    v = (int16_t)((src[in++] - 128) << 8); //8 bit wav samples are unsigned
+                }
+                rs->hist[ch][rs->pos] = rs->hist[ch][rs->pos + RS_TAPS] = v;
+            }
+            if (++rs->pos == RS_TAPS)
+                rs->pos = 0;
+            rs->need--;
+            continue;
+        }
+
+        //hist[ch][pos ..] holds the last RS_TAPS frames, oldest first
+        h = bank[rs->phases == rs->l ? rs->acc : (uint32_t)((rs->acc * rs->phase_mul) >> 32)];
+        for (ch = 0; ch < rs->channels; ch++) {
+            x = &rs->hist[ch][rs->pos];
+            sum = 1 << (RS_COEF_BITS - 1);
+            for (k = 0; k < RS_TAPS; k++)
+                sum += h[k] * x[k];
+            sum >>= RS_COEF_BITS;
+            if (sum > 32767)
+                sum = 32767;
+            else if (sum < -32768)
+                sum = -32768;
+            y[ch] = sum;
+        }
+        *native++ = (uint16_t)y[0] | ((uint32_t)(uint16_t)y[rs->channels - 1] << 16); //mono goes to both channels
+        out += PCM_NATIVE_FRAME;
+
+        //step to the next output frame, m / l input frames on
+        rs->acc += rs->m;
+        while (rs->acc >= rs->l) {
+            rs->acc -= rs->l;
+            rs->need++;
+        }
+    }
+    *src_len = in;
+    return out;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+//see resample.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+streaming sample rate converter for songs that were not recorded at the codec's rate.
+the ratio out/in is reduced to L/M: output frame i sits at input position i * M / L, whose fraction picks one of
+the L phases of a windowed sinc filter of RS_TAPS taps. the filter bank is built once per rate pair, the
+conversion itself is 16 bit fixed point. ratios with more than RS_MAX_PHASES phases use the closest earlier one
+of RS_MAX_PHASES evenly spaced phases, so the rate is still exact but each frame may be early by up to
+1 / RS_MAX_PHASES of an input frame.
+the input may be 8 or 16 bits, 1 or 2 channels, the output is always native 16 bit stereo (see pcm.h), so widening
+costs nothing extra. the filter keeps its history across calls, so a song can be fed in pieces of any size.
+*/
+
+#define RS_TAPS 24 //input frames each output frame is made of
+#define RS_MAX_PHASES 160 //enough for 44.1k -> 48k to be exact
+#define RS_COEF_BITS 14 //the coefficients of each phase sum to 1 << RS_COEF_BITS
+
+typedef struct {
+    uint32_t in_rate, out_rate;
+    uint32_t l, m; //out_rate / in_rate in lowest terms
+    uint32_t phases; //min(l, RS_MAX_PHASES)
+    uint64_t phase_mul; //phases / l in 0.32 fixed point, for rounding a position to a phase
+    uint8_t channels, sample_bits;
+    //streaming state
+    uint32_t acc; //the fraction of the next output frame's input position, in 1/l frames
+    uint32_t need; //input frames to take in before the next output frame
+    uint32_t pos; //where the next input frame goes in hist
+    int16_t hist[2][2 * RS_TAPS]; //the last RS_TAPS input frames per channel, stored twice so they are contiguous
+} resampler;
+
+/*
+sets up <rs> for converting audio with <channels> channels of <sample_bits> bits from <in_rate> to <out_rate>.
+the filter bank is shared by all resamplers and only rebuilt when the rates change, which costs a few hundred
+thousand floating point operations.
+returns false if the rates or the format are not supported.
+*/
+bool resample_init(resampler *rs, uint32_t in_rate, uint32_t out_rate, int channels, int sample_bits);
+/*
+forgets the audio taken in so far, eg after a seek.
+*/
+void resample_reset(resampler *rs);
+/*
+converts the <*src_len> bytes at <src> into at most <room> bytes of native frames at <dest>, which must be 4 byte
+aligned.
+<*src_len> is set to the number of bytes taken in, which is all of them unless <dest> filled up.
+returns the number of bytes written to <dest>.
+*/
+size_t resample_run(resampler *rs, const uint8_t *src, size_t *src_len, uint8_t *dest, size_t room);
+
+#endif // !RESAMPLE_H
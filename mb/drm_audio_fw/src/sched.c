@@ -0,0 +1,84 @@
+#include "sched.h"
+#include "mb_interface.h"
+
+/*
+a very small run-to-completion scheduler.
+events are bits in one word. interrupt handlers and tasks set them, the superloop takes the whole word
+at once and runs every task that is waiting on one of the bits.
+there is no preemption, so tasks never have to lock anything against each other, only against the isrs.
+*/
+
+typedef struct {
+    sched_task_fn fn;
+    uint32_t events;
+} sched_task;
+
+static sched_task tasks[SCHED_MAX_TASKS];
+static sched_task_fn idle_tasks[SCHED_MAX_TASKS];
+static uint32_t nr_tasks, nr_idle_tasks;
+static sched_poll_fn poll_sources;
+static volatile uint32_t pending;
+
+void sched_init(sched_poll_fn poll) {
+    nr_tasks = nr_idle_tasks = 0;
+    poll_sources = poll;
+    pending = 0;
+}
+
+bool sched_add(sched_task_fn fn, uint32_t events) {
+    if (nr_tasks == SCHED_MAX_TASKS)
+        return false;
+    tasks[nr_tasks].fn = fn;
+    tasks[nr_tasks].events = events;
+    nr_tasks++;
+    return true;
+}
+
+bool sched_add_idle(sched_task_fn fn) {
+    if (nr_idle_tasks == SCHED_MAX_TASKS)
+        return false;
+    idle_tasks[nr_idle_tasks++] = fn;
+    return true;
+}
+
+void sched_post(uint32_t events) {
+    //a read-modify-write, so keep the isr from posting in the middle of it.
+    //posting from the isr itself is fine, interrupts are already off there.
+    uint32_t msr = mfmsr();
+    microblaze_disable_interrupts();
+    pending |= events;
+    if (msr & 0x2) //MSR[IE]
+        microblaze_enable_interrupts();
+}
+
+/*
+takes all pending events, leaving none behind.
+*/
+static uint32_t sched_take(void) {
+    uint32_t ev;
+    microblaze_disable_interrupts();
+    ev = pending;
+    pending = 0;
+    microblaze_enable_interrupts();
+    return ev;
+}
+
+bool sched_run_once(void) {
+    uint32_t ev, i;
+
+    if (poll_sources)
+        poll_sources();
+
+    ev = sched_take();
+    if (!ev) {
+        for (i = 0; i < nr_idle_tasks; i++)
+            idle_tasks[i]();
+        return false;
+    }
+
+    for (i = 0; i < nr_tasks; i++) {
+        if (tasks[i].events & ev)
+            tasks[i].fn();
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef SCHED_H
+#define SCHED_H
+//see sched.c for implementation
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS 8
+
+/*
+a task does a bounded amount of work and returns, it never waits on anything.
+if it needs to run again it posts one of its own events.
+*/
+typedef void (*sched_task_fn)(void);
+
+/*
+called once per scheduler pass to turn hardware state that has no interrupt of its own (eg dma idle)
+into events.
+*/
+typedef void (*sched_poll_fn)(void);
+
+/*
+forgets all tasks and pending events.
+*/
+void sched_init(sched_poll_fn poll);
+/*
+registers <fn> to run whenever any of the bits in <events> is posted.
+tasks run in the order they were added, so add the most latency sensitive ones first.
+returns false if the task table is full.
+*/
+bool sched_add(sched_task_fn fn, uint32_t events);
+/*
+registers <fn> to run when no events are pending, ie in time the superloop would otherwise spin away.
+*/
+bool sched_add_idle(sched_task_fn fn);
+/*
+marks <events> as pending. safe to call from an interrupt handler.
+*/
+void sched_post(uint32_t events);
+/*
+runs every task with a pending event once, or the idle tasks if there were none.
+returns true if an event task ran.
+*/
+bool sched_run_once(void);
+
+#endif // !SCHED_H
@@ -17,6 +17,17 @@
   (cp)[1] = (unsigned char)((value) >> 16), \
   (cp)[2] = (unsigned char)((value) >> 8), \
   (cp)[3] = (unsigned char)(value) )
+#define GET_32BIT_MSB_FIRST(cp) ( \
+  (((uint32)(cp)[0]) << 24) | (((uint32)(cp)[1]) << 16) | \
+  (((uint32)(cp)[2]) << 8) | ((uint32)(cp)[3]) )
+/* a word that was loaded from memory as is, put into big-endian order */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GET_32BIT_MSB_FIRST_W(w) (w)
+#else
+#define GET_32BIT_MSB_FIRST_W(w) ( \
+  (((w) & 0xFF) << 24) | (((w) & 0xFF00) << 8) | \
+  (((w) >> 8) & 0xFF00) | ((w) >> 24) )
+#endif
 
 static void SHA_Core_Init(uint32 h[5])
 {
@@ -27,95 +38,82 @@ static void SHA_Core_Init(uint32 h[5])
     h[4] = 0xc3d2e1f0;
 }
 
-void SHATransform(word32 * digest, word32 * block)
+/*
+ * The message schedule only ever looks 16 words back, so it is kept
+ * in a 16 word ring that is overwritten in place as the rounds go,
+ * instead of being expanded to 80 words up front. All 80 rounds are
+ * unrolled, and rather than shuffling a..e every round the variables
+ * change roles, so one group of five rounds ends where it started.
+ */
+#define SHA_F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define SHA_F2(b, c, d) ((b) ^ (c) ^ (d))
+#define SHA_F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define SHA_W(t) ((t) < 16 ? w[(t) & 15] : \
+    (w[(t) & 15] = rol(w[((t) + 13) & 15] ^ w[((t) + 8) & 15] ^ \
+                       w[((t) + 2) & 15] ^ w[(t) & 15], 1)))
+#define SHA_R(a, b, c, d, e, f, k, t) do { \
+    e += rol(a, 5) + f(b, c, d) + (k) + SHA_W(t); \
+    b = rol(b, 30); \
+} while (0)
+#define SHA_R5(f, k, t) \
+    SHA_R(a, b, c, d, e, f, k, (t)); \
+    SHA_R(e, a, b, c, d, f, k, (t) + 1); \
+    SHA_R(d, e, a, b, c, f, k, (t) + 2); \
+    SHA_R(c, d, e, a, b, f, k, (t) + 3); \
+    SHA_R(b, c, d, e, a, f, k, (t) + 4)
+
+/*
+ * Compresses one block of 16 big-endian words into the digest. The
+ * block is used as the schedule, so it is clobbered.
+ */
+static void SHA_Compress(uint32 h[5], uint32 w[16])
 {
-    word32 w[80];
-    word32 a, b, c, d, e;
-    int t;
-
-#ifdef RANDOM_DIAGNOSTICS
-    {
-        extern int random_diagnostics;
-        if (random_diagnostics) {
-            int i;
-            printf("SHATransform:");
-            for (i = 0; i < 5; i++)
-                printf(" %08x", digest[i]);
-            printf(" +");
-            for (i = 0; i < 16; i++)
-                printf(" %08x", block[i]);
-        }
-    }
-#endif
+    uint32 a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
 
-    for (t = 0; t < 16; t++)
-        w[t] = block[t];
+    SHA_R5(SHA_F1, 0x5a827999, 0);
+    SHA_R5(SHA_F1, 0x5a827999, 5);
+    SHA_R5(SHA_F1, 0x5a827999, 10);
+    SHA_R5(SHA_F1, 0x5a827999, 15);
+    SHA_R5(SHA_F2, 0x6ed9eba1, 20);
+    SHA_R5(SHA_F2, 0x6ed9eba1, 25);
+    SHA_R5(SHA_F2, 0x6ed9eba1, 30);
+    SHA_R5(SHA_F2, 0x6ed9eba1, 35);
+    SHA_R5(SHA_F3, 0x8f1bbcdc, 40);
+    SHA_R5(SHA_F3, 0x8f1bbcdc, 45);
+    SHA_R5(SHA_F3, 0x8f1bbcdc, 50);
+    SHA_R5(SHA_F3, 0x8f1bbcdc, 55);
+    SHA_R5(SHA_F2, 0xca62c1d6, 60);
+    SHA_R5(SHA_F2, 0xca62c1d6, 65);
+    SHA_R5(SHA_F2, 0xca62c1d6, 70);
+    SHA_R5(SHA_F2, 0xca62c1d6, 75);
 
-    for (t = 16; t < 80; t++) {
-        word32 tmp = w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16];
-        w[t] = rol(tmp, 1);
-    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
 
-    a = digest[0];
-    b = digest[1];
-    c = digest[2];
-    d = digest[3];
-    e = digest[4];
-
-    for (t = 0; t < 20; t++) {
-        word32 tmp =
-            rol(a, 5) + ((b & c) | (d & ~b)) + e + w[t] + 0x5a827999;
-        e = d;
-        d = c;
-        c = rol(b, 30);
-        b = a;
-        a = tmp;
-    }
-    for (t = 20; t < 40; t++) {
-        word32 tmp = rol(a, 5) + (b ^ c ^ d) + e + w[t] + 0x6ed9eba1;
-        e = d;
-        d = c;
-        c = rol(b, 30);
-        b = a;
-        a = tmp;
-    }
-    for (t = 40; t < 60; t++) {
-        word32 tmp = rol(a,
-                         5) + ((b & c) | (b & d) | (c & d)) + e + w[t] +
-            0x8f1bbcdc;
-        e = d;
-        d = c;
-        c = rol(b, 30);
-        b = a;
-        a = tmp;
-    }
-    for (t = 60; t < 80; t++) {
-        word32 tmp = rol(a, 5) + (b ^ c ^ d) + e + w[t] + 0xca62c1d6;
-        e = d;
-        d = c;
-        c = rol(b, 30);
-        b = a;
-        a = tmp;
-    }
+/*
+ * Compresses nblocks consecutive 64 byte blocks straight out of p.
+ * Word aligned input is loaded a word at a time.
+ */
+static void SHA_Core_Blocks(uint32 h[5], const unsigned char *p,
+                            int nblocks)
+{
+    uint32 w[16];
+    int i;
 
-    digest[0] += a;
-    digest[1] += b;
-    digest[2] += c;
-    digest[3] += d;
-    digest[4] += e;
-
-#ifdef RANDOM_DIAGNOSTICS
-    {
-        extern int random_diagnostics;
-        if (random_diagnostics) {
-            int i;
-            printf(" =");
-            for (i = 0; i < 5; i++)
-                printf(" %08x", digest[i]);
-            printf("\n");
+    for (; nblocks > 0; nblocks--, p += 64) {
+        if (!((unsigned long) p & 3)) {
+            for (i = 0; i < 16; i++)
+                w[i] = GET_32BIT_MSB_FIRST_W(((const uint32 *) p)[i]);
+        } else {
+            for (i = 0; i < 16; i++)
+                w[i] = GET_32BIT_MSB_FIRST(p + 4 * i);
         }
+        SHA_Compress(h, w);
     }
-#endif
 }
 
 /* ----------------------------------------------------------------------
@@ -134,9 +132,8 @@ void SHA_Init(SHA_State * s)
 void SHA_Bytes(SHA_State * s, const void *p, int len)
 {
     const unsigned char *q = (const unsigned char *) p;
-    uint32 wordblock[16];
     uint32 lenw = len;
-    int i;
+    int n;
 
     /*
      * Update the length field.
@@ -144,34 +141,84 @@ void SHA_Bytes(SHA_State * s, const void *p, int len)
     s->lenlo += lenw;
     s->lenhi += (s->lenlo < lenw);
 
-    if (s->blkused && s->blkused + len < 64) {
-        /*
-         * Trivial case: just add to the block.
-         */
-        memcpy(s->block + s->blkused, q, len);
-        s->blkused += len;
-    } else {
-        /*
-         * We must complete and process at least one block.
-         */
-        while (s->blkused + len >= 64) {
-            memcpy(s->block + s->blkused, q, 64 - s->blkused);
-            q += 64 - s->blkused;
-            len -= 64 - s->blkused;
-            /* Now process the block. Gather bytes big-endian into words */
+    /*
+     * Top up a pending partial block first. Whole blocks after that
+     * are hashed in place, only the tail is buffered.
+     */
+    if (s->blkused) {
+        n = 64 - s->blkused;
+        if (len < n) {
+            memcpy(s->block + s->blkused, q, len);
+            s->blkused += len;
+            return;
+        }
+        memcpy(s->block + s->blkused, q, n);
+        q += n;
+        len -= n;
+        SHA_Core_Blocks(s->h, s->block, 1);
+        s->blkused = 0;
+    }
+    if (len >= 64) {
+        SHA_Core_Blocks(s->h, q, len >> 6);
+        q += len & ~63;
+        len &= 63;
+    }
+    memcpy(s->block, q, len);
+    s->blkused = len;
+}
+
+void SHA_Blocks(SHA_State * s, const void *p, int nblocks)
+{
+    uint32 lenw = (uint32) nblocks << 6;
+
+    if (s->blkused) {
+        SHA_Bytes(s, p, nblocks << 6);
+        return;
+    }
+    s->lenlo += lenw;
+    s->lenhi += (s->lenlo < lenw);
+    SHA_Core_Blocks(s->h, (const unsigned char *) p, nblocks);
+}
+
+/*
+ * Copy len bytes from src to dest and hash them on the way, so src
+ * is read exactly once. Each word is hashed from the register it was
+ * stored to dest from, never from a second read of src, so the digest
+ * always matches what ended up in dest even if src changes under us.
+ * Whole blocks take the fast path when both pointers are word
+ * aligned and no partial block is pending; anything else is copied
+ * first and then hashed out of dest.
+ */
+void SHA_CopyBytes(SHA_State * s, void *dest, const volatile void *src,
+                   int len)
+{
+    unsigned char *d = (unsigned char *) dest;
+    const volatile unsigned char *q = (const volatile unsigned char *) src;
+    uint32 wordblock[16];
+    uint32 lenw;
+    int i;
+
+    if (s->blkused == 0 &&
+        !(((unsigned long) d | (unsigned long) q) & 3)) {
+        lenw = len & ~63;
+        s->lenlo += lenw;
+        s->lenhi += (s->lenlo < lenw);
+        while (len >= 64) {
             for (i = 0; i < 16; i++) {
-                wordblock[i] =
-                    (((uint32) s->block[i * 4 + 0]) << 24) |
-                    (((uint32) s->block[i * 4 + 1]) << 16) |
-                    (((uint32) s->block[i * 4 + 2]) << 8) |
-                    (((uint32) s->block[i * 4 + 3]) << 0);
+                uint32 w = ((const volatile uint32 *) q)[i];
+                ((uint32 *) d)[i] = w;
+                wordblock[i] = GET_32BIT_MSB_FIRST_W(w);
             }
-            SHATransform(s->h, wordblock);
-            s->blkused = 0;
+            SHA_Compress(s->h, wordblock);
+            d += 64;
+            q += 64;
+            len -= 64;
         }
-        memcpy(s->block, q, len);
-        s->blkused = len;
     }
+
+    for (i = 0; i < len; i++)
+        d[i] = q[i];
+    SHA_Bytes(s, d, len);
 }
 
 void SHA_Final(SHA_State * s, unsigned char *output)
@@ -13,6 +13,14 @@ extern "C" {
     } SHA_State;
     void SHA_Init(SHA_State * s);
     void SHA_Bytes(SHA_State * s, const void *p, int len);
+    /*
+     * hashes nblocks whole 64 byte blocks from p without buffering them.
+     * same result as SHA_Bytes(s, p, nblocks * 64); fastest when p is word aligned
+     * and nothing is pending from an earlier SHA_Bytes.
+     */
+    void SHA_Blocks(SHA_State * s, const void *p, int nblocks);
+    void SHA_CopyBytes(SHA_State * s, void *dest, const volatile void *src,
+                       int len);
     void SHA_Final(SHA_State * s, unsigned char *output);
     void SHA_Simple(const void *p, int len, unsigned char *output);
 #ifdef  __cplusplus
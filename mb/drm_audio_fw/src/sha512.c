@@ -5,6 +5,7 @@
  */
 // #include <string.h>
 #include "sha512.h"
+#include "memops.h"
 //#define TEST
 #define BLKSIZE 128
 
@@ -0,0 +1,23 @@
+/*
+Our half of the trace rings, see mipod_trace in constants.h.
+We are the only writer of mb[] and mb_head, so our cached copy of mb_head is always current. The record goes out
+before the head that covers it, so the client never dumps a half written one.
+*/
+#include "trace.h"
+#include "memops.h"
+
+extern volatile mipod_buffer *mipod_in;
+
+void trace_event(uint16_t id, uint8_t ph, uint32_t arg) {
+    volatile mipod_trace *t = &mipod_in->trace;
+    volatile trace_record *rec = &t->mb[t->mb_head % TRACE_EVENTS];
+
+    shm_invalidate_obj(t->clock);
+    rec->ts = t->clock;
+    rec->id = id;
+    rec->ph = ph;
+    rec->arg = arg;
+    shm_flush(rec, sizeof(*rec));
+    t->mb_head++;
+    shm_flush_obj(t->mb_head);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#ifndef TRACE_H
+#define TRACE_H
+//see trace.c for implementation
+#include <stdint.h>
+#include "constants.h"
+
+/*
+records an event in our ring of mipod_buffer.trace, for the client to dump as a chrome trace.
+there is no timer in the block design, so the event is stamped with the client's clock as it last published it.
+that is exact to a few microseconds while the client waits on a command, and to TRACE_TICK_MS while a song plays.
+*/
+void trace_event(uint16_t id, uint8_t ph, uint32_t arg);
+#define trace_begin(id, arg) trace_event((id), TRACE_BEGIN, (arg))
+#define trace_end(id, arg) trace_event((id), TRACE_END, (arg))
+#define trace_mark(id, arg) trace_event((id), TRACE_INSTANT, (arg))
+
+#endif // !TRACE_H
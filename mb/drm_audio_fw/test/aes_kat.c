@@ -0,0 +1,138 @@
+/*
+known answer tests for the software aes engines in aes.c, and their throughput with --bench.
+
+both engines take the key and blocks the way protectSong stores them, ie transposed, and hand back the plain
+audio. so the fips-197 key is fed in transposed and the plaintext comes back transposed, and the protectSong vector is exactly what it writes for
+<key>: Transform(key) as the aes key, TransSeg(audio) as the blocks. it was made with
+
+    AES.new(Transform(key), AES.MODE_ECB).encrypt(TransSeg(audio, 48))
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "test.h"
+#include "aes.h"
+
+//fips-197 appendix c.1
+static const uint8_t fips_key[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+static const uint8_t fips_plain[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+};
+static const uint8_t fips_cipher[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a,
+};
+
+//a region key and three blocks of audio as protectSong encrypts them. three, so the bitsliced engine has a lone block.
+static const uint8_t song_key[16] = {
+    0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+};
+static const uint8_t song_plain[48] = {
+    0x0b, 0x30, 0x55, 0x7a, 0x9f, 0xc4, 0xe9, 0x0e, 0x33, 0x58, 0x7d, 0xa2, 0xc7, 0xec, 0x11, 0x36,
+    0x5b, 0x80, 0xa5, 0xca, 0xef, 0x14, 0x39, 0x5e, 0x83, 0xa8, 0xcd, 0xf2, 0x17, 0x3c, 0x61, 0x86,
+    0xab, 0xd0, 0xf5, 0x1a, 0x3f, 0x64, 0x89, 0xae, 0xd3, 0xf8, 0x1d, 0x42, 0x67, 0x8c, 0xb1, 0xd6,
+};
+static const uint8_t song_cipher[48] = {
+    0xc4, 0x42, 0x2f, 0x2a, 0xb9, 0x8b, 0xa4, 0xbb, 0x2c, 0xa9, 0x82, 0xd8, 0xc4, 0x78, 0x4f, 0x24,
+    0x5b, 0x5f, 0xf0, 0x6d, 0xb8, 0x16, 0x77, 0xbe, 0xf7, 0x79, 0xe2, 0x3c, 0x8e, 0x74, 0xa9, 0x30,
+    0x5c, 0x62, 0x96, 0xac, 0x31, 0x8b, 0xa6, 0xb7, 0x49, 0xb6, 0x94, 0x64, 0xd0, 0xbf, 0x0b, 0x7f,
+};
+
+static const struct {
+    int variant;
+    const char *name;
+} engines[] = {
+    { AES_SW_TTABLE, "t-table" },
+    { AES_SW_BITSLICED, "bitsliced" },
+};
+#define NR_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+//protectSong's Transform on one 16 byte block
+static void transpose(uint8_t out[16], const uint8_t in[16]) {
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            out[4 * c + r] = in[4 * r + c];
+}
+
+static void check_fips(int variant, const char *name) {
+    uint8_t key[16], plain[16], out[16];
+    aes_sw ctx;
+
+    //the engine's aes key is Transform(key), and it transposes the block it decrypts back
+    transpose(key, fips_key);
+    CHECK(aes_sw_init(&ctx, key, variant), "%s: init", name);
+    aes_sw_decrypt_blocks(&ctx, out, fips_cipher, 1);
+    transpose(plain, out);
+    CHECK(!memcmp(plain, fips_plain, 16), "%s: fips-197 c.1", name);
+}
+
+static void check_song(int variant, const char *name) {
+    uint8_t buf[sizeof(song_cipher)];
+    aes_sw ctx;
+
+    CHECK(aes_sw_init(&ctx, song_key, variant), "%s: init", name);
+    for (size_t n = 1; n <= sizeof(buf) / 16; n++) {
+        aes_sw_decrypt_blocks(&ctx, buf, song_cipher, n);
+        CHECK(!memcmp(buf, song_plain, n * 16), "%s: protectSong vector, %zu blocks", name, n);
+    }
+    //in place, the way segments are decrypted in segment_buffer
+    memcpy(buf, song_cipher, sizeof(buf));
+    aes_sw_decrypt_blocks(&ctx, buf, buf, sizeof(buf) / 16);
+    CHECK(!memcmp(buf, song_plain, sizeof(buf)), "%s: protectSong vector in place", name);
+}
+
+//both engines have to agree on random keys and lengths, odd block counts included
+static void check_agree(void) {
+    static uint8_t src[4096], out[NR_ENGINES][4096];
+    uint8_t key[16];
+    aes_sw ctx;
+
+    for (uint32_t round = 1; round <= 64; round++) {
+        size_t nblocks = round * 7 % (sizeof(src) / 16) + 1;
+        test_fill(key, sizeof(key), round);
+        test_fill(src, sizeof(src), ~round);
+        for (size_t e = 0; e < NR_ENGINES; e++) {
+            aes_sw_init(&ctx, key, engines[e].variant);
+            aes_sw_decrypt_blocks(&ctx, out[e], src, nblocks);
+        }
+        CHECK(!memcmp(out[0], out[1], nblocks * 16), "engines disagree, key %u, %zu blocks", round, nblocks);
+    }
+}
+
+static void bench(int variant, const char *name) {
+    static uint8_t buf[32000] __attribute__((aligned(4))); //one full segment
+    const int reps = 200;
+    uint8_t key[16];
+    uint64_t c, ns;
+    aes_sw ctx;
+
+    test_fill(key, sizeof(key), 7);
+    test_fill(buf, sizeof(buf), 8);
+    aes_sw_init(&ctx, key, variant);
+    c = test_cycles();
+    ns = test_ns();
+    for (int i = 0; i < reps; i++)
+        aes_sw_decrypt_blocks(&ctx, buf, buf, sizeof(buf) / 16);
+    c = test_cycles() - c;
+    ns = test_ns() - ns;
+    printf("  %-10s %7.1f MB/s %6.2f cycles/byte\n", name, (double)reps * sizeof(buf) * 1e3 / ns,
+           (double)c / reps / sizeof(buf));
+}
+
+int main(int argc, char **argv) {
+    aes_sw ctx;
+
+    for (size_t e = 0; e < NR_ENGINES; e++) {
+        check_fips(engines[e].variant, engines[e].name);
+        check_song(engines[e].variant, engines[e].name);
+    }
+    check_agree();
+    CHECK(!aes_sw_init(&ctx, fips_key, 0), "init takes an unknown variant");
+
+    if (test_bench(argc, argv)) {
+        printf("aes-128 decrypt, 32000 byte segment:\n");
+        for (size_t e = 0; e < NR_ENGINES; e++)
+            bench(engines[e].variant, engines[e].name);
+    }
+    return test_done("aes_kat");
+}
@@ -0,0 +1,196 @@
+/*
+known answer tests for blake2s.c, and the cost of verifying a segment with it against hmac-sha1 with --bench.
+
+- rfc 7693 appendix b, blake2s-256 of "abc", unkeyed
+- rfc 7693 appendix e, the self test: unkeyed and keyed digests of 16, 20, 28 and 32 bytes over messages of 0 to
+  1024 bytes, hashed together into one digest
+- the keyed vectors of the blake2 reference code (key 00..1f, message 00..n-1), through blake2s_update a byte at a
+  time, in one call, and blake2s_copy_update from an unaligned source into an unaligned destination
+- a segment mac as seg_mac_init keys it (the first 32 bytes of the 64 byte key, 20 byte digest), against python's
+  hashlib.blake2s
+*/
+#include <string.h>
+#include "test.h"
+#include "blake2s.h"
+#include "hmac.h"
+#include "constants.h"
+
+#define TRAILER_SZ sizeof(struct segment_trailer_v2)
+#define SEG (SEGMENT_BUF_SIZE + TRAILER_SZ) //a full v2 segment
+#define RUNS 200
+
+static const uint8_t abc_digest[32] = {
+    0x50, 0x8c, 0x5e, 0x8c, 0x32, 0x7c, 0x14, 0xe2, 0xe1, 0xa7, 0x2b, 0xa3, 0x4e, 0xeb, 0x45, 0x2f,
+    0x37, 0x45, 0x8b, 0x20, 0x9e, 0xd6, 0x3a, 0x29, 0x4d, 0x99, 0x9b, 0x4c, 0x86, 0x67, 0x59, 0x82,
+};
+
+static const uint8_t selftest_digest[32] = {
+    0x6a, 0x41, 0x1f, 0x08, 0xce, 0x25, 0xad, 0xcd, 0xfb, 0x02, 0xab, 0xa6, 0x41, 0x45, 0x1c, 0xec,
+    0x53, 0xc5, 0x98, 0xb2, 0x4f, 0x4f, 0xc7, 0x87, 0xfb, 0xdc, 0x88, 0x79, 0x7f, 0x4c, 0x1d, 0xfe,
+};
+
+static const struct {
+    size_t len;
+    uint8_t digest[32];
+} keyed[] = {
+    { 0, { 0x48, 0xa8, 0x99, 0x7d, 0xa4, 0x07, 0x87, 0x6b, 0x3d, 0x79, 0xc0, 0xd9, 0x23, 0x25, 0xad, 0x3b,
+           0x89, 0xcb, 0xb7, 0x54, 0xd8, 0x6a, 0xb7, 0x1a, 0xee, 0x04, 0x7a, 0xd3, 0x45, 0xfd, 0x2c, 0x49 } },
+    { 1, { 0x40, 0xd1, 0x5f, 0xee, 0x7c, 0x32, 0x88, 0x30, 0x16, 0x6a, 0xc3, 0xf9, 0x18, 0x65, 0x0f, 0x80,
+           0x7e, 0x7e, 0x01, 0xe1, 0x77, 0x25, 0x8c, 0xdc, 0x0a, 0x39, 0xb1, 0x1f, 0x59, 0x80, 0x66, 0xf1 } },
+    { 63, { 0xc6, 0x53, 0x82, 0x51, 0x3f, 0x07, 0x46, 0x0d, 0xa3, 0x98, 0x33, 0xcb, 0x66, 0x6c, 0x5e, 0xd8,
+            0x2e, 0x61, 0xb9, 0xe9, 0x98, 0xf4, 0xb0, 0xc4, 0x28, 0x7c, 0xee, 0x56, 0xc3, 0xcc, 0x9b, 0xcd } },
+    { 64, { 0x89, 0x75, 0xb0, 0x57, 0x7f, 0xd3, 0x55, 0x66, 0xd7, 0x50, 0xb3, 0x62, 0xb0, 0x89, 0x7a, 0x26,
+            0xc3, 0x99, 0x13, 0x6d, 0xf0, 0x7b, 0xab, 0xab, 0xbd, 0xe6, 0x20, 0x3f, 0xf2, 0x95, 0x4e, 0xd4 } },
+    { 65, { 0x21, 0xfe, 0x0c, 0xeb, 0x00, 0x52, 0xbe, 0x7f, 0xb0, 0xf0, 0x04, 0x18, 0x7c, 0xac, 0xd7, 0xde,
+            0x67, 0xfa, 0x6e, 0xb0, 0x93, 0x8d, 0x92, 0x76, 0x77, 0xf2, 0x39, 0x8c, 0x13, 0x23, 0x17, 0xa8 } },
+    { 255, { 0x3f, 0xb7, 0x35, 0x06, 0x1a, 0xbc, 0x51, 0x9d, 0xfe, 0x97, 0x9e, 0x54, 0xc1, 0xee, 0x5b, 0xfa,
+             0xd0, 0xa9, 0xd8, 0x58, 0xb3, 0x31, 0x5b, 0xad, 0x34, 0xbd, 0xe9, 0x99, 0xef, 0xd7, 0x24, 0xdd } },
+};
+
+//hashlib.blake2s(bytes((i * 13 + 5) & 0xff for i in range(1000)), key=key[:32], digest_size=20), see check_seg_mac
+static const uint8_t seg_digest[SEG_MAC_SIZE] = {
+    0x5d, 0xaf, 0x6b, 0xbc, 0x7c, 0xc9, 0x96, 0xfa, 0x13, 0x7b,
+    0xa6, 0x6f, 0x66, 0x43, 0xc6, 0x83, 0xa7, 0xf2, 0xb3, 0x96,
+};
+
+static uint8_t seg[SEG] __attribute__((aligned(4)));
+
+static void blake2s(uint8_t *out, size_t outlen, const uint8_t *key, size_t keylen, const uint8_t *msg, size_t len) {
+    BLAKE2S_State s;
+
+    blake2s_init_key(&s, outlen, key, keylen);
+    blake2s_update(&s, msg, len);
+    blake2s_final(&s, out);
+}
+
+//the message and key generator of rfc 7693 appendix e
+static void selftest_seq(uint8_t *out, size_t len, uint32_t seed) {
+    uint32_t a = 0xDEAD4BAD * seed, b = 1, t;
+
+    for (size_t i = 0; i < len; i++) {
+        t = a + b;
+        a = b;
+        b = t;
+        out[i] = (t >> 24) & 0xFF;
+    }
+}
+
+static void check_selftest(void) {
+    static const size_t md_len[] = { 16, 20, 28, 32 }, in_len[] = { 0, 3, 64, 65, 255, 1024 };
+    uint8_t in[1024], md[32], key[32], out[32];
+    BLAKE2S_State all;
+
+    blake2s(out, 32, NULL, 0, (const uint8_t *)"abc", 3);
+    CHECK(!memcmp(out, abc_digest, 32), "blake2s-256(\"abc\")");
+
+    blake2s_init_key(&all, 32, NULL, 0);
+    for (size_t i = 0; i < 4; i++) {
+        for (size_t j = 0; j < 6; j++) {
+            selftest_seq(in, in_len[j], in_len[j]);
+            blake2s(md, md_len[i], NULL, 0, in, in_len[j]);
+            blake2s_update(&all, md, md_len[i]);
+            selftest_seq(key, md_len[i], md_len[i]);
+            blake2s(md, md_len[i], key, md_len[i], in, in_len[j]);
+            blake2s_update(&all, md, md_len[i]);
+        }
+    }
+    blake2s_final(&all, out);
+    CHECK(!memcmp(out, selftest_digest, 32), "the rfc 7693 self test");
+}
+
+static void check_keyed(void) {
+    static uint8_t src[256 + 4] __attribute__((aligned(4))), dest[256 + 4] __attribute__((aligned(4)));
+    uint8_t key[32], msg[256], out[32];
+    BLAKE2S_State s;
+
+    for (int i = 0; i < 32; i++)
+        key[i] = i;
+    for (int i = 0; i < 256; i++)
+        msg[i] = i;
+    for (size_t k = 0; k < sizeof(keyed) / sizeof(keyed[0]); k++) {
+        size_t len = keyed[k].len;
+
+        blake2s(out, 32, key, 32, msg, len);
+        CHECK(!memcmp(out, keyed[k].digest, 32), "keyed vector %zu: in one call", len);
+
+        blake2s_init_key(&s, 32, key, 32);
+        for (size_t i = 0; i < len; i++)
+            blake2s_update(&s, msg + i, 1);
+        blake2s_final(&s, out);
+        CHECK(!memcmp(out, keyed[k].digest, 32), "keyed vector %zu: a byte at a time", len);
+
+        for (int off = 0; off < 4; off++) {
+            memcpy(src + off, msg, len);
+            memset(dest, 0, sizeof(dest));
+            blake2s_init_key(&s, 32, key, 32);
+            blake2s_copy_update(&s, dest + (3 - off), src + off, len);
+            blake2s_final(&s, out);
+            CHECK(!memcmp(out, keyed[k].digest, 32) && !memcmp(dest + (3 - off), msg, len),
+                  "keyed vector %zu: blake2s_copy_update from offset %d", len, off);
+        }
+    }
+}
+
+static void check_seg_mac(void) {
+    uint8_t key[HASH_BLKSIZE], out[SEG_MAC_SIZE];
+    SEG_MAC_State s;
+
+    for (int i = 0; i < HASH_BLKSIZE; i++)
+        key[i] = 7 * i + 1;
+    for (int i = 0; i < 1000; i++)
+        seg[i] = i * 13 + 5;
+    CHECK(seg_mac_init(&s, SEG_MAC_BLAKE2S, key), "seg_mac_init does not know blake2s");
+    seg_mac_update(&s, seg, 1000);
+    seg_mac_final(&s, out);
+    CHECK(!memcmp(out, seg_digest, SEG_MAC_SIZE), "the blake2s segment mac");
+}
+
+/*
+cycles to verify the mac of a segment of <n> bytes, as segment_ingest_task does once the segment is local.
+*/
+static uint64_t time_verify(uint8_t alg, size_t n) {
+    uint8_t key[HASH_BLKSIZE], out[SEG_MAC_SIZE];
+    SEG_MAC_State s;
+    uint64_t t;
+
+    test_fill(key, sizeof(key), 1);
+    t = test_cycles();
+    for (int i = 0; i < RUNS; i++) {
+        seg_mac_init(&s, alg, key);
+        seg_mac_update(&s, seg, n - SEG_MAC_SIZE);
+        seg_mac_final(&s, out);
+    }
+    return (test_cycles() - t) / RUNS;
+}
+
+//the best of a number of runs of both macs, taken in turns
+static void bench_verify(size_t n, uint64_t *sha1, uint64_t *b2s) {
+    *sha1 = *b2s = UINT64_MAX;
+    for (int r = 0; r < 10; r++) {
+        uint64_t t = time_verify(SEG_MAC_HMAC_SHA1, n);
+        *sha1 = t < *sha1 ? t : *sha1;
+        t = time_verify(SEG_MAC_BLAKE2S, n);
+        *b2s = t < *b2s ? t : *b2s;
+    }
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 1024 + TRAILER_SZ, 8064 + TRAILER_SZ, 16000 + TRAILER_SZ, SEG };
+
+    check_selftest();
+    check_keyed();
+    check_seg_mac();
+
+    if (test_bench(argc, argv)) {
+        test_fill(seg, sizeof(seg), 2);
+        printf("cycles to verify a segment:\n  %6s %10s %10s %8s\n", "bytes", "hmac-sha1", "blake2s", "saved");
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            uint64_t sha1, b2s;
+
+            bench_verify(sizes[i], &sha1, &b2s);
+            printf("  %6zu %10llu %10llu %7.1f%%\n", sizes[i], (unsigned long long)sha1, (unsigned long long)b2s,
+                   100.0 - 100.0 * b2s / sha1);
+        }
+    }
+    return test_done("blake2s_kat");
+}
@@ -0,0 +1,105 @@
+/*
+checks that decrypting a segment a chunk at a time straight into the dma bram plays exactly the same bytes as
+decrypting all of it in place and copying it over, which is what playback did before.
+
+the bram half and chunk bookkeeping follow dma_refill_task: a chunk of song.chunk_size bytes is staged into the half
+the dma is not reading while the other one plays out in DMA_SLICE_SZ slices. decrypt_data is the AES_SW_ENGINE
+branch of the one in main.c, so the core is the software engine, which decrypts the same as the XDecrypt core.
+segments are random bytes standing in for ciphertext, plus short last segments and a partial final block.
+*/
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "aes.h"
+
+static aes_sw engine;
+static uint8_t segment_buffer[SEGMENT_BUF_SIZE] __attribute__((aligned(4)));
+static uint8_t bram[2 * CHUNK_SZ] __attribute__((aligned(4)));
+static uint8_t whole[8 * SEGMENT_BUF_SIZE], played[8 * SEGMENT_BUF_SIZE];
+
+//as in main.c, built with AES_SW_ENGINE
+static size_t decrypt_data(void *dest, void *src, size_t len) {
+    int count = len / 16;
+    aes_sw_decrypt_blocks(&engine, dest, src, count);
+    if (dest != src && len % 16)
+        memcpy((uint8_t *)dest + count * 16, (uint8_t *)src + count * 16, len % 16);
+    return len;
+}
+
+typedef struct {
+    uint32_t half; //DMA_half
+    size_t cur_off, cur_len, cur_pos, next_off, next_len;
+    size_t out; //bytes played so far
+} dma_model;
+
+/*
+plays the <len> bytes of the verified segment in segment_buffer through the bram, staging a chunk whenever nothing
+is staged and handing the dma one slice per pass.
+*/
+static void play_segment(dma_model *d, size_t len, size_t chunk, int last) {
+    size_t pos = 0, cnt;
+
+    for (;;) {
+        if (!d->next_len && pos < len) {
+            size_t off = (d->half % 2 == 0) ? 0 : CHUNK_SZ, n = min(len - pos, chunk);
+            CHECK(d->cur_pos == d->cur_len || off != d->cur_off, "chunk staged into the half the dma is reading");
+            decrypt_data(bram + off, segment_buffer + pos, n);
+            pos += n;
+            d->next_off = off;
+            d->next_len = n;
+            d->half++;
+        }
+        if (d->cur_pos == d->cur_len) {
+            if (!d->next_len)
+                break;
+            d->cur_off = d->next_off;
+            d->cur_len = d->next_len;
+            d->cur_pos = 0;
+            d->next_len = 0;
+        }
+        cnt = min(d->cur_len - d->cur_pos, DMA_SLICE_SZ);
+        memcpy(played + d->out, bram + d->cur_off + d->cur_pos, cnt);
+        d->out += cnt;
+        d->cur_pos += cnt;
+        //the segment buffer is freed once all of it is in the bram, so the model moves on when only the dma is left
+        if (pos == len && !d->next_len && !last)
+            break;
+    }
+}
+
+static void check_song(size_t segment_size, const size_t *lens, int nr_segments) {
+    size_t chunk = min(segment_size / 2, CHUNK_SZ), total = 0;
+    dma_model d = { 0 };
+
+    CHECK(chunk % 16 == 0, "segment size %zu: chunk %zu is not whole blocks", segment_size, chunk);
+    for (int i = 0; i < nr_segments; i++) {
+        test_fill(segment_buffer, lens[i], segment_size * 31 + i);
+        memcpy(whole + total, segment_buffer, lens[i]);
+        decrypt_data(whole + total, whole + total, lens[i]); //in place, then copied to the bram whole
+        total += lens[i];
+        play_segment(&d, lens[i], chunk, i == nr_segments - 1);
+    }
+    CHECK(d.out == total, "segment size %zu: played %zu of %zu bytes", segment_size, d.out, total);
+    CHECK(!memcmp(whole, played, total), "segment size %zu: played audio differs from whole segment decryption",
+          segment_size);
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 128, 1024, 8064, 16000, 31872, SEGMENT_BUF_SIZE };
+    uint8_t key[AES_KEYSIZE];
+
+    test_fill(key, sizeof(key), 1);
+    for (int variant = AES_SW_TTABLE; variant <= AES_SW_BITSLICED; variant++) {
+        aes_sw_init(&engine, key, variant);
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t z = sizes[s];
+            //full segments, then the shapes a last segment comes in: one aligned unit, odd, and a partial block
+            size_t full[] = { z, z, z }, shortest[] = { z, z, 128 }, odd[] = { z, z, z - 128 + 48 }, tail[] = { z, z, z - 7 };
+            check_song(z, full, 3);
+            check_song(z, shortest, 3);
+            check_song(z, odd, 3);
+            check_song(z, tail, 3);
+        }
+    }
+    return test_done("bram_decrypt");
+}
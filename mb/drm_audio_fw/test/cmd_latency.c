@@ -0,0 +1,268 @@
+/*
+how long a playback command takes to act while a song plays, on the firmware's own scheduler (sched.c).
+
+the playback tasks are a model of command_task, dma_refill_task and segment_ingest_task, run in virtual time: the
+dma plays each slice at the codec's byte rate, and the cpu work between slices (decrypting a chunk into the bram,
+copying and macing a segment INGEST_SLICE_SZ bytes per pass as ingest_poll does) is charged at rough microblaze costs. pause and resume arrive at random times, as the
+gpio interrupt would post them, and the test measures
+- pause: how much audio still plays after the command arrives. the dma cannot be stopped mid transfer, so this is
+  the slice in flight, plus one more if the pass that was running when the command came in starts it.
+- resume: how long until the dma is fed again.
+- gap: how long the dma sat idle mid song before a pass got round to feeding it. the pass that was running when it
+  went idle has to finish first, so this is never more than one pass.
+with --bench it sweeps the segment sizes a v2 header can carry and prints, for each, the latencies, the share of the
+file the trailers take, how busy the model keeps the cpu, and what the real ingest path (copy and mac a segment with
+hmac.c, then decrypt it with aes.c) sustains on the host.
+*/
+#include <stdbool.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "sched.h"
+#include "hmac.h"
+#include "aes.h"
+#include "ingest.h"
+
+#define CPU_HZ 100000000ull //XPAR_CPU_CORE_CLOCK_FREQ_HZ
+#define AUDIO_BYTES_PER_SEC (AUDIO_SAMPLING_RATE * 4ull)
+//rough cycles per byte of the work done between dma slices
+#define DECRYPT_CYCLES 40 //a chunk into the bram
+#define VERIFY_CYCLES 30 //a segment's mac
+#define SEGMENT_CYCLES (4 * 64 * VERIFY_CYCLES) //per segment: the hmac's key pads and its two final blocks
+#define TRAILER_SZ sizeof(struct segment_trailer_v2)
+#define PASS_CYCLES 300 //a scheduler pass that finds nothing to do
+#define SONG_SECONDS 600
+#define NS_PER_SEC 1000000000ull
+
+#define cycles_ns(c) ((uint64_t)(c) * NS_PER_SEC / CPU_HZ)
+#define audio_ns(bytes) ((uint64_t)(bytes) * NS_PER_SEC / AUDIO_BYTES_PER_SEC)
+
+static uint64_t now, dma_idle_at; //virtual ns
+static size_t segment_size, chunk_size;
+
+static struct {
+    bool paused, seg_ready, loading;
+    size_t ingest_left; //bytes of the segment being loaded that ingest_poll has still to copy in
+    size_t seg_pos, cur_len, cur_pos, next_len;
+    uint64_t played; //bytes handed to the dma
+    uint64_t busy, gap_max; //virtual ns the cpu spent working, and the longest the dma went unfed mid song
+} play;
+
+static struct {
+    uint64_t at; //when the next command arrives
+    int op; //MIPOD_PAUSE or MIPOD_RESUME
+    bool posted;
+    uint64_t resumed_at; //when the last resume arrived, 0 once the dma has been fed since
+    uint64_t pause_max, pause_sum, resume_max, resume_sum, nr_pause, nr_resume, slices_while_paused;
+} cmd;
+
+//charges the cpu with <cycles> of work
+static void work(uint64_t cycles) {
+    now += cycles_ns(cycles);
+    play.busy += cycles_ns(cycles);
+}
+
+static uint32_t seed = 1;
+static uint32_t rnd(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void schedule_command(void) {
+    cmd.at = now + (rnd() % 300 + 1) * 1000000ull; //every 1 to 300 ms
+    cmd.op = cmd.op == MIPOD_PAUSE ? MIPOD_RESUME : MIPOD_PAUSE;
+    cmd.posted = false;
+}
+
+static void command_task(void) {
+    uint64_t lat;
+
+    work(PASS_CYCLES);
+    if (cmd.op == MIPOD_PAUSE) {
+        play.paused = true;
+        //no more slices are started, so the audio stops once the one in flight is done
+        lat = (dma_idle_at > cmd.at ? dma_idle_at : now) - cmd.at;
+        cmd.pause_max = lat > cmd.pause_max ? lat : cmd.pause_max;
+        cmd.pause_sum += lat;
+        cmd.nr_pause++;
+    } else {
+        play.paused = false;
+        cmd.resumed_at = cmd.at;
+        sched_post(EV_DMA);
+    }
+    schedule_command();
+}
+
+static void dma_refill_task(void) {
+    size_t cnt;
+
+    if (play.paused)
+        return;
+    if (!play.next_len && play.seg_ready) { //decrypt the next chunk into the free bram half
+        play.next_len = min(segment_size - play.seg_pos, chunk_size);
+        work(play.next_len * DECRYPT_CYCLES);
+        play.seg_pos += play.next_len;
+        if (play.seg_pos == segment_size) {
+            play.seg_ready = false;
+            sched_post(EV_INGEST);
+        }
+    }
+    if (play.cur_pos == play.cur_len && !play.next_len)
+        return;
+    if (now < dma_idle_at)
+        return; //the poll hook posts us again once it is idle
+    if (play.cur_pos == play.cur_len) {
+        play.cur_len = play.next_len;
+        play.cur_pos = 0;
+        play.next_len = 0;
+        sched_post(EV_DMA);
+    }
+    if (play.played && !cmd.resumed_at && now - dma_idle_at > play.gap_max)
+        play.gap_max = now - dma_idle_at;
+    cnt = min(play.cur_len - play.cur_pos, DMA_SLICE_SZ);
+    dma_idle_at = now + audio_ns(cnt);
+    play.cur_pos += cnt;
+    play.played += cnt;
+    if (cmd.resumed_at) {
+        uint64_t lat = now - cmd.resumed_at;
+        cmd.resume_max = lat > cmd.resume_max ? lat : cmd.resume_max;
+        cmd.resume_sum += lat;
+        cmd.nr_resume++;
+        cmd.resumed_at = 0;
+    }
+}
+
+static void segment_ingest_task(void) {
+    if (play.seg_ready || play.ingest_left)
+        return;
+    if (!play.loading) {
+        play.loading = true;
+        play.ingest_left = segment_size + TRAILER_SZ;
+        return;
+    }
+    //the copy is in, check the mac
+    work(SEGMENT_CYCLES);
+    play.loading = false;
+    play.seg_ready = true;
+    play.seg_pos = 0;
+    sched_post(EV_DMA);
+}
+
+//the gpio interrupt and the dma idle poll, see poll_hw
+static void poll_hw(void) {
+    if (!cmd.posted && now >= cmd.at) {
+        cmd.posted = true;
+        sched_post(EV_COMMAND);
+    }
+    if (play.ingest_left) { //poll_ingest
+        size_t n = min(play.ingest_left, INGEST_SLICE_SZ);
+        work(n * VERIFY_CYCLES);
+        play.ingest_left -= n;
+        if (!play.ingest_left)
+            sched_post(EV_INGEST);
+    }
+    if (!play.paused && now >= dma_idle_at && (play.cur_pos < play.cur_len || play.next_len))
+        sched_post(EV_DMA);
+}
+
+//nothing to do until the dma goes idle or the client says something
+static void idle_task(void) {
+    uint64_t next = cmd.at;
+    if (play.ingest_left)
+        return; //poll_hw moves it along every pass
+    if (!play.paused && dma_idle_at > now && dma_idle_at < next)
+        next = dma_idle_at;
+    now = next > now ? next : now + cycles_ns(PASS_CYCLES);
+}
+
+/*
+MB/s of the real per segment work on the host: copy and mac each segment as ingest does, check the trailer fields
+in, decrypt it. the per segment part (hmac setup and finalisation) is what makes small segments cost more.
+*/
+static double host_mbps(size_t seg_size) {
+    static uint8_t src[1 << 22], local[SEGMENT_BUF_SIZE + TRAILER_SZ] __attribute__((aligned(4)));
+    static const uint8_t aes_key[AES_KEYSIZE] = { 1, 2, 3, 4 };
+    uint8_t key[HASH_BLKSIZE] = { 5, 6, 7 }, mac[SEG_MAC_SIZE];
+    SEG_MAC_State state;
+    aes_sw engine;
+    size_t nr = sizeof(src) / seg_size;
+    uint64_t t, best = UINT64_MAX;
+
+    test_fill(src, sizeof(src), 27);
+    aes_sw_init(&engine, aes_key, AES_SW_TTABLE);
+    for (int run = 0; run < 3; run++) {
+        t = test_ns();
+        for (size_t i = 0; i < nr; i++) {
+            seg_mac_init(&state, SEG_MAC_HMAC_SHA1, key);
+            seg_mac_copy_update(&state, local, src + i * seg_size, seg_size);
+            seg_mac_update(&state, src, 8 + SONGID_LEN); //idx, next_segment_size and the song id
+            seg_mac_final(&state, mac);
+            aes_sw_decrypt_blocks(&engine, local, local, seg_size / AES_BLOCKSIZE);
+        }
+        t = test_ns() - t;
+        best = t < best ? t : best;
+    }
+    return (double)nr * seg_size * 1e3 / best;
+}
+
+static void run(size_t seg_size, int verbose) {
+    //the longest a pass can take: a command, a chunk, an ingest slice and a segment check, each once
+    uint64_t worst_pass = cycles_ns(3 * PASS_CYCLES + CHUNK_SZ * DECRYPT_CYCLES + INGEST_SLICE_SZ * VERIFY_CYCLES
+                                    + SEGMENT_CYCLES);
+    uint64_t slice = audio_ns(DMA_SLICE_SZ);
+
+    segment_size = seg_size;
+    chunk_size = min(seg_size / 2, CHUNK_SZ);
+    now = dma_idle_at = 0;
+    memset(&play, 0, sizeof(play));
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op = MIPOD_RESUME;
+    schedule_command();
+
+    sched_init(poll_hw);
+    sched_add(command_task, EV_COMMAND);
+    sched_add(dma_refill_task, EV_DMA);
+    sched_add(segment_ingest_task, EV_INGEST);
+    sched_add_idle(idle_task);
+    sched_post(EV_INGEST);
+    while (now < SONG_SECONDS * NS_PER_SEC) {
+        bool was_paused = play.paused;
+        uint64_t played = play.played;
+        sched_run_once();
+        if (was_paused && play.paused && play.played != played)
+            cmd.slices_while_paused++;
+    }
+
+    CHECK(cmd.nr_pause > 100 && cmd.nr_resume > 100, "segment %zu: only %llu pauses and %llu resumes", seg_size,
+          (unsigned long long)cmd.nr_pause, (unsigned long long)cmd.nr_resume);
+    CHECK(!cmd.slices_while_paused, "segment %zu: %llu slices started while paused", seg_size,
+          (unsigned long long)cmd.slices_while_paused);
+    CHECK(cmd.pause_max <= slice + worst_pass, "segment %zu: audio went on %.2f ms after a pause, bound %.2f ms",
+          seg_size, cmd.pause_max / 1e6, (slice + worst_pass) / 1e6);
+    //the pass the resume arrived in, then the one that decrypts a chunk and starts the dma
+    CHECK(cmd.resume_max <= 2 * worst_pass, "segment %zu: resume took %.2f ms, bound %.2f ms", seg_size,
+          cmd.resume_max / 1e6, 2 * worst_pass / 1e6);
+    CHECK(play.gap_max <= worst_pass, "segment %zu: the dma went unfed for %.2f ms, bound %.2f ms", seg_size,
+          play.gap_max / 1e6, worst_pass / 1e6);
+    if (verbose)
+        printf("  %5zu %7.2f%% %6.1f%% %7.2f %7.2f %7.2f %7.2f %8.2f %8.1f\n", seg_size,
+               100.0 * TRAILER_SZ / (seg_size + TRAILER_SZ), 100.0 * play.busy / now,
+               cmd.pause_sum / 1e6 / cmd.nr_pause, cmd.pause_max / 1e6, cmd.resume_sum / 1e6 / cmd.nr_resume,
+               cmd.resume_max / 1e6, play.gap_max / 1e6, host_mbps(seg_size));
+}
+
+int main(int argc, char **argv) {
+    //every segment size from one SEGMENT_ALIGN unit up, the ones genSongs makes by default among them
+    static const size_t sizes[] = { 128, 256, 512, 1024, 2048, 4096, 8064, 16000, SEGMENT_BUF_SIZE };
+    int verbose = test_bench(argc, argv);
+
+    if (verbose)
+        printf("segment size sweep (one %d byte slice is %.2f ms, latencies in ms, host ingest in MB/s):\n"
+               "  %5s %8s %7s %7s %7s %7s %7s %8s %8s\n", DMA_SLICE_SZ, audio_ns(DMA_SLICE_SZ) / 1e6,
+               "seg", "trailer", "cpu", "pause", "max", "resume", "max", "gap max", "host");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        run(sizes[s], verbose);
+    return test_done("cmd_latency");
+}
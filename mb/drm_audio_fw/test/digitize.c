@@ -0,0 +1,98 @@
+/*
+the write back of digital_out, before and after digitize_segment.
+a song of about DIGITIZE_BYTES of encrypted pcm sits in the shared memory in full segments. every segment, once it
+is local and verified, is written back out to the shared memory as plaintext either
+- before: decrypted in place in segment_buffer, then copied out with copyfromlocal, or
+- after: decrypted straight into the shared memory, then flushed (digitize_segment).
+the test checks that both write the same plaintext, flush every byte of it for the arm, and invalidate nothing.
+with --bench it prints the wall time of the write back of the whole song both ways. the copy in and the mac are
+the same either way and are left out.
+there is no second bus master to overlap the write back with (no cdma; the axi dma only reads, for the audio
+out), so the cpu does all of it; the saving is the copy.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "memops.h"
+#include "aes.h"
+
+#define DIGITIZE_BYTES (32u << 20) //about the largest song the shared buffer holds
+#define SEG SEGMENT_BUF_SIZE
+#define NR_SEGMENTS (DIGITIZE_BYTES / SEG)
+#define SONG_BYTES ((size_t)NR_SEGMENTS * SEG)
+
+static uint8_t segment_buffer[SEG] __attribute__((aligned(4)));
+static uint8_t *cipher, *plain, *out; //the song in the shared memory, its plaintext, and the song written back
+static aes_sw engine;
+
+static void write_back_before(volatile uint8_t *arm_dest, size_t len) {
+    aes_sw_decrypt_blocks(&engine, segment_buffer, segment_buffer, len / AES_BLOCKSIZE);
+    copyfromlocal(arm_dest, segment_buffer, len);
+}
+
+static void write_back_after(volatile uint8_t *arm_dest, size_t len) {
+    aes_sw_decrypt_blocks(&engine, (void *)arm_dest, segment_buffer, len / AES_BLOCKSIZE);
+    shm_flush(arm_dest, len);
+}
+
+/*
+writes the whole song back out to <out> one way or the other. returns the wall time in ns.
+*/
+static uint64_t digitize(void (*write_back)(volatile uint8_t *, size_t)) {
+    uint64_t t = 0, t0;
+
+    memset(&test_shm, 0, sizeof(test_shm));
+    for (uint32_t i = 0; i < NR_SEGMENTS; i++) {
+        memcpy(segment_buffer, cipher + (size_t)i * SEG, SEG); //ingest, not timed
+        t0 = test_ns();
+        write_back(out + (size_t)i * SEG, SEG);
+        t += test_ns() - t0;
+    }
+    return t;
+}
+
+static void check(const char *how, void (*write_back)(volatile uint8_t *, size_t)) {
+    memset(out, 0, SONG_BYTES);
+    digitize(write_back);
+    CHECK(!memcmp(out, plain, SONG_BYTES), "%s: the plaintext differs", how);
+    CHECK(test_shm.flushed == SONG_BYTES && !test_shm.invalidated, "%s: flushed %zu and invalidated %zu bytes",
+          how, test_shm.flushed, test_shm.invalidated);
+}
+
+int main(int argc, char **argv) {
+    uint8_t key[AES_KEYSIZE];
+
+    cipher = malloc(SONG_BYTES);
+    plain = malloc(SONG_BYTES);
+    out = malloc(SONG_BYTES);
+    if (!cipher || !plain || !out) {
+        CHECK(0, "cannot allocate %zu bytes", SONG_BYTES);
+        return test_done("digitize");
+    }
+    test_fill(key, sizeof(key), 1);
+    test_fill(cipher, SONG_BYTES, 2);
+    aes_sw_init(&engine, key, AES_SW_TTABLE);
+    aes_sw_decrypt_blocks(&engine, plain, cipher, SONG_BYTES / AES_BLOCKSIZE);
+
+    check("before", write_back_before);
+    check("after", write_back_after);
+
+    if (test_bench(argc, argv)) {
+        uint64_t before = UINT64_MAX, after = UINT64_MAX, t;
+
+        for (int r = 0; r < 5; r++) {
+            t = digitize(write_back_before);
+            before = t < before ? t : before;
+            t = digitize(write_back_after);
+            after = t < after ? t : after;
+        }
+        printf("write back of a %zu byte song in %u byte segments, ms:\n  %10s %10s %8s\n", SONG_BYTES, SEG,
+               "before", "after", "saved");
+        printf("  %10.2f %10.2f %7.1f%%\n", before / 1e6, after / 1e6, 100.0 - 100.0 * after / before);
+    }
+    free(cipher);
+    free(plain);
+    free(out);
+    return test_done("digitize");
+}
@@ -0,0 +1,222 @@
+/*
+the silence between two songs of a playlist, on the firmware's own scheduler (sched.c).
+
+the playback tasks are a model of dma_refill_task, segment_ingest_task and prefetch_task, run in virtual time and
+charged at the same rough microblaze costs as cmd_latency. two songs are played back to back, either
+- gapless: the client stages the second song while the first plays, prefetch_task checks its header in idle passes,
+  and segment_ingest_task switches to it as soon as the first song's last segment is in the bram, or
+- stop/play: the first song ends, the client loads the second one into the same buffer and rings the doorbell,
+  and play_song sets the dma up and checks the header before the first segment can load.
+the silence is the time from the end of the last slice of the first song to the start of the first slice of the
+second. the client's side of stop/play depends on the board (sd card, process spawns), so it is printed separately
+with the assumed costs below, on top of the firmware's part.
+the test checks that a gapless switch leaves the dma no longer unfed than any segment change in the middle of a song.
+*/
+#include <stdbool.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "sched.h"
+#include "ingest.h"
+
+#define CPU_HZ 100000000ull //XPAR_CPU_CORE_CLOCK_FREQ_HZ
+#define AUDIO_BYTES_PER_SEC (AUDIO_SAMPLING_RATE * 4ull)
+//rough cycles of the firmware's work, as in cmd_latency
+#define DECRYPT_CYCLES 40 //per byte of a chunk decrypted into the bram
+#define VERIFY_CYCLES 30 //per byte of a segment copied in and maced
+#define SEGMENT_CYCLES (4 * 64 * VERIFY_CYCLES) //per segment: the hmac's key pads and its two final blocks
+#define PASS_CYCLES 300 //a scheduler pass that finds nothing to do
+#define HEADER_CYCLES (6 * 20000) //the two sha512 hmacs of a header, six blocks of 64 bit arithmetic on a 32 bit cpu
+#define DMA_SETUP_CYCLES 5000 //fnConfigDma
+//the client's part of stop/play, assumed: reading the next song off the sd card, and two devmem processes
+#define CLIENT_LOAD_MBPS 20
+#define CLIENT_DOORBELL_MS 5
+#define SONG_SECONDS 10
+#define TRAILER_SZ sizeof(struct segment_trailer_v2)
+#define NS_PER_SEC 1000000000ull
+
+#define cycles_ns(c) ((uint64_t)(c) * NS_PER_SEC / CPU_HZ)
+#define audio_ns(bytes) ((uint64_t)(bytes) * NS_PER_SEC / AUDIO_BYTES_PER_SEC)
+
+static uint64_t now, dma_idle_at; //virtual ns
+static size_t segment_size, chunk_size;
+static uint32_t nr_segments;
+
+static struct {
+    bool next_staged, next_ready, eos;
+    int song; //the song segments are being loaded from, 0 or 1
+    uint32_t idx; //the next segment to load
+    bool loading, seg_ready;
+    size_t ingest_left, seg_pos, cur_len, cur_pos, next_len;
+    int cur_song, next_song; //the song of the chunk the dma is playing, and of the staged one
+    uint64_t played, first_end, second_start, gap_max;
+} play;
+
+static void work(uint64_t cycles) {
+    now += cycles_ns(cycles);
+}
+
+static void dma_refill_task(void) {
+    size_t cnt;
+
+    if (!play.next_len && play.seg_ready) {
+        play.next_len = min(segment_size - play.seg_pos, chunk_size);
+        play.next_song = play.song;
+        work(play.next_len * DECRYPT_CYCLES);
+        play.seg_pos += play.next_len;
+        if (play.seg_pos == segment_size) {
+            play.seg_ready = false;
+            sched_post(EV_INGEST);
+        }
+    }
+    if (play.cur_pos == play.cur_len && !play.next_len)
+        return;
+    if (now < dma_idle_at)
+        return;
+    if (play.cur_pos == play.cur_len) {
+        play.cur_len = play.next_len;
+        play.cur_song = play.next_song;
+        play.cur_pos = 0;
+        play.next_len = 0;
+        sched_post(EV_DMA);
+    }
+    cnt = min(play.cur_len - play.cur_pos, DMA_SLICE_SZ);
+    if (play.cur_song == 1 && !play.second_start) {
+        play.second_start = now;
+    } else if (play.played && now - dma_idle_at > play.gap_max) {
+        play.gap_max = now - dma_idle_at;
+    }
+    dma_idle_at = now + audio_ns(cnt);
+    if (play.cur_song == 0)
+        play.first_end = dma_idle_at;
+    play.cur_pos += cnt;
+    play.played += cnt;
+}
+
+static void segment_ingest_task(void) {
+    if (play.seg_ready || play.ingest_left || play.eos)
+        return;
+    if (play.loading) {
+        work(SEGMENT_CYCLES);
+        play.loading = false;
+        play.seg_ready = true;
+        play.seg_pos = 0;
+        play.idx++;
+        sched_post(EV_DMA);
+        return;
+    }
+    if (play.idx == nr_segments) {
+        //switch_to_next_song: the staged header was checked already, so this is a few copies
+        if (play.song == 0 && play.next_ready) {
+            work(PASS_CYCLES);
+            play.song = 1;
+            play.idx = 0;
+        } else {
+            play.eos = true;
+            return;
+        }
+    }
+    play.loading = true;
+    play.ingest_left = segment_size + TRAILER_SZ;
+}
+
+static void poll_hw(void) {
+    if (play.ingest_left) { //poll_ingest
+        size_t n = min(play.ingest_left, INGEST_SLICE_SZ);
+        work(n * VERIFY_CYCLES);
+        play.ingest_left -= n;
+        if (!play.ingest_left)
+            sched_post(EV_INGEST);
+    }
+    if (now >= dma_idle_at && (play.cur_pos < play.cur_len || play.next_len))
+        sched_post(EV_DMA);
+}
+
+static void prefetch_task(void) {
+    if (play.next_staged && !play.next_ready) {
+        work(HEADER_CYCLES);
+        play.next_ready = true;
+    }
+}
+
+//nothing to do until the dma goes idle
+static void idle_task(void) {
+    if (play.ingest_left)
+        return;
+    now = dma_idle_at > now ? dma_idle_at : now + cycles_ns(PASS_CYCLES);
+}
+
+static bool drained(void) {
+    return play.eos && !play.seg_ready && !play.next_len && play.cur_pos == play.cur_len && now >= dma_idle_at;
+}
+
+/*
+plays song <song> from its first segment, as play_song does, until the playback has ended or the second song
+has started.
+*/
+static void start(int song) {
+    work(DMA_SETUP_CYCLES + HEADER_CYCLES);
+    play.song = song;
+    play.idx = 0;
+    play.eos = false;
+    sched_init(poll_hw);
+    sched_add(dma_refill_task, EV_DMA);
+    sched_add(segment_ingest_task, EV_INGEST);
+    sched_add_idle(prefetch_task);
+    sched_add_idle(idle_task);
+    sched_post(EV_INGEST);
+    while (!drained() && !(song == 0 && play.second_start))
+        sched_run_once();
+}
+
+/*
+returns the silence between the two songs with the gapless switch, or with stop/play (<client_ns> being the part
+of that the client spends loading the second song).
+*/
+static uint64_t run(size_t seg_size, bool gapless, uint64_t *client_ns) {
+    size_t song_bytes = SONG_SECONDS * AUDIO_BYTES_PER_SEC;
+
+    segment_size = seg_size;
+    chunk_size = min(seg_size / 2, CHUNK_SZ);
+    nr_segments = (song_bytes + seg_size - 1) / seg_size;
+    now = dma_idle_at = 0;
+    memset(&play, 0, sizeof(play));
+    play.next_staged = gapless;
+    start(0);
+    if (!gapless) {
+        //the firmware stops once the last slice is done, then the client loads the next song and rings
+        now = play.first_end;
+        *client_ns = (uint64_t)(sizeof(drm_header_v2) + nr_segments * (seg_size + TRAILER_SZ)) * NS_PER_SEC
+                     / (CLIENT_LOAD_MBPS * 1000000ull) + CLIENT_DOORBELL_MS * 1000000ull;
+        memset(&play, 0, sizeof(play));
+        play.first_end = now;
+        start(1);
+    }
+    CHECK(play.second_start, "segment %zu: the second song never started", seg_size);
+    return play.second_start > play.first_end ? play.second_start - play.first_end : 0;
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 1024, 8064, 16000, SEGMENT_BUF_SIZE };
+    int verbose = test_bench(argc, argv);
+
+    if (verbose)
+        printf("silence between two %d s songs, ms (client part of stop/play assumed: %d MB/s load, %d ms doorbell):\n"
+               "  %5s %8s %10s %10s %10s\n", SONG_SECONDS, CLIENT_LOAD_MBPS, CLIENT_DOORBELL_MS,
+               "seg", "gapless", "mid song", "stop/play", "+client");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint64_t client = 0, gap, mid, stop;
+
+        gap = run(sizes[s], true, &client);
+        mid = play.gap_max;
+        stop = run(sizes[s], false, &client);
+        //the switch happens in between dma slices, like any other segment change
+        CHECK(gap <= mid + cycles_ns(PASS_CYCLES), "segment %zu: %.3f ms of silence at the switch, %.3f ms mid song",
+              sizes[s], gap / 1e6, mid / 1e6);
+        CHECK(gap < stop, "segment %zu: the gapless switch is no quieter than stop/play", sizes[s]);
+        if (verbose)
+            printf("  %5zu %8.3f %10.3f %10.3f %10.3f\n", sizes[s], gap / 1e6, mid / 1e6, stop / 1e6,
+                   (stop + client) / 1e6);
+    }
+    return test_done("gapless");
+}
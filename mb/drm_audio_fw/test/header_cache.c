@@ -0,0 +1,195 @@
+/*
+the cache of verified song headers (header.c), on the v2 songs of the songs rule in the Makefile.
+verify() below is the header check of verify_song_header, with the cache in front of the two hmacs. the test checks
+- that a song misses the first time it is played and hits after, without redoing either hmac
+- that a header with a changed acl but the old signature misses, and fails its signature
+- that logging out (header_cache_clear) forgets every song
+then it replays a listening session: the songs are picked with zipf weights (the first song twice as often as the
+second, three times as often as the third, ...), one play in four restarts the current song, and the user logs out
+every SESSION_PLAYS plays on average.
+with --bench it prints the hit rate of that session and the cpu time of a header check on a hit and on a miss.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "header.h"
+
+#define DIR "songs/v2"
+#define OWNER "user1" //genSongs' default --owner
+#define NR_SONGS 8
+#define PLAYS 20000
+#define SESSION_PLAYS 24
+#define RUNS 2000
+
+static const char *songs[NR_SONGS] = {
+    "10s_8000hz_1ch_8b_natural",
+    "10s_8000hz_2ch_16b_natural",
+    "10s_48000hz_1ch_8b_natural",
+    "10s_48000hz_2ch_16b_natural",
+    "10s_8000hz_1ch_16b_natural",
+    "10s_8000hz_2ch_8b_natural",
+    "10s_48000hz_1ch_16b_natural",
+    "10s_48000hz_2ch_8b_natural",
+};
+
+static uint8_t mipod_key[HASH_OUTSIZE], owner_key[HASH_OUTSIZE];
+static drm_file_header headers[NR_SONGS];
+static uint32_t hmacs; //signatures checked, the work the cache saves
+
+static int sig_ok(uint8_t *key, drm_file_header *hdr, size_t sig_offset) {
+    uint8_t sig[HASH_OUTSIZE];
+
+    hmacs++;
+    hmac(key, (uint8_t *)hdr, sig_offset, sig);
+    return !memcmp(sig, (uint8_t *)hdr + sig_offset, HASH_OUTSIZE);
+}
+
+/*
+checks the header <file> as verify_song_header does for its owner. returns false if a signature is bad.
+*/
+static bool verify(const drm_file_header *file) {
+    drm_file_header hdr;
+    song_info song;
+    int cached = 0;
+
+    memcpy(&hdr, file, sizeof(hdr));
+    if (!parse_song_header(&hdr, &song)
+        || ((cached = header_cache_find(&hdr, &song)) < 0 && !sig_ok(mipod_key, &hdr, mp_sig_offset(&song))))
+        return false;
+    if (cached < 0)
+        cached = header_cache_add(&hdr, &song, false);
+    if (!header_cache_user_ok(cached)) {
+        if (!sig_ok(owner_key, &hdr, owner_sig_offset(&song)))
+            return false;
+        header_cache_set_user_ok(cached);
+    }
+    return true;
+}
+
+static bool load_songs(void) {
+    for (int i = 0; i < NR_SONGS; i++) {
+        char path[256];
+        size_t size;
+        uint8_t *file;
+
+        snprintf(path, sizeof(path), "%s/%s.drm", DIR, songs[i]);
+        if (!(file = test_load(path, &size)) || size < sizeof(drm_file_header)) {
+            free(file);
+            return false;
+        }
+        memcpy(&headers[i], file, sizeof(drm_file_header));
+        free(file);
+    }
+    return true;
+}
+
+static void check_cache(void) {
+    drm_file_header bad;
+    uint32_t before;
+
+    header_cache_clear();
+    hmacs = 0;
+    CHECK(verify(&headers[0]) && hmacs == 2, "the first play of a song checked %u signatures", hmacs);
+    CHECK(verify(&headers[0]) && hmacs == 2, "a replay of a song checked its signatures again");
+
+    memcpy(&bad, &headers[0], sizeof(bad));
+    bad.v2.regions ^= 2;
+    before = hmacs;
+    CHECK(!verify(&bad) && hmacs == before + 1, "a changed acl under the old signature was taken from the cache");
+
+    header_cache_clear();
+    hmacs = 0;
+    CHECK(verify(&headers[0]) && hmacs == 2, "a song was still cached after a logout");
+
+    //the cache holds the last HEADER_CACHE_ENTRIES songs played
+    for (int i = 0; i < HEADER_CACHE_ENTRIES; i++)
+        verify(&headers[i]);
+    before = hmacs;
+    for (int i = 0; i < HEADER_CACHE_ENTRIES; i++)
+        verify(&headers[i]);
+    CHECK(hmacs == before, "%d songs did not all stay cached", HEADER_CACHE_ENTRIES);
+}
+
+/*
+picks a song with zipf weights 1/1, 1/2, ... 1/NR_SONGS.
+*/
+static int zipf_song(void) {
+    static double cdf[NR_SONGS];
+    double r;
+
+    if (!cdf[NR_SONGS - 1]) {
+        double sum = 0;
+        for (int i = 0; i < NR_SONGS; i++)
+            cdf[i] = sum += 1.0 / (i + 1);
+        for (int i = 0; i < NR_SONGS; i++)
+            cdf[i] /= sum;
+    }
+    r = (double)test_rand() / UINT32_MAX;
+    for (int i = 0; i < NR_SONGS - 1; i++)
+        if (r < cdf[i])
+            return i;
+    return NR_SONGS - 1;
+}
+
+/*
+replays the listening session. returns the hit rate of header_cache_find.
+*/
+static double session(void) {
+    uint32_t hits0, misses0, hits, misses;
+    int cur = 0;
+
+    header_cache_clear();
+    header_cache_stats(&hits0, &misses0);
+    for (int i = 0; i < PLAYS; i++) {
+        if (test_rand() % SESSION_PLAYS == 0)
+            header_cache_clear(); //logout_user
+        if (test_rand() % 4)
+            cur = zipf_song();
+        CHECK(verify(&headers[cur]), "play %d of %s failed its header check", i, songs[cur]);
+    }
+    header_cache_stats(&hits, &misses);
+    CHECK(hits + misses - hits0 - misses0 == PLAYS, "the cache counted %u lookups for %d plays",
+          hits + misses - hits0 - misses0, PLAYS);
+    return (double)(hits - hits0) / PLAYS;
+}
+
+static uint64_t bench_verify(bool hit) {
+    uint64_t t, best = UINT64_MAX;
+
+    for (int r = 0; r < 5; r++) {
+        header_cache_clear();
+        verify(&headers[0]);
+        t = test_cycles();
+        for (int i = 0; i < RUNS; i++) {
+            if (!hit)
+                header_cache_clear();
+            verify(&headers[0]);
+        }
+        t = test_cycles() - t;
+        best = t < best ? t : best;
+    }
+    return best / RUNS;
+}
+
+int main(int argc, char **argv) {
+    double rate;
+
+    if (test_region_key(DIR, "mipod_key", mipod_key, sizeof(mipod_key)) != sizeof(mipod_key)
+        || !test_user_key(DIR, OWNER, owner_key) || !load_songs()) {
+        CHECK(0, "no test songs in %s, run make songs", DIR);
+        return test_done("header_cache");
+    }
+
+    check_cache();
+    rate = session();
+    if (test_bench(argc, argv)) {
+        uint64_t hit = bench_verify(true), miss = bench_verify(false);
+
+        printf("%d plays of %d songs, logout every %d plays, %d entries: %.1f%% hits\n", PLAYS, NR_SONGS,
+               SESSION_PLAYS, HEADER_CACHE_ENTRIES, 100.0 * rate);
+        printf("cycles per header check: %llu on a hit, %llu on a miss, %llu on average\n", (unsigned long long)hit,
+               (unsigned long long)miss, (unsigned long long)(rate * hit + (1 - rate) * miss));
+    }
+    return test_done("header_cache");
+}
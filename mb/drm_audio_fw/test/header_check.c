@@ -0,0 +1,161 @@
+/*
+the v2 drm file format against v1, on the same songs protected both ways by tools/genSongs (see the songs rule in
+the Makefile). every file is parsed with the firmware's parse_song_header, and the test checks
+- both header signatures, with the firmware's hmac and the genSongs test keys
+- that the segment chain the header and the trailers describe covers the file exactly
+- that changing an acl byte breaks the mipod signature
+with --bench it prints the size of each file and how much of it is format overhead, and the cpu time of the header
+check a play command does (copy, parse, region and user checks, both hmacs).
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "header.h"
+
+#define OWNER "user1" //genSongs' default --owner
+#define OWNER_UID 0
+#define REGION_MASK 1u //genSongs' default --region-list, rid 0
+#define RUNS 2000
+
+static const char *songs[] = {
+    "10s_8000hz_1ch_8b_natural",
+    "10s_8000hz_2ch_16b_natural",
+    "10s_48000hz_1ch_8b_natural",
+    "10s_48000hz_2ch_16b_natural",
+};
+
+static uint8_t mipod_key[HASH_OUTSIZE], owner_key[HASH_OUTSIZE];
+
+static int sig_ok(uint8_t *key, drm_file_header *hdr, size_t sig_offset) {
+    uint8_t sig[HASH_OUTSIZE];
+
+    hmac(key, (uint8_t *)hdr, sig_offset, sig);
+    return !memcmp(sig, (uint8_t *)hdr + sig_offset, HASH_OUTSIZE);
+}
+
+/*
+what verify_song_header does for a song the owner plays: returns SONG_xyz.
+*/
+static int32_t header_check(const uint8_t *file, drm_file_header *hdr, song_info *song) {
+    memcpy(hdr, file, sizeof(drm_file_header));
+    if (!parse_song_header(hdr, song) || !sig_ok(mipod_key, hdr, mp_sig_offset(song)))
+        return SONG_BADSIG;
+    if (!(song->regions & REGION_MASK))
+        return SONG_BADREGION;
+    if (!sig_ok(owner_key, hdr, owner_sig_offset(song)))
+        return SONG_BADSIG;
+    if (song->ownerID == OWNER_UID)
+        return SONG_OWNER;
+    return bitmap_test(song->shared_users, OWNER_UID) ? SONG_SHARED : SONG_BADUSER;
+}
+
+/*
+follows the segment chain from the header through the trailers. returns the offset it ends at.
+*/
+static size_t walk_segments(const char *name, const uint8_t *file, size_t size, song_info *song) {
+    size_t off = song->header_size, seg = song->first_segment_size;
+
+    for (uint32_t i = 0; i < song->nr_segments; i++) {
+        uint32_t idx, next;
+
+        if (seg < song->trailer_size || seg > song->segment_size + song->trailer_size || off + seg > size) {
+            CHECK(0, "%s: segment %u of %zu bytes at %zu does not fit", name, i, seg, off);
+            return off;
+        }
+        //idx and next_segment_size sit at the same place in both trailers, after the v1 song id
+        const uint8_t *trailer = file + off + seg - song->trailer_size;
+        if (song->version == DRM_VERSION_1)
+            trailer += SONGID_LEN;
+        memcpy(&idx, trailer, 4);
+        memcpy(&next, trailer + 4, 4);
+        CHECK(idx == i, "%s: segment %u has index %u", name, i, idx);
+        off += seg;
+        seg = next;
+    }
+    CHECK(seg == 0, "%s: the last segment points at another one of %zu bytes", name, seg);
+    return off;
+}
+
+static void check_song(const char *name, const char *dir, int version, size_t *file_size, size_t *overhead) {
+    char path[256];
+    drm_file_header hdr;
+    song_info song;
+    size_t size;
+    uint8_t *file;
+
+    snprintf(path, sizeof(path), "%s/%s.drm", dir, name);
+    if (!(file = test_load(path, &size)) || size < sizeof(drm_file_header)) {
+        CHECK(0, "cannot read %s, run make songs", path);
+        free(file);
+        return;
+    }
+    CHECK(header_check(file, &hdr, &song) == SONG_OWNER, "%s: the header does not check out", path);
+    CHECK(song.version == version, "%s: parsed as v%d", path, song.version);
+    CHECK(walk_segments(path, file, size, &song) == size, "%s: the segments do not cover the file", path);
+
+    //another region in the acl, as a v1 byte or a v2 bit
+    memcpy(&hdr, file, sizeof(hdr));
+    if (version == DRM_VERSION_1)
+        hdr.v1.regions[0] = MAX_SHARED_REGIONS - 1;
+    else
+        hdr.v2.regions ^= 2;
+    CHECK(parse_song_header(&hdr, &song) && !sig_ok(mipod_key, &hdr, mp_sig_offset(&song)),
+          "%s: a changed acl still passes", path);
+
+    *file_size = size;
+    *overhead = song.header_size + (size_t)song.nr_segments * song.trailer_size;
+    free(file);
+}
+
+static void bench_check(const char *dir, const char *name) {
+    char path[256];
+    drm_file_header hdr;
+    song_info song;
+    size_t size;
+    uint8_t *file;
+    uint64_t t, best;
+
+    snprintf(path, sizeof(path), "%s/%s.drm", dir, name);
+    if (!(file = test_load(path, &size)))
+        return;
+    best = UINT64_MAX;
+    for (int r = 0; r < 5; r++) {
+        t = test_cycles();
+        for (int i = 0; i < RUNS; i++)
+            header_check(file, &hdr, &song);
+        t = test_cycles() - t;
+        best = t < best ? t : best;
+    }
+    printf("  %s: %llu cycles per check, %zu bytes hmaced\n", dir, (unsigned long long)(best / RUNS),
+           mp_sig_offset(&song) + owner_sig_offset(&song));
+    free(file);
+}
+
+int main(int argc, char **argv) {
+    if (test_region_key("songs/v2", "mipod_key", mipod_key, sizeof(mipod_key)) != sizeof(mipod_key)
+        || !test_user_key("songs/v2", OWNER, owner_key)) {
+        CHECK(0, "no test secrets in songs/v2, run make songs");
+        return test_done("header_check");
+    }
+
+    if (test_bench(argc, argv))
+        printf("%-30s %10s %19s %10s %19s\n", "song", "v1 bytes", "overhead", "v2 bytes", "overhead");
+    for (size_t i = 0; i < sizeof(songs) / sizeof(songs[0]); i++) {
+        size_t size1 = 0, size2 = 0, over1 = 0, over2 = 0;
+
+        check_song(songs[i], "songs/v1", DRM_VERSION_1, &size1, &over1);
+        check_song(songs[i], "songs/v2", DRM_VERSION_2, &size2, &over2);
+        CHECK(size1 - over1 == size2 - over2, "%s: v1 and v2 hold different amounts of audio", songs[i]);
+        if (test_bench(argc, argv) && size1 && size2)
+            printf("%-30s %10zu %10zu %7.3f%% %10zu %10zu %7.3f%%\n", songs[i], size1, over1, 100.0 * over1 / size1,
+                   size2, over2, 100.0 * over2 / size2);
+    }
+
+    if (test_bench(argc, argv)) {
+        printf("header check of a play command:\n");
+        bench_check("songs/v1", songs[0]);
+        bench_check("songs/v2", songs[0]);
+    }
+    return test_done("header_check");
+}
@@ -0,0 +1,154 @@
+/*
+host side stand-ins for the bits of the firmware's support code the tested sources need,
+and the helpers in test.h.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+#include "memops.h"
+#include "xil_types.h"
+#include "xil_mem.h"
+
+int test_failures;
+static uint32_t rand_state = 1;
+
+void* memzero(void* buf, size_t n) {
+    return memset(buf, 0, n);
+}
+
+/*
+memops.c as it is built for a microblaze without a data cache, where keeping the shared memory coherent is a no-op.
+here the ranges are noted instead, so the tests can check that every handoff asks for it.
+*/
+test_shm_log test_shm;
+
+void shm_invalidate(const volatile void* arm_src, size_t n) {
+    test_shm.invalidated += n;
+    test_shm.invalidate_at = arm_src;
+    test_shm.invalidate_len = n;
+}
+
+void shm_flush(const volatile void* arm_dest, size_t n) {
+    test_shm.flushed += n;
+    test_shm.flush_at = arm_dest;
+    test_shm.flush_len = n;
+}
+
+void* copytolocal(void* fpga_dest, const volatile void* arm_src, size_t n) {
+    shm_invalidate(arm_src, n);
+    Xil_MemCpy(fpga_dest, (const void*)arm_src, n);
+    return fpga_dest;
+}
+
+void* copyfromlocal(volatile void* arm_dest, const void* fpga_src, size_t n) {
+    Xil_MemCpy((void*)arm_dest, fpga_src, n);
+    shm_flush(arm_dest, n);
+    return (void*)arm_dest;
+}
+
+int test_done(const char *name) {
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+    return test_failures != 0;
+}
+
+int test_bench(int argc, char **argv) {
+    return argc > 1 && !strcmp(argv[1], "--bench");
+}
+
+uint64_t test_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t test_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return test_ns();
+#endif
+}
+
+//xorshift32, good enough to make up test data
+uint32_t test_rand(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+void test_fill(void *buf, size_t n, uint32_t seed) {
+    uint8_t *p = buf;
+    rand_state = seed ? seed : 1;
+    while (n--)
+        *p++ = (uint8_t)test_rand();
+}
+
+uint8_t *test_load(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf = NULL;
+    long n;
+
+    if (!f)
+        return NULL;
+    if (!fseek(f, 0, SEEK_END) && (n = ftell(f)) >= 0 && !fseek(f, 0, SEEK_SET)) {
+        buf = malloc(n + 1);
+        if (buf && fread(buf, 1, n, f) == (size_t)n) {
+            buf[n] = 0; //so the json secrets can be searched as a string
+            *size = n;
+        } else {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+size_t test_region_key(const char *dir, const char *name, uint8_t *key, size_t n) {
+    char path[256], field[64];
+    size_t size, got = 0;
+    uint8_t *json;
+    char *p;
+
+    snprintf(path, sizeof(path), "%s/test_region.secrets", dir);
+    snprintf(field, sizeof(field), "\"%s\": \"", name);
+    if (!(json = test_load(path, &size)))
+        return 0;
+    //"mipod_key": "12, 34, ...", see byte_list in genSongs
+    if ((p = strstr((char *)json, field))) {
+        p += strlen(field);
+        while (got < n && *p != '"') {
+            key[got++] = (uint8_t)strtoul(p, &p, 10);
+            p += strspn(p, ", ");
+        }
+    }
+    free(json);
+    return got;
+}
+
+//the binary format of tools/userSecrets.py
+#define USEC_HEADER 16
+#define USEC_RECORD (16 + 4 + 16 + 64)
+
+int test_user_key(const char *dir, const char *user, uint8_t key[64]) {
+    char path[256];
+    size_t size, off;
+    uint8_t *file;
+    int found = 0;
+
+    snprintf(path, sizeof(path), "%s/test_user.secrets", dir);
+    if (!(file = test_load(path, &size)))
+        return 0;
+    if (size >= USEC_HEADER && !memcmp(file, "USEC", 4)) {
+        for (off = USEC_HEADER; off + USEC_RECORD <= size && !found; off += USEC_RECORD) {
+            if (!strncmp((char *)file + off, user, 16)) {
+                memcpy(key, file + off + 16 + 4 + 16, 64);
+                found = 1;
+            }
+        }
+    }
+    free(file);
+    return found;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#ifndef MB_INTERFACE_H
+#define MB_INTERFACE_H
+/*
+host stand-in for the bsp header: there are no interrupts to mask in the host tests.
+*/
+#include <stdint.h>
+
+static inline uint32_t mfmsr(void) { return 0; }
+static inline void microblaze_enable_interrupts(void) {}
+static inline void microblaze_disable_interrupts(void) {}
+
+#endif // !MB_INTERFACE_H
@@ -0,0 +1,11 @@
+#pragma once
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+/*
+host stand-in for the bsp header, so the tests can take the firmware's layout from constants.h.
+*/
+#include <stdio.h>
+
+#define xil_printf printf
+
+#endif // !XIL_PRINTF_H
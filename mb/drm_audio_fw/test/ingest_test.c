@@ -0,0 +1,226 @@
+/*
+segment ingest (ingest.c) and the shared memory copies of memops.c, built for the host with the bsp's Xil_MemCpy.
+the memops.c stand-ins in host.c note what they are asked to keep coherent, and the test checks that
+- copytolocal invalidates the whole source before it copies, and copyfromlocal flushes the whole destination after
+- an ingest invalidates the whole segment before its first slice is copied, then copies it exactly,
+  INGEST_SLICE_SZ bytes per ingest_poll call
+- the mac it absorbs on the way in is the same as macing the copy in one go, for segment and mac lengths that do
+  not line up with the slices or the hash blocks
+with --bench it prints the MB/s of the shared memory copies before and after they went through copytolocal: the
+segment copy was already Xil_MemCpy, the header and login copies were the byte loop memops.c has for memcpy.
+it then prints the cycles of a segment copy, in one go as load_song_segment did it and through the ingest engine,
+and how long each ingest_poll holds the cpu, which is what the other tasks wait on.
+last it compares the fused path (mac the segment while ingest copies it in, then decrypt it) with three passes over
+the same segment (copy it in, mac it, decrypt it), and checks that both give the same mac and plaintext.
+*/
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "memops.h"
+#include "ingest.h"
+#include "aes.h"
+#include "xil_types.h"
+#include "xil_mem.h"
+
+#define TRAILER_SZ sizeof(struct segment_trailer_v2)
+#define SEG (SEGMENT_BUF_SIZE + TRAILER_SZ) //a full v2 segment
+#define RUNS 2000
+
+static uint8_t shared[SEG + 64] __attribute__((aligned(4))), local[SEG + 64] __attribute__((aligned(4)));
+static uint8_t key[HASH_BLKSIZE];
+static aes_sw engine;
+
+/*
+memcpy as memops.c has it, which the header and login copies used before copytolocal.
+kept from being turned back into a call to the host's memcpy.
+*/
+__attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+static void *memops_memcpy(void *dest, const void *src, size_t n) {
+    char *dp = dest;
+    const char *sp = src;
+    while (n--)
+        *dp++ = *sp++;
+    return dest;
+}
+
+static void check_copies(void) {
+    for (size_t n = 1; n <= 300; n += 37) {
+        test_fill(shared, n, n);
+        memset(local, 0, n);
+        memset(&test_shm, 0, sizeof(test_shm));
+        copytolocal(local, shared + 1, n);
+        CHECK(!memcmp(local, shared + 1, n), "copytolocal of %zu bytes differs", n);
+        CHECK(test_shm.invalidate_at == shared + 1 && test_shm.invalidate_len == n && test_shm.invalidated == n,
+              "copytolocal of %zu bytes did not invalidate exactly its source", n);
+
+        test_fill(local, n, n + 1);
+        copyfromlocal(shared + 3, local, n);
+        CHECK(!memcmp(local, shared + 3, n), "copyfromlocal of %zu bytes differs", n);
+        CHECK(test_shm.flush_at == shared + 3 && test_shm.flush_len == n && test_shm.flushed == n,
+              "copyfromlocal of %zu bytes did not flush exactly its destination", n);
+    }
+}
+
+static void check_ingest(size_t n, size_t mac_len, uint8_t alg) {
+    SEG_MAC_State state, ref;
+    uint8_t mac[SEG_MAC_SIZE], want[SEG_MAC_SIZE];
+    uint32_t polls = 0;
+
+    test_fill(shared, n, n ^ mac_len);
+    memset(local, 0xA5, sizeof(local));
+    memset(&test_shm, 0, sizeof(test_shm));
+    seg_mac_init(&state, alg, key);
+
+    CHECK(ingest_start_mac(local, shared, n, &state, mac_len), "ingest of %zu bytes did not start", n);
+    CHECK(test_shm.invalidate_at == shared && test_shm.invalidate_len == n,
+          "ingest of %zu bytes did not invalidate the segment when it started", n);
+    CHECK(local[0] == 0xA5, "ingest of %zu bytes copied before it was polled", n);
+    while (!ingest_poll())
+        polls++;
+    CHECK(test_shm.invalidated == n && !test_shm.flushed, "ingest of %zu bytes invalidated %zu and flushed %zu bytes",
+          n, test_shm.invalidated, test_shm.flushed);
+    CHECK(!memcmp(local, shared, n) && local[n] == 0xA5, "ingest of %zu bytes did not copy exactly the segment", n);
+
+    const ingest_stats *st = ingest_last_stats();
+    CHECK(polls + 1 == (n + INGEST_SLICE_SZ - 1) / INGEST_SLICE_SZ && st->polls == polls + 1,
+          "ingest of %zu bytes took %u polls", n, polls + 1);
+    CHECK(st->bytes == n && st->cpu_bytes == n && st->mac_bytes == min(n, mac_len),
+          "ingest of %zu bytes: stats %u %u %u", n, st->bytes, st->cpu_bytes, st->mac_bytes);
+
+    seg_mac_final(&state, mac);
+    seg_mac_init(&ref, alg, key);
+    seg_mac_update(&ref, local, min(n, mac_len));
+    seg_mac_final(&ref, want);
+    CHECK(!memcmp(mac, want, SEG_MAC_SIZE), "ingest of %zu bytes, mac over %zu: the mac differs (alg %d)",
+          n, mac_len, alg);
+}
+
+static double mbps(size_t n, uint64_t ns) {
+    return (double)n * RUNS * 1e3 / ns;
+}
+
+static void bench_copy(const char *what, size_t n) {
+    uint64_t t0, t1, t2, t3;
+
+    t0 = test_ns();
+    for (int i = 0; i < RUNS; i++)
+        memops_memcpy(local, shared, n);
+    t1 = test_ns();
+    for (int i = 0; i < RUNS; i++)
+        Xil_MemCpy(local, shared, n);
+    t2 = test_ns();
+    for (int i = 0; i < RUNS; i++)
+        copytolocal(local, shared, n);
+    t3 = test_ns();
+    printf("  %-8s %6zu %10.0f %10.0f %12.0f\n", what, n, mbps(n, t1 - t0), mbps(n, t2 - t1), mbps(n, t3 - t2));
+}
+
+static void bench_segment(size_t n) {
+    uint64_t t, once = UINT64_MAX, ingest = UINT64_MAX;
+    uint32_t polls = 0;
+
+    for (int r = 0; r < 5; r++) {
+        t = test_cycles();
+        for (int i = 0; i < RUNS; i++)
+            copytolocal(local, shared, n);
+        t = test_cycles() - t;
+        once = t < once ? t : once;
+
+        t = test_cycles();
+        for (int i = 0; i < RUNS; i++) {
+            ingest_start_mac(local, shared, n, NULL, 0);
+            while (!ingest_poll());
+        }
+        t = test_cycles() - t;
+        ingest = t < ingest ? t : ingest;
+        polls = ingest_last_stats()->polls;
+    }
+    printf("  %6zu %10llu %10llu %6u %10llu\n", n, (unsigned long long)(once / RUNS),
+           (unsigned long long)(ingest / RUNS), polls, (unsigned long long)(ingest / RUNS / polls));
+}
+
+/*
+ingests, macs and decrypts the segment of <n> bytes in shared, into local and <mac>, in one of the two ways.
+*/
+static void load_segment(size_t n, uint8_t alg, bool fused, uint8_t mac[SEG_MAC_SIZE]) {
+    SEG_MAC_State state;
+    size_t data = n - TRAILER_SZ;
+
+    seg_mac_init(&state, alg, key);
+    if (fused) {
+        ingest_start_mac(local, shared, n, &state, n - SEG_MAC_SIZE);
+        while (!ingest_poll());
+    } else {
+        copytolocal(local, shared, n);
+        seg_mac_update(&state, local, n - SEG_MAC_SIZE);
+    }
+    seg_mac_final(&state, mac);
+    aes_sw_decrypt_blocks(&engine, local, local, data / AES_BLOCKSIZE);
+}
+
+static void bench_fused(size_t n, uint8_t alg, const char *name) {
+    uint8_t mac3[SEG_MAC_SIZE], mac1[SEG_MAC_SIZE];
+    static uint8_t plain[SEG];
+    uint64_t t, three = UINT64_MAX, fused = UINT64_MAX;
+
+    load_segment(n, alg, false, mac3);
+    memcpy(plain, local, n);
+    load_segment(n, alg, true, mac1);
+    CHECK(!memcmp(mac1, mac3, SEG_MAC_SIZE) && !memcmp(plain, local, n),
+          "%s, %zu bytes: the fused path gives another mac or plaintext", name, n);
+
+    for (int r = 0; r < 20; r++) {
+        t = test_cycles();
+        for (int i = 0; i < RUNS / 10; i++)
+            load_segment(n, alg, false, mac3);
+        t = test_cycles() - t;
+        three = t < three ? t : three;
+
+        t = test_cycles();
+        for (int i = 0; i < RUNS / 10; i++)
+            load_segment(n, alg, true, mac1);
+        t = test_cycles() - t;
+        fused = t < fused ? t : fused;
+    }
+    printf("  %-10s %6zu %12llu %12llu %7.1f%%\n", name, n, (unsigned long long)(three / (RUNS / 10)),
+           (unsigned long long)(fused / (RUNS / 10)), 100.0 - 100.0 * fused / three);
+}
+
+int main(int argc, char **argv) {
+    static const size_t sizes[] = { 1, 15, 64, INGEST_SLICE_SZ, INGEST_SLICE_SZ + 1, 8064 + TRAILER_SZ, SEG };
+
+    test_fill(key, sizeof(key), 7);
+    ingest_init();
+    check_copies();
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t n = sizes[i];
+        size_t v2_mac = n > TRAILER_SZ ? n - SEG_MAC_SIZE : n; //the data, idx and next_segment_size
+        check_ingest(n, v2_mac, SEG_MAC_HMAC_SHA1);
+        check_ingest(n, v2_mac, SEG_MAC_BLAKE2S);
+        check_ingest(n, n / 3, SEG_MAC_HMAC_SHA1);
+        check_ingest(n, 0, SEG_MAC_HMAC_SHA1);
+    }
+
+    if (test_bench(argc, argv)) {
+        test_fill(shared, sizeof(shared), 3);
+        printf("shared memory copies, MB/s:\n  %-8s %6s %10s %10s %12s\n", "", "bytes", "byte loop", "Xil_MemCpy",
+               "copytolocal");
+        bench_copy("header", 297);
+        bench_copy("login", 16 + 64);
+        bench_copy("segment", SEG);
+        printf("cycles per segment:\n  %6s %10s %10s %6s %10s\n", "bytes", "in one go", "ingest", "polls",
+               "per poll");
+        bench_segment(1024 + TRAILER_SZ);
+        bench_segment(8064 + TRAILER_SZ);
+        bench_segment(16000 + TRAILER_SZ);
+        bench_segment(SEG);
+        printf("cycles to load a segment, copy + mac + decrypt:\n  %-10s %6s %12s %12s %8s\n", "mac", "bytes",
+               "three pass", "fused", "saved");
+        aes_sw_init(&engine, key, AES_SW_TTABLE);
+        bench_fused(1024 + TRAILER_SZ, SEG_MAC_HMAC_SHA1, "hmac-sha1");
+        bench_fused(SEG, SEG_MAC_HMAC_SHA1, "hmac-sha1");
+        bench_fused(1024 + TRAILER_SZ, SEG_MAC_BLAKE2S, "blake2s");
+        bench_fused(SEG, SEG_MAC_BLAKE2S, "blake2s");
+    }
+    return test_done("ingest_test");
+}
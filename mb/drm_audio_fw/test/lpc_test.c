@@ -0,0 +1,257 @@
+/*
+the lossless decoder (lpc.c) on songs protectSong coded with --codec lpc (the lpc songs rule in the Makefile), which
+keeps the wav files they were made from.
+each song is 8 or 16 bit, mono or stereo, at 8000 or 48000 hz, and ends in a natural, a 128 byte or an odd sized
+last segment, so most of them end in a short block. every segment is decrypted with the test aes key and decoded,
+and the test checks bit for bit that
+- the song's own format comes out as the wav's pcm, at the offset the segment header gives
+- native frames come out as pcm.c widens the wav's pcm
+- for 8000 hz songs, the resampler fed with the decoded segments puts out the same as when it is fed the wav
+with --bench it prints the cycles it takes to decode a second of audio, in the song's own format and native.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "header.h"
+#include "aes.h"
+#include "lpc.h"
+#include "pcm.h"
+#include "resample.h"
+
+#define DIR "songs/lpc"
+#define BLOCK_ROOM (LPC_BLOCK_FRAMES * PCM_NATIVE_FRAME)
+
+static const char *rates[] = { "8000", "48000" }, *ends[] = { "natural", "short", "odd" };
+static const int formats[][2] = { { 1, 8 }, { 1, 16 }, { 2, 8 }, { 2, 16 } };
+
+static aes_sw engine;
+
+typedef struct {
+    char name[64];
+    uint8_t *drm, *wav;
+    const uint8_t *pcm; //the wav's audio
+    size_t drm_size, pcm_size;
+    song_info song;
+    uint8_t *plain; //the decrypted data of every segment, back to back
+    size_t *seg_off, *seg_len;
+} lpc_song;
+
+static const uint8_t *wav_data(const uint8_t *wav, size_t size, size_t *len) {
+    size_t off = 12;
+
+    while (off + 8 <= size) {
+        uint32_t n;
+        memcpy(&n, wav + off + 4, 4);
+        if (!memcmp(wav + off, "data", 4) && off + 8 + n <= size) {
+            *len = n;
+            return wav + off + 8;
+        }
+        off += 8 + n + (n & 1);
+    }
+    return NULL;
+}
+
+/*
+reads the song <name>, parses its header and decrypts its segments. returns false if it is not there.
+*/
+static bool load_song(lpc_song *s, const char *name) {
+    char path[256];
+    size_t wav_size, off, seg;
+
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    snprintf(path, sizeof(path), "%s/%s.drm", DIR, name);
+    if (!(s->drm = test_load(path, &s->drm_size)) || s->drm_size < sizeof(drm_file_header))
+        return false;
+    snprintf(path, sizeof(path), "%s/%s.wav", DIR, name);
+    if (!(s->wav = test_load(path, &wav_size)) || !(s->pcm = wav_data(s->wav, wav_size, &s->pcm_size)))
+        return false;
+    if (!parse_song_header((drm_file_header *)s->drm, &s->song) || s->song.codec != SEG_CODEC_LPC)
+        return false;
+
+    s->plain = malloc(s->drm_size);
+    s->seg_off = calloc(s->song.nr_segments, sizeof(size_t));
+    s->seg_len = calloc(s->song.nr_segments, sizeof(size_t));
+    off = s->song.header_size;
+    seg = s->song.first_segment_size;
+    for (uint32_t i = 0; i < s->song.nr_segments; i++) {
+        uint32_t next;
+
+        if (seg < s->song.trailer_size || off + seg > s->drm_size)
+            return false;
+        s->seg_off[i] = off;
+        s->seg_len[i] = seg - s->song.trailer_size;
+        aes_sw_decrypt_blocks(&engine, s->plain + off, s->drm + off, s->seg_len[i] / AES_BLOCKSIZE);
+        memcpy(&next, s->drm + off + seg - s->song.trailer_size + 4, 4);
+        off += seg;
+        seg = next;
+    }
+    return true;
+}
+
+static void free_song(lpc_song *s) {
+    free(s->drm);
+    free(s->wav);
+    free(s->plain);
+    free(s->seg_off);
+    free(s->seg_len);
+}
+
+/*
+decodes segment <i> of <s> into <out>, returns the bytes written, or 0 on an error.
+the offset of its audio in the song is put in <start>.
+*/
+static size_t decode_segment(lpc_song *s, uint32_t i, bool native, uint8_t *out, size_t *start) {
+    lpc_segment seg;
+    size_t n, total = 0;
+
+    if (!lpc_open(&seg, s->plain + s->seg_off[i], s->seg_len[i], s->song.channels, s->song.sample_bits, native))
+        return 0;
+    *start = seg.raw_start;
+    while (seg.raw_done < seg.raw_len) {
+        if (!lpc_decode(&seg, out + total, BLOCK_ROOM, &n))
+            return 0;
+        total += n;
+    }
+    return total;
+}
+
+/*
+widens the wav frame at <src> into the native frame at <dest>: 8 bit samples are unsigned, mono goes to both channels.
+*/
+static void native_frame(uint8_t *dest, const uint8_t *src, int channels, int bits) {
+    for (int c = 0; c < 2; c++) {
+        const uint8_t *p = src + (channels - 1) * c * bits / 8;
+        uint16_t v = bits == 16 ? (uint16_t)(p[0] | (p[1] << 8)) : (uint16_t)((p[0] - 128) * 256);
+
+        dest[2 * c] = v & 0xFF;
+        dest[2 * c + 1] = v >> 8;
+    }
+}
+
+static void check_song(lpc_song *s) {
+    size_t ratio = PCM_NATIVE_FRAME / pcm_frame_size(s->song.channels, s->song.sample_bits);
+    uint8_t *out = malloc(s->pcm_size * ratio + BLOCK_ROOM), *ref = malloc(s->pcm_size * ratio + 4);
+    pcm_widen_fn widen = pcm_widener(s->song.channels, s->song.sample_bits);
+    size_t pos = 0, start, n;
+
+    CHECK(s->song.audio_size == s->pcm_size, "%s: the header says %u bytes of audio, the wav has %zu", s->name,
+          s->song.audio_size, s->pcm_size);
+    for (uint32_t i = 0; i < s->song.nr_segments; i++) {
+        n = decode_segment(s, i, false, out, &start);
+        CHECK(n && start == pos && pos + n <= s->pcm_size && !memcmp(out, s->pcm + pos, n),
+              "%s: segment %u (%zu bytes at %zu) does not decode to the wav", s->name, i, n, start);
+        pos += n;
+    }
+    CHECK(pos == s->pcm_size, "%s: %zu of %zu bytes decoded", s->name, pos, s->pcm_size);
+
+    //native frames, against widening the wav. the kernels take whole words, the frames after those are widened here
+    memcpy(ref, s->pcm, s->pcm_size);
+    if (widen) {
+        size_t frame = pcm_frame_size(s->song.channels, s->song.sample_bits), whole = s->pcm_size & ~3;
+
+        n = widen((uint32_t *)out, (const uint32_t *)ref, whole);
+        for (; whole + frame <= s->pcm_size; whole += frame, n += PCM_NATIVE_FRAME)
+            native_frame(out + n, s->pcm + whole, s->song.channels, s->song.sample_bits);
+        memcpy(ref, out, n);
+    } else {
+        n = s->pcm_size;
+    }
+    pos = 0;
+    for (uint32_t i = 0; i < s->song.nr_segments; i++) {
+        size_t m = decode_segment(s, i, true, out, &start);
+        CHECK(m && start * ratio == pos && pos + m <= n && !memcmp(out, ref + pos, m),
+              "%s: segment %u does not decode to the widened wav", s->name, i);
+        pos += m;
+    }
+    CHECK(pos == n, "%s: %zu of %zu native bytes decoded", s->name, pos, n);
+    free(out);
+    free(ref);
+}
+
+/*
+the resampler fed with the decoded segments, a block at a time as playback_read does, against one fed with the wav.
+*/
+static void check_resampled(lpc_song *s) {
+    static resampler rs;
+    size_t room = s->pcm_size / pcm_frame_size(s->song.channels, s->song.sample_bits) * PCM_NATIVE_FRAME
+                  * AUDIO_SAMPLING_RATE / s->song.samplerate + 4096;
+    uint8_t *want = malloc(room), *got = malloc(room), *out = malloc(s->pcm_size + BLOCK_ROOM);
+    size_t nwant, ngot = 0, used, start;
+
+    resample_init(&rs, s->song.samplerate, AUDIO_SAMPLING_RATE, s->song.channels, s->song.sample_bits);
+    used = s->pcm_size;
+    nwant = resample_run(&rs, s->pcm, &used, want, room);
+
+    resample_reset(&rs);
+    for (uint32_t i = 0; i < s->song.nr_segments; i++) {
+        size_t n = decode_segment(s, i, false, out, &start);
+        for (size_t pos = 0; pos < n; pos += used) {
+            used = min(n - pos, BLOCK_ROOM);
+            ngot += resample_run(&rs, out + pos, &used, got + ngot, room - ngot);
+        }
+    }
+    CHECK(ngot == nwant && !memcmp(got, want, nwant), "%s: resampled %zu bytes, %zu from the wav", s->name, ngot,
+          nwant);
+    free(want);
+    free(got);
+    free(out);
+}
+
+/*
+host cycles to decode a second of <s>'s audio, once the segments are decrypted.
+*/
+static uint64_t bench_decode(lpc_song *s, bool native) {
+    uint8_t *out = malloc(s->pcm_size * PCM_NATIVE_FRAME + BLOCK_ROOM);
+    uint64_t t, best = UINT64_MAX;
+    size_t start;
+
+    for (int r = 0; r < 5; r++) {
+        t = test_cycles();
+        for (uint32_t i = 0; i < s->song.nr_segments; i++)
+            decode_segment(s, i, native, out, &start);
+        t = test_cycles() - t;
+        best = t < best ? t : best;
+    }
+    free(out);
+    return best * s->song.samplerate * pcm_frame_size(s->song.channels, s->song.sample_bits) / s->pcm_size;
+}
+
+int main(int argc, char **argv) {
+    uint8_t key[AES_KEYSIZE];
+    int verbose = test_bench(argc, argv);
+
+    if (test_region_key(DIR, "aes_key", key, sizeof(key)) != sizeof(key)) {
+        CHECK(0, "no test secrets in %s, run make songs", DIR);
+        return test_done("lpc_test");
+    }
+    aes_sw_init(&engine, key, AES_SW_TTABLE);
+
+    if (verbose)
+        printf("cycles to decode a second of audio:\n  %-28s %10s %10s %10s\n", "song", "bytes/s", "own", "native");
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            for (size_t e = 0; e < sizeof(ends) / sizeof(ends[0]); e++) {
+                char name[64];
+                lpc_song s;
+
+                snprintf(name, sizeof(name), "3s_%shz_%dch_%db_%s", rates[r], formats[f][0], formats[f][1], ends[e]);
+                if (!load_song(&s, name)) {
+                    CHECK(0, "cannot read %s/%s, run make songs", DIR, name);
+                    free_song(&s);
+                    continue;
+                }
+                check_song(&s);
+                if (s.song.samplerate != AUDIO_SAMPLING_RATE)
+                    check_resampled(&s);
+                if (verbose && e == 0)
+                    printf("  %-28s %10u %10llu %10llu\n", name,
+                           s.song.samplerate * pcm_frame_size(s.song.channels, s.song.sample_bits),
+                           (unsigned long long)bench_decode(&s, false), (unsigned long long)bench_decode(&s, true));
+                free_song(&s);
+            }
+        }
+    }
+    return test_done("lpc_test");
+}
@@ -0,0 +1,98 @@
+/*
+checks the widening kernels in pcm.c against a byte at a time reference, and times them with --bench.
+the reference reads wav samples the way the format defines them (little endian, 8 bit unsigned) and builds each
+native frame from its left and right sample, so it shares none of the kernels' word tricks.
+*/
+#include <string.h>
+#include "test.h"
+#include "pcm.h"
+
+#define MAX_IN 32000 //a full segment
+
+static const struct {
+    int channels, bits;
+} formats[] = {
+    { 1, 16 }, { 2, 8 }, { 1, 8 },
+};
+
+static uint32_t in_buf[MAX_IN / 4], out_buf[MAX_IN + 1], ref_buf[MAX_IN];
+
+static int16_t sample_at(const uint8_t *p, int bits) {
+    if (bits == 16)
+        return (int16_t)(p[0] | (p[1] << 8));
+    return (int16_t)((p[0] - 128) * 256);
+}
+
+static size_t reference(uint32_t *dest, const uint8_t *src, size_t n, int channels, int bits) {
+    size_t frame = pcm_frame_size(channels, bits), frames = n / frame;
+    for (size_t i = 0; i < frames; i++) {
+        const uint8_t *f = src + i * frame;
+        uint16_t l = (uint16_t)sample_at(f, bits), r = (uint16_t)sample_at(f + (channels - 1) * bits / 8, bits);
+        dest[i] = l | ((uint32_t)r << 16);
+    }
+    return frames * PCM_NATIVE_FRAME;
+}
+
+static void check_kernels(void) {
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        int ch = formats[f].channels, bits = formats[f].bits;
+        pcm_widen_fn widen = pcm_widener(ch, bits);
+
+        CHECK(widen, "no kernel for %d ch %d bit", ch, bits);
+        if (!widen)
+            continue;
+        for (uint32_t round = 0; round < 200; round++) {
+            size_t n = round < 4 ? round * 4 : (test_rand() % (MAX_IN / 4) + 1) * 4, want, got;
+            size_t words = n * PCM_NATIVE_FRAME / pcm_frame_size(ch, bits) / 4;
+
+            test_fill(in_buf, n, round + 1);
+            out_buf[words] = 0xDEADBEEF;
+            got = widen(out_buf, in_buf, n);
+            want = reference(ref_buf, (const uint8_t *)in_buf, n, ch, bits);
+            CHECK(got == want, "%d ch %d bit, %zu bytes: wrote %zu, want %zu", ch, bits, n, got, want);
+            CHECK(!memcmp(out_buf, ref_buf, want), "%d ch %d bit, %zu bytes: differs from the reference", ch, bits, n);
+            CHECK(out_buf[words] == 0xDEADBEEF, "%d ch %d bit, %zu bytes: wrote past the end", ch, bits, n);
+        }
+    }
+    //the extremes of each format
+    in_buf[0] = 0x7FFF8000; //16 bit -32768, 32767
+    CHECK(pcm_widener(1, 16)(out_buf, in_buf, 4) == 8 && out_buf[0] == 0x80008000 && out_buf[1] == 0x7FFF7FFF,
+          "16 bit mono extremes");
+    in_buf[0] = 0xFF80007F; //8 bit 0x7f, 0x00, 0x80, 0xff, ie -1, -128, 0, 127
+    CHECK(pcm_widener(1, 8)(out_buf, in_buf, 4) == 16 && out_buf[0] == 0xFF00FF00 && out_buf[1] == 0x80008000 &&
+          out_buf[2] == 0x00000000 && out_buf[3] == 0x7F007F00, "8 bit mono extremes");
+
+    CHECK(!pcm_widener(2, 16), "the native format has a kernel");
+    CHECK(!pcm_widener(2, 24) && !pcm_widener(3, 8) && !pcm_widener(1, 32), "an unknown format has a kernel");
+}
+
+static void bench(void) {
+    const int reps = 2000;
+
+    printf("pcm widening, 32000 byte segment, cycles per output sample (two per frame):\n");
+    test_fill(in_buf, sizeof(in_buf), 9);
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        int ch = formats[f].channels, bits = formats[f].bits;
+        pcm_widen_fn widen = pcm_widener(ch, bits);
+        size_t samples = 0, ref_samples = 0;
+        uint64_t c, ref_c;
+
+        c = test_cycles();
+        for (int i = 0; i < reps; i++)
+            samples += widen(out_buf, in_buf, sizeof(in_buf)) / 2;
+        c = test_cycles() - c;
+        ref_c = test_cycles();
+        for (int i = 0; i < reps / 10; i++)
+            ref_samples += reference(ref_buf, (const uint8_t *)in_buf, sizeof(in_buf), ch, bits) / 2;
+        ref_c = test_cycles() - ref_c;
+        printf("  %d ch %2d bit %6.2f (byte-wise reference %.2f)\n", ch, bits, (double)c / samples,
+               (double)ref_c / ref_samples);
+    }
+}
+
+int main(int argc, char **argv) {
+    check_kernels();
+    if (test_bench(argc, argv))
+        bench();
+    return test_done("pcm_test");
+}
@@ -0,0 +1,233 @@
+/*
+quality and consistency tests for resample.c, and its throughput with --bench.
+
+- a sine sweep: tones at fractions of the lower rate's nyquist frequency are converted and compared with the ideal
+  sine at the output rate. output frame i sits at input frame i * in_rate / out_rate exactly, so there is no delay
+  to line up, only the first RS_TAPS frames are skipped while the history fills.
+- streaming: a song fed in random pieces, into random amounts of room, comes out the same as in one call.
+- dc and silence come out unchanged, since each phase sums to exactly 1 << RS_COEF_BITS.
+*/
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "test.h"
+#include "resample.h"
+#include "pcm.h"
+
+#define OUT_RATE 48000 //AUDIO_SAMPLING_RATE
+#define SWEEP_FRAMES 16384 //input frames per tone
+#define MAX_OUT_FRAMES (SWEEP_FRAMES * 5) //11025 -> 48000 is the biggest step up here
+
+static uint8_t in_buf[SWEEP_FRAMES * 4];
+static uint32_t out_buf[MAX_OUT_FRAMES], out2_buf[MAX_OUT_FRAMES];
+
+/*
+regression floors, a couple of db under what the bank does now. the 16 bit taps cap the snr in the low 70s.
+rates that need more than RS_MAX_PHASES phases lose more at the top, as each output frame may be early by up to
+1 / RS_MAX_PHASES of an input frame. going down, the 24 taps leave a wide transition band under the cutoff, so the
+top of the band is rolled off rather than wrong and is not checked.
+*/
+static const struct {
+    uint32_t in_rate;
+    double min_snr[8]; //db, for tones at 0.1 .. 0.8 of the lower nyquist frequency. 0 is not checked.
+} sweeps[] = {
+    { 44100, { 69, 72, 71, 69, 74, 69, 66, 38 } },
+    { 32000, { 66, 72, 66, 66, 80, 67, 63, 38 } },
+    { 22050, { 60, 55, 51, 49, 47, 45, 44, 37 } },
+    { 11025, { 58, 52, 49, 46, 44, 43, 41, 36 } },
+    { 96000, { 66, 63, 68, 61, 63, 53, 0, 0 } },
+};
+
+//writes <frames> frames of a sine at <freq> in the given format, 0.7 of full scale
+static size_t make_sine(uint8_t *dest, size_t frames, double freq, uint32_t rate, int channels, int bits) {
+    uint8_t *p = dest;
+    for (size_t n = 0; n < frames; n++) {
+        double v = 0.7 * sin(2 * M_PI * freq * n / rate);
+        for (int ch = 0; ch < channels; ch++) {
+            if (bits == 16) {
+                int16_t s = (int16_t)lrint(v * 32767);
+                *p++ = (uint8_t)s;
+                *p++ = (uint8_t)(s >> 8);
+            } else {
+                *p++ = (uint8_t)(lrint(v * 127) + 128);
+            }
+        }
+    }
+    return p - dest;
+}
+
+//converts all of <src> in one call
+static size_t run_all(resampler *rs, const uint8_t *src, size_t len, uint32_t *dest) {
+    size_t used = len, n = resample_run(rs, src, &used, (uint8_t *)dest, MAX_OUT_FRAMES * PCM_NATIVE_FRAME);
+    CHECK(used == len, "one shot took %zu of %zu bytes", used, len);
+    return n / PCM_NATIVE_FRAME;
+}
+
+//snr in db of both channels of <frames> native frames against the ideal sine
+static double snr(const uint32_t *out, size_t frames, double freq, double scale) {
+    double sig = 0, err = 0;
+    for (size_t i = RS_TAPS; i < frames - RS_TAPS; i++) {
+        double want = 0.7 * scale * sin(2 * M_PI * freq * i / OUT_RATE);
+        for (int ch = 0; ch < 2; ch++) {
+            double got = (int16_t)(out[i] >> (16 * ch)) / 32768.0;
+            sig += want * want;
+            err += (got - want) * (got - want);
+        }
+    }
+    return 10 * log10(sig / (err ? err : 1e-30));
+}
+
+static void check_sweep(int verbose) {
+    resampler rs;
+
+    if (verbose)
+        printf("snr against an ideal sine, db, 16 bit stereo (tone as a fraction of the lower nyquist frequency):\n"
+               "                 0.1   0.2   0.3   0.4   0.5   0.6   0.7   0.8\n");
+    for (size_t s = 0; s < sizeof(sweeps) / sizeof(sweeps[0]); s++) {
+        uint32_t in_rate = sweeps[s].in_rate;
+        double nyquist = (in_rate < OUT_RATE ? in_rate : OUT_RATE) / 2.0, db[8];
+
+        for (int t = 0; t < 8; t++) {
+            double freq = nyquist * (t + 1) / 10;
+            size_t len = make_sine(in_buf, SWEEP_FRAMES, freq, in_rate, 2, 16), frames;
+
+            CHECK(resample_init(&rs, in_rate, OUT_RATE, 2, 16), "init %u", in_rate);
+            frames = run_all(&rs, in_buf, len, out_buf);
+            //the last RS_TAPS / 2 input frames are still waiting for the ones after them
+            CHECK(frames >= (uint64_t)(SWEEP_FRAMES - RS_TAPS / 2) * OUT_RATE / in_rate,
+                  "%u: only %zu frames out", in_rate, frames);
+            db[t] = snr(out_buf, frames, freq, 1.0);
+        }
+        if (verbose) {
+            printf("  %5u->%5u", in_rate, OUT_RATE);
+            for (int t = 0; t < 8; t++)
+                printf(" %5.1f", db[t]);
+            printf("\n");
+        }
+        for (int t = 0; t < 8; t++)
+            CHECK(db[t] >= sweeps[s].min_snr[t], "%u->%u at %.1f of nyquist: snr %.1f db, want %.0f",
+                  in_rate, OUT_RATE, (t + 1) / 10.0, db[t], sweeps[s].min_snr[t]);
+    }
+}
+
+//the narrower formats, where 8 bits cap the snr at around 48 db
+static void check_formats(void) {
+    static const struct { int channels, bits; double min_snr; } formats[] = {
+        { 1, 16, 72 }, { 2, 8, 40 }, { 1, 8, 40 },
+    };
+    resampler rs;
+
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        int ch = formats[f].channels, bits = formats[f].bits;
+        double freq = 1000, scale = bits == 8 ? 127 / 127.996 : 1.0, db;
+        size_t len = make_sine(in_buf, SWEEP_FRAMES, freq, 44100, ch, bits), frames;
+
+        CHECK(resample_init(&rs, 44100, OUT_RATE, ch, bits), "init %d ch %d bit", ch, bits);
+        frames = run_all(&rs, in_buf, len, out_buf);
+        db = snr(out_buf, frames, freq, scale);
+        CHECK(db >= formats[f].min_snr, "%d ch %d bit: snr %.1f db", ch, bits, db);
+    }
+}
+
+/*
+feeds the same audio in random pieces into random room, as playback_read does across lpc blocks and bram chunks,
+and compares it with the one shot output.
+*/
+static void check_streaming(void) {
+    static const int formats[][2] = { { 2, 16 }, { 1, 16 }, { 2, 8 }, { 1, 8 } };
+    static const uint32_t rates[] = { 44100, 32000, 96000, 11025 };
+    resampler rs;
+
+    for (uint32_t round = 0; round < 64; round++) {
+        int ch = formats[round % 4][0], bits = formats[round % 4][1];
+        uint32_t rate = rates[round / 4 % 4];
+        size_t len = SWEEP_FRAMES * pcm_frame_size(ch, bits), want, got = 0, pos = 0;
+
+        test_fill(in_buf, len, round + 1);
+        CHECK(resample_init(&rs, rate, OUT_RATE, ch, bits), "init");
+        want = run_all(&rs, in_buf, len, out_buf);
+
+        resample_reset(&rs);
+        memset(out2_buf, 0, sizeof(out2_buf));
+        while (pos < len && got < MAX_OUT_FRAMES) {
+            //whole frames, a partial one would just be handed back
+            size_t piece = (test_rand() % 750 + 1) * pcm_frame_size(ch, bits);
+            size_t room = (test_rand() % 512 + 1) * PCM_NATIVE_FRAME, used;
+            if (piece > len - pos)
+                piece = len - pos;
+            if (got * PCM_NATIVE_FRAME + room > sizeof(out2_buf))
+                room = sizeof(out2_buf) - got * PCM_NATIVE_FRAME;
+            used = piece;
+            got += resample_run(&rs, in_buf + pos, &used, (uint8_t *)(out2_buf + got), room) / PCM_NATIVE_FRAME;
+            pos += used;
+        }
+        CHECK(got == want, "%u hz %d ch %d bit: streamed %zu frames, one shot %zu", rate, ch, bits, got, want);
+        CHECK(!memcmp(out_buf, out2_buf, want * PCM_NATIVE_FRAME), "%u hz %d ch %d bit: streamed output differs",
+              rate, ch, bits);
+    }
+}
+
+static void check_dc(void) {
+    static const int16_t levels[] = { 0, 1, -1, 1234, -32768, 32767 };
+    resampler rs;
+
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        size_t frames, bad = 0;
+        for (size_t n = 0; n < SWEEP_FRAMES; n++)
+            ((uint32_t *)in_buf)[n] = (uint16_t)levels[l] * 0x10001u;
+        resample_init(&rs, 44100, OUT_RATE, 2, 16);
+        frames = run_all(&rs, in_buf, SWEEP_FRAMES * 4, out_buf);
+        for (size_t i = RS_TAPS; i < frames; i++)
+            bad += out_buf[i] != (uint16_t)levels[l] * 0x10001u;
+        CHECK(!bad, "dc %d: %zu frames changed", levels[l], bad);
+    }
+}
+
+static void check_init(void) {
+    resampler rs;
+    CHECK(!resample_init(&rs, 0, OUT_RATE, 2, 16), "init takes a zero rate");
+    CHECK(!resample_init(&rs, OUT_RATE * 5, OUT_RATE, 2, 16), "init takes more than RS_MAX_DOWN");
+    CHECK(!resample_init(&rs, 44100, OUT_RATE, 3, 16), "init takes 3 channels");
+    CHECK(!resample_init(&rs, 44100, OUT_RATE, 2, 24), "init takes 24 bits");
+    CHECK(resample_init(&rs, 44100, OUT_RATE, 2, 16) && rs.phases == RS_MAX_PHASES && rs.l == 160,
+          "44.1k -> 48k is not exact");
+}
+
+static void bench(void) {
+    static const int formats[][2] = { { 2, 16 }, { 1, 16 }, { 2, 8 }, { 1, 8 } };
+    const int reps = 20;
+    resampler rs;
+
+    printf("resample 44100 -> %d, %d frames of noise:\n", OUT_RATE, SWEEP_FRAMES);
+    for (size_t f = 0; f < 4; f++) {
+        int ch = formats[f][0], bits = formats[f][1];
+        size_t len = SWEEP_FRAMES * pcm_frame_size(ch, bits), frames = 0;
+        uint64_t c, ns;
+
+        test_fill(in_buf, len, 5);
+        resample_init(&rs, 44100, OUT_RATE, ch, bits);
+        c = test_cycles();
+        ns = test_ns();
+        for (int i = 0; i < reps; i++) {
+            resample_reset(&rs);
+            frames += run_all(&rs, in_buf, len, out_buf);
+        }
+        c = test_cycles() - c;
+        ns = test_ns() - ns;
+        printf("  %d ch %2d bit %7.1f cycles/frame %6.0fx real time\n", ch, bits, (double)c / frames,
+               frames / (ns / 1e9) / OUT_RATE);
+    }
+}
+
+int main(int argc, char **argv) {
+    int bench_run = test_bench(argc, argv);
+
+    check_init();
+    check_sweep(bench_run);
+    check_formats();
+    check_streaming();
+    check_dc();
+    if (bench_run)
+        bench();
+    return test_done("resample_test");
+}
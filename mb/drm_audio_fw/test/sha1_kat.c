@@ -0,0 +1,192 @@
+/*
+known answer tests for sha1.c, and its speed with --bench.
+
+the fips 180 vectors go through every way the firmware feeds data in: SHA_Simple, SHA_Bytes a byte at a time,
+SHA_Blocks for the whole blocks with SHA_Bytes for the tail, and SHA_CopyBytes from an unaligned source into an
+unaligned destination. random messages are then split at random points across all three entry points, at every
+alignment, and have to hash the same as one SHA_Bytes call.
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "test.h"
+#include "sha1.h"
+
+#define MILLION 1000000
+
+static const struct {
+    const char *msg; //NULL for a million 'a's
+    uint8_t digest[20];
+} kat[] = {
+    { "", { 0xda, 0x39, 0xa3, 0xee, 0x5e, 0x6b, 0x4b, 0x0d, 0x32, 0x55,
+            0xbf, 0xef, 0x95, 0x60, 0x18, 0x90, 0xaf, 0xd8, 0x07, 0x09 } },
+    { "abc", { 0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+               0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d } },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      { 0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae,
+        0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 } },
+    { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+      { 0xa4, 0x9b, 0x24, 0x46, 0xa0, 0x2c, 0x64, 0x5b, 0xf4, 0x19,
+        0xf9, 0x95, 0xb6, 0x70, 0x91, 0x25, 0x3a, 0x04, 0xa2, 0x59 } },
+    { NULL, { 0x34, 0xaa, 0x97, 0x3c, 0xd4, 0xc4, 0xda, 0xa4, 0xf6, 0x1e,
+              0xeb, 0x2b, 0xdb, 0xad, 0x27, 0x31, 0x65, 0x34, 0x01, 0x6f } },
+};
+
+//room for the longest message at any alignment
+static uint8_t msg_buf[MILLION + 8] __attribute__((aligned(4)));
+static uint8_t copy_buf[MILLION + 8] __attribute__((aligned(4)));
+
+static void check_kat(const uint8_t *msg, int len, const uint8_t *want, int k) {
+    uint8_t out[20];
+    int whole = len & ~63;
+    SHA_State s;
+
+    SHA_Simple(msg, len, out);
+    CHECK(!memcmp(out, want, 20), "vector %d: SHA_Simple", k);
+
+    if (len < 4096) { //a million single byte calls would take a while
+        SHA_Init(&s);
+        for (int i = 0; i < len; i++)
+            SHA_Bytes(&s, msg + i, 1);
+        SHA_Final(&s, out);
+        CHECK(!memcmp(out, want, 20), "vector %d: SHA_Bytes a byte at a time", k);
+    }
+
+    SHA_Init(&s);
+    SHA_Blocks(&s, msg, whole >> 6);
+    SHA_Bytes(&s, msg + whole, len - whole);
+    SHA_Final(&s, out);
+    CHECK(!memcmp(out, want, 20), "vector %d: SHA_Blocks", k);
+
+    for (int off = 0; off < 4; off++) {
+        memset(copy_buf, 0, len + 8);
+        SHA_Init(&s);
+        SHA_CopyBytes(&s, copy_buf + off, msg, len);
+        SHA_Final(&s, out);
+        CHECK(!memcmp(out, want, 20), "vector %d: SHA_CopyBytes to +%d", k, off);
+        CHECK(!memcmp(copy_buf + off, msg, len), "vector %d: SHA_CopyBytes copy to +%d", k, off);
+    }
+}
+
+static void check_vectors(void) {
+    for (size_t k = 0; k < sizeof(kat) / sizeof(kat[0]); k++) {
+        int len = kat[k].msg ? (int)strlen(kat[k].msg) : MILLION;
+        for (int off = 0; off < 4; off++) { //the source at every alignment
+            if (kat[k].msg)
+                memcpy(msg_buf + off, kat[k].msg, len);
+            else
+                memset(msg_buf + off, 'a', len);
+            check_kat(msg_buf + off, len, kat[k].digest, k);
+        }
+    }
+}
+
+/*
+splits a random message into random pieces, each fed through a random entry point, and compares the digest with
+hashing all of it at once. lengths cover partial, single and multi block pieces with and without a pending tail.
+*/
+static void check_splits(void) {
+    static uint8_t src[8192 + 8], dest[8192 + 8];
+    uint8_t want[20], got[20];
+    SHA_State s;
+
+    for (uint32_t round = 1; round <= 4000; round++) {
+        int off = round % 4, doff = (round / 4) % 4, len = test_rand() % 8192, pos = 0, n;
+
+        test_fill(src, sizeof(src), round);
+        SHA_Simple(src + off, len, want);
+
+        SHA_Init(&s);
+        while (pos < len) {
+            n = test_rand() % 4 == 0 ? test_rand() % 64 : test_rand() % 1024;
+            if (n > len - pos)
+                n = len - pos;
+            switch (test_rand() % 3) {
+            case 0:
+                SHA_Bytes(&s, src + off + pos, n);
+                break;
+            case 1:
+                n &= ~63;
+                SHA_Blocks(&s, src + off + pos, n >> 6);
+                break;
+            default:
+                SHA_CopyBytes(&s, dest + doff + pos, src + off + pos, n);
+                break;
+            }
+            pos += n;
+        }
+        SHA_Final(&s, got);
+        CHECK(!memcmp(want, got, 20), "split hash, %d bytes at +%d", len, off);
+        if (test_failures > 10)
+            return;
+    }
+}
+
+//SHA_CopyBytes has to hash exactly what it wrote to dest
+static void check_copy(void) {
+    static uint8_t src[4096 + 8], dest[4096 + 8];
+    uint8_t want[20], got[20];
+    SHA_State s;
+
+    for (uint32_t round = 1; round <= 2000; round++) {
+        int off = round % 4, doff = (round / 4) % 4, pre = round % 97, len = test_rand() % 4000;
+
+        test_fill(src, sizeof(src), ~round);
+        memset(dest, 0x5a, sizeof(dest));
+        SHA_Init(&s);
+        SHA_Bytes(&s, src, pre); //a pending partial block in front, sometimes
+        SHA_CopyBytes(&s, dest + doff, src + off, len);
+        SHA_Final(&s, got);
+
+        SHA_Init(&s);
+        SHA_Bytes(&s, src, pre);
+        SHA_Bytes(&s, src + off, len);
+        SHA_Final(&s, want);
+        CHECK(!memcmp(want, got, 20), "SHA_CopyBytes hash, %d+%d bytes, +%d to +%d", pre, len, off, doff);
+        CHECK(!memcmp(dest + doff, src + off, len), "SHA_CopyBytes copy, %d bytes, +%d to +%d", len, off, doff);
+        CHECK(dest[doff + len] == 0x5a && (!doff || dest[doff - 1] == 0x5a), "SHA_CopyBytes wrote outside dest");
+        if (test_failures > 10)
+            return;
+    }
+}
+
+typedef enum { BENCH_BYTES, BENCH_BLOCKS, BENCH_COPY } bench_kind;
+
+static double bench_one(bench_kind kind, int off) {
+    static uint8_t seg[32000 + 4] __attribute__((aligned(4))), dest[32000 + 4] __attribute__((aligned(4)));
+    const int reps = 200, len = 32000; //one full segment
+    uint8_t out[20];
+    uint64_t c;
+    SHA_State s;
+
+    test_fill(seg, sizeof(seg), 3);
+    c = test_cycles();
+    for (int i = 0; i < reps; i++) {
+        SHA_Init(&s);
+        if (kind == BENCH_BYTES)
+            SHA_Bytes(&s, seg + off, len);
+        else if (kind == BENCH_BLOCKS)
+            SHA_Blocks(&s, seg + off, len >> 6);
+        else
+            SHA_CopyBytes(&s, dest + off, seg + off, len);
+        SHA_Final(&s, out);
+    }
+    return (double)(test_cycles() - c) / reps / len;
+}
+
+static void bench(void) {
+    static const char *names[] = { "SHA_Bytes", "SHA_Blocks", "SHA_CopyBytes" };
+
+    printf("sha-1, 32000 byte segment, cycles/byte:\n");
+    printf("  %-14s %8s %8s\n", "", "aligned", "+1");
+    for (int k = BENCH_BYTES; k <= BENCH_COPY; k++)
+        printf("  %-14s %8.2f %8.2f\n", names[k], bench_one(k, 0), bench_one(k, 1));
+}
+
+int main(int argc, char **argv) {
+    check_vectors();
+    check_splits();
+    check_copy();
+    if (test_bench(argc, argv))
+        bench();
+    return test_done("sha1_kat");
+}
@@ -0,0 +1,127 @@
+/*
+the firmware's cost of sharing a song with N users, one share command per user as before against one command
+for all of them (share_song in main.c). on a v2 song of the songs rule in the Makefile, each command is
+- copy the header in, parse it, check the mipod and owner signatures (load_song_header; the header cache does not
+  help, the previous share re-signed the header and cleared it)
+- set each user's bit in the shared users map
+- sign the owner block and copy the header back out
+the username lookups (see user_lookup) and the client's side are left out.
+the test checks that both ways write the same header, and that it passes its header check.
+with --bench it prints the cycles of both against N.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "memops.h"
+#include "header.h"
+
+#define DIR "songs/v2"
+#define SONG "10s_8000hz_1ch_8b_natural"
+#define OWNER "user1" //genSongs' default --owner, uid 0
+#define RUNS 200
+
+static uint8_t mipod_key[HASH_OUTSIZE], owner_key[HASH_OUTSIZE];
+static drm_file_header shared, original; //the header in shared memory, and as protectSong wrote it
+
+static int sig_ok(uint8_t *key, drm_file_header *hdr, size_t sig_offset) {
+    uint8_t sig[HASH_OUTSIZE];
+
+    hmac(key, (uint8_t *)hdr, sig_offset, sig);
+    return !memcmp(sig, (uint8_t *)hdr + sig_offset, HASH_OUTSIZE);
+}
+
+/*
+one share command for the users 1 to <n> after <first>. returns false if the header does not check out.
+*/
+static bool share(uint32_t first, uint32_t n) {
+    drm_file_header hdr;
+    song_info song;
+
+    copytolocal(&hdr, &shared, sizeof(hdr));
+    if (!parse_song_header(&hdr, &song) || !sig_ok(mipod_key, &hdr, mp_sig_offset(&song))
+        || !sig_ok(owner_key, &hdr, owner_sig_offset(&song)))
+        return false;
+    for (uint32_t uid = first + 1; uid <= first + n; uid++)
+        bitmap_set(hdr.v2.shared_users, uid);
+    hmac(owner_key, (uint8_t *)&hdr, owner_sig_offset(&song), (uint8_t *)&hdr + owner_sig_offset(&song));
+    copyfromlocal(&shared, &hdr, song.header_size);
+    return true;
+}
+
+static void share_each(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++)
+        share(i, 1);
+}
+
+static void share_all(uint32_t n) {
+    share(0, n);
+}
+
+static void check_share(uint32_t n) {
+    drm_file_header each;
+    song_info song;
+
+    memcpy(&shared, &original, sizeof(shared));
+    share_each(n);
+    memcpy(&each, &shared, sizeof(each));
+    memcpy(&shared, &original, sizeof(shared));
+    share_all(n);
+    CHECK(!memcmp(&each, &shared, sizeof(each)), "sharing with %u users one by one writes another header", n);
+    CHECK(parse_song_header(&shared, &song) && sig_ok(owner_key, &shared, owner_sig_offset(&song))
+          && bitmap_test(song.shared_users, n) && !bitmap_test(song.shared_users, n + 1),
+          "the header shared with %u users does not check out", n);
+}
+
+static uint64_t time_share(void (*how)(uint32_t), uint32_t n) {
+    uint64_t t = test_cycles();
+
+    for (int i = 0; i < RUNS; i++) {
+        memcpy(&shared, &original, sizeof(shared));
+        how(n);
+    }
+    return (test_cycles() - t) / RUNS;
+}
+
+/*
+the best of a number of runs of either way, taken in turns so both see the same machine.
+*/
+static void bench_share(uint32_t n, uint64_t *each, uint64_t *all) {
+    *each = *all = UINT64_MAX;
+    for (int r = 0; r < 20; r++) {
+        uint64_t t = time_share(share_each, n);
+        *each = t < *each ? t : *each;
+        t = time_share(share_all, n);
+        *all = t < *all ? t : *all;
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t size;
+    uint8_t *file;
+
+    if (test_region_key(DIR, "mipod_key", mipod_key, sizeof(mipod_key)) != sizeof(mipod_key)
+        || !test_user_key(DIR, OWNER, owner_key) || !(file = test_load(DIR "/" SONG ".drm", &size))
+        || size < sizeof(original)) {
+        CHECK(0, "no test songs in %s, run make songs", DIR);
+        return test_done("share_cost");
+    }
+    memcpy(&original, file, sizeof(original));
+    free(file);
+
+    for (uint32_t n = 1; n <= MAX_SHARE_TARGETS; n++)
+        check_share(n);
+
+    if (test_bench(argc, argv)) {
+        printf("cycles to share a song with n users:\n  %4s %12s %12s %8s\n", "n", "n commands", "1 command",
+               "ratio");
+        for (uint32_t n = 1; n <= MAX_SHARE_TARGETS; n *= 2) {
+            uint64_t each, all;
+
+            bench_share(n, &each, &all);
+            printf("  %4u %12llu %12llu %7.1fx\n", n, (unsigned long long)each, (unsigned long long)all,
+                   (double)each / all);
+        }
+    }
+    return test_done("share_cost");
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef TEST_H
+#define TEST_H
+//see host.c for implementation
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+bits shared by the host tests of the firmware sources.
+a test prints one line per failed check and exits non zero if there was any, benchmarks only run with --bench.
+*/
+
+extern int test_failures;
+
+#define CHECK(cond_, ...) do { \
+    if (!(cond_)) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        test_failures++; \
+    } \
+} while (0)
+
+/*
+what the memops.c stand-ins in host.c were asked to keep coherent: the bytes handed to shm_invalidate and shm_flush,
+and the last range of each.
+*/
+typedef struct {
+    size_t invalidated, flushed;
+    const volatile void *invalidate_at, *flush_at;
+    size_t invalidate_len, flush_len;
+} test_shm_log;
+extern test_shm_log test_shm;
+
+/*
+returns 0 if no check failed, after printing a summary for <name>.
+*/
+int test_done(const char *name);
+/*
+returns true if the test was asked to run its benchmark too.
+*/
+int test_bench(int argc, char **argv);
+/*
+a free running cycle count (the tsc on x86), or nanoseconds where there is none.
+*/
+uint64_t test_cycles(void);
+/*
+wall clock nanoseconds.
+*/
+uint64_t test_ns(void);
+/*
+deterministic filler for test data, seeded with <seed>.
+*/
+void test_fill(void *buf, size_t n, uint32_t seed);
+uint32_t test_rand(void);
+/*
+the whole file at <path> in a malloc'd buffer, its size in <size>. NULL if it cannot be read.
+*/
+uint8_t *test_load(const char *path, size_t *size);
+/*
+the test secrets tools/genSongs writes next to its songs, see the songs rule in the Makefile.
+test_region_key reads the byte list <name> (eg "mipod_key") of the region secrets in <dir> into <key>, and returns
+how many bytes it read. test_user_key reads the key of <user>, and returns false if there is no such user.
+*/
+size_t test_region_key(const char *dir, const char *name, uint8_t *key, size_t n);
+int test_user_key(const char *dir, const char *user, uint8_t key[64]);
+
+#endif // !TEST_H
@@ -0,0 +1,101 @@
+/*
+username lookups through the perfect hash tables createDevice writes into secrets.h (phf.c).
+user_tables.py builds the tables for made up users with createDevice's own build_phf, one of 64 users (all a device
+can hold) and one of 10000. the test checks that
+- every name is found at its own index
+- a name that is not in the table finds nothing, or an index whose name then fails the compare
+with --bench it prints the cycles of a lookup, found and not found, against the linear strcmp scan
+username_to_uid did before the tables.
+*/
+#include <string.h>
+#include "test.h"
+#include "constants.h"
+#include "phf.h"
+
+typedef struct {
+    uint32_t n;
+    const char (*names)[UNAME_SIZE];
+    const uint16_t *seeds;
+    uint32_t nr_seeds;
+    const uint16_t *slots;
+    uint32_t nr_slots;
+} user_table;
+
+#include "user_tables.h"
+
+#define NR_TABLES (sizeof(tables) / sizeof(tables[0]))
+#define LOOKUPS 4096 //names looked up per timed run
+
+static int phf_lookup(const user_table *t, const char *name) {
+    uint16_t i = phf_find(name, t->seeds, t->nr_seeds, t->slots, t->nr_slots);
+    return (i != PHF_NONE && !strcmp(name, t->names[i])) ? i : -1;
+}
+
+static int scan_lookup(const user_table *t, const char *name) {
+    for (uint32_t i = 0; i < t->n; i++)
+        if (!strcmp(name, t->names[i]))
+            return i;
+    return -1;
+}
+
+/*
+fills <names> with LOOKUPS names of <t>, or with names not in it if <missing>.
+*/
+static void pick_names(const user_table *t, bool missing, char names[LOOKUPS][UNAME_SIZE]) {
+    for (int i = 0; i < LOOKUPS; i++) {
+        strcpy(names[i], t->names[test_rand() % t->n]);
+        if (missing)
+            names[i][0] = '_'; //not in the alphabet of user_tables.py
+    }
+}
+
+static void check_table(const user_table *t) {
+    static char missing[LOOKUPS][UNAME_SIZE];
+    int i;
+
+    for (i = 0; i < (int)t->n && phf_lookup(t, t->names[i]) == i; i++);
+    CHECK(i == (int)t->n, "%u users: %s is not found at %d", t->n, t->names[i < (int)t->n ? i : 0], i);
+    pick_names(t, true, missing);
+    for (i = 0; i < LOOKUPS && phf_lookup(t, missing[i]) < 0; i++);
+    CHECK(i == LOOKUPS, "%u users: %s is found", t->n, missing[i < LOOKUPS ? i : 0]);
+}
+
+static uint64_t bench_lookup(const user_table *t, int (*lookup)(const user_table *, const char *),
+                             char names[LOOKUPS][UNAME_SIZE]) {
+    uint64_t t0, best = UINT64_MAX;
+    volatile int sink;
+
+    for (int r = 0; r < 5; r++) {
+        t0 = test_cycles();
+        for (int i = 0; i < LOOKUPS; i++)
+            sink = lookup(t, names[i]);
+        t0 = test_cycles() - t0;
+        best = t0 < best ? t0 : best;
+    }
+    (void)sink;
+    return best / LOOKUPS;
+}
+
+int main(int argc, char **argv) {
+    static char found[LOOKUPS][UNAME_SIZE], missing[LOOKUPS][UNAME_SIZE];
+
+    for (size_t i = 0; i < NR_TABLES; i++)
+        check_table(&tables[i]);
+
+    if (test_bench(argc, argv)) {
+        printf("cycles per username lookup:\n  %6s %10s %10s %10s %10s\n", "users", "phf", "scan", "phf miss",
+               "scan miss");
+        for (size_t i = 0; i < NR_TABLES; i++) {
+            const user_table *t = &tables[i];
+
+            pick_names(t, false, found);
+            pick_names(t, true, missing);
+            printf("  %6u %10llu %10llu %10llu %10llu\n", t->n,
+                   (unsigned long long)bench_lookup(t, phf_lookup, found),
+                   (unsigned long long)bench_lookup(t, scan_lookup, found),
+                   (unsigned long long)bench_lookup(t, phf_lookup, missing),
+                   (unsigned long long)bench_lookup(t, scan_lookup, missing));
+        }
+    }
+    return test_done("user_lookup");
+}
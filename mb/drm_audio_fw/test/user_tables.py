@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+"""
+Writes the user lookup tables createDevice would put into secrets.h for made up users, one table per count given,
+for user_lookup.c. Use: user_tables.py 64 10000 > user_tables.h
+"""
+import os
+import random
+import string
+import sys
+from importlib.machinery import SourceFileLoader
+
+TOOLS = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "..", "tools")
+sys.path.insert(0, TOOLS)
+createDevice = SourceFileLoader("createDevice", os.path.join(TOOLS, "createDevice")).load_module()
+
+
+def usernames(n, rng):
+    """n unique names of 4 to 15 lowercase letters and digits"""
+    names = set()
+    while len(names) < n:
+        names.add("".join(rng.choice(string.ascii_lowercase + string.digits) for _ in range(rng.randint(4, 15))))
+    return sorted(names, key=lambda _: rng.random())
+
+
+def main(counts):
+    rng = random.Random(1)
+    print("//generated by user_tables.py, do not edit")
+    tables = []
+    for n in counts:
+        names = usernames(n, rng)
+        seeds, slots = createDevice.build_phf(names)
+        print("static const char NAMES_%d[%d][UNAME_SIZE] = { %s };" % (n, n, ", ".join('"%s"' % u for u in names)))
+        print("static const uint16_t SEEDS_%d[%d] = { %s };" % (n, len(seeds), createDevice.c_array(seeds)))
+        print("static const uint16_t SLOTS_%d[%d] = { %s };" % (n, len(slots), createDevice.c_array(slots)))
+        tables.append("{ %d, NAMES_%d, SEEDS_%d, %d, SLOTS_%d, %d }" % (n, n, n, len(seeds), n, len(slots)))
+    print("static const user_table tables[] = { %s };" % ", ".join(tables))
+
+
+if __name__ == "__main__":
+    main([int(n) for n in sys.argv[1:]])
@@ -0,0 +1,254 @@
+/*
+ * library.c
+ *
+ * The song library index, see library.h.
+ */
+
+#include "library.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static int entry_cmp(const void *a, const void *b) {
+    return strcmp(((const lib_entry *)a)->name, ((const lib_entry *)b)->name);
+}
+
+
+// the entry named <name> in the sorted <entries>, or NULL
+static lib_entry *find_entry(lib_entry *entries, uint32_t count, const char *name) {
+    lib_entry key;
+
+    if (!entries || strlen(name) >= LIBRARY_NAME_SZ)
+        return NULL;
+    strncpy(key.name, name, LIBRARY_NAME_SZ);
+    return bsearch(&key, entries, count, sizeof(lib_entry), entry_cmp);
+}
+
+
+// whether <e> was read from the file as it is now
+static int entry_fresh(const lib_entry *e, const struct stat *st) {
+    return e->mtime_sec == st->st_mtim.tv_sec && e->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec &&
+           e->size == (uint32_t)st->st_size;
+}
+
+
+// fills <e> from the header of the file <name> in <dirfd>, which <st> describes. only the header is read.
+static void read_entry(int dirfd, const char *name, const struct stat *st, lib_entry *e) {
+    union {
+        drm_header v1;
+        drm_header_v2 v2;
+    } hdr;
+    wav_header *wav;
+    ssize_t got;
+    int fd, i;
+
+    memset(e, 0, sizeof(*e));
+    strncpy(e->name, name, LIBRARY_NAME_SZ - 1);
+    e->mtime_sec = st->st_mtim.tv_sec;
+    e->mtime_nsec = st->st_mtim.tv_nsec;
+    e->size = st->st_size;
+
+    fd = openat(dirfd, name, O_RDONLY);
+    if (fd == -1)
+        return;
+    got = pread(fd, &hdr, sizeof(hdr), 0);
+    close(fd);
+
+    if (got >= (ssize_t)sizeof(drm_header_v2) && hdr.v2.magic == DRM_MAGIC_V2) {
+        if (hdr.v2.version != DRM_VERSION_2)
+            return;
+        memcpy(e->song_id, hdr.v2.song_id, SONGID_LEN);
+        e->owner = hdr.v2.ownerID;
+        e->regions = hdr.v2.regions;
+        memcpy(e->shared_users, hdr.v2.shared_users, sizeof(e->shared_users));
+        wav = &hdr.v2.wavdata;
+        e->version = DRM_VERSION_2;
+    } else if (got == (ssize_t)sizeof(drm_header)) {
+        memcpy(e->song_id, hdr.v1.song_id, SONGID_LEN);
+        e->owner = hdr.v1.ownerID;
+        // the same reading of the byte lists as the DRM's, zero padding and all
+        for (i = 0; i < MAX_SHARED_REGIONS; i++)
+            if (hdr.v1.regions[i] < MAX_SHARED_REGIONS)
+                e->regions |= 1u << hdr.v1.regions[i];
+        for (i = 0; i < MAX_SHARED_USERS; i++)
+            if (hdr.v1.shared_users[i] == 1)
+                e->shared_users[i >> 5] |= 1u << (i & 31);
+        wav = &hdr.v1.wavdata;
+        e->version = DRM_VERSION_1;
+    } else {
+        return;
+    }
+
+    // v1 headers have no magic, so anything without a wav header in the right place is not a song
+    if (memcmp(wav->chunkID, "RIFF", 4) || memcmp(wav->format, "WAVE", 4)) {
+        e->version = 0;
+        return;
+    }
+    if (wav->byterate)
+        e->duration_ms = (uint64_t)(wav->chunk_size - 44 + 8) * 1000 / wav->byterate;
+}
+
+
+// loads the index file of <dirfd> into <entries>. returns the entry count, 0 if there is no usable index.
+static uint32_t load_index(int dirfd, lib_entry **entries) {
+    lib_file_header hdr;
+    size_t size;
+    int fd;
+
+    *entries = NULL;
+    fd = openat(dirfd, LIBRARY_INDEX_NAME, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != LIBRARY_MAGIC ||
+        hdr.version != LIBRARY_VERSION || hdr.entry_size != sizeof(lib_entry) || !hdr.count)
+        goto fail;
+    size = (size_t)hdr.count * sizeof(lib_entry);
+    if (!(*entries = malloc(size)) || read(fd, *entries, size) != (ssize_t)size)
+        goto fail;
+    close(fd);
+    return hdr.count;
+
+fail:
+    free(*entries);
+    *entries = NULL;
+    close(fd);
+    return 0;
+}
+
+
+// writes the index of <lib> next to its songs. a temporary file is renamed over it, so it is never half written.
+static int save_index(library *lib, int dirfd) {
+    lib_file_header hdr = { LIBRARY_MAGIC, LIBRARY_VERSION, lib->count, sizeof(lib_entry) };
+    size_t size = (size_t)lib->count * sizeof(lib_entry);
+    int fd, ok;
+
+    fd = openat(dirfd, LIBRARY_INDEX_NAME ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && write(fd, lib->entries, size) == (ssize_t)size;
+    close(fd);
+    if (!ok || renameat(dirfd, LIBRARY_INDEX_NAME ".tmp", dirfd, LIBRARY_INDEX_NAME) == -1) {
+        unlinkat(dirfd, LIBRARY_INDEX_NAME ".tmp", 0);
+        return -1;
+    }
+    return 0;
+}
+
+
+int lib_open(library *lib, const char *dir) {
+    lib_entry *old, *cur = NULL, *e, *grown;
+    uint32_t nr_old, count = 0, cap = 0, reread = 0;
+    struct dirent *de;
+    struct stat st;
+    size_t len;
+    DIR *d;
+    int dirfd;
+
+    if (strlen(dir) >= sizeof(lib->dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirfd == -1)
+        return -1;
+    if (fstat(dirfd, &st) == -1 || !(d = fdopendir(dup(dirfd)))) {
+        close(dirfd);
+        return -1;
+    }
+    lib_close(lib);
+    strcpy(lib->dir, dir);
+    lib->dev = st.st_dev;
+    lib->ino = st.st_ino;
+
+    nr_old = load_index(dirfd, &old);
+    while ((de = readdir(d))) {
+        len = strlen(de->d_name);
+        if (len < 4 || len >= LIBRARY_NAME_SZ || strcmp(de->d_name + len - 4, ".drm"))
+            continue;
+        if (fstatat(dirfd, de->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode))
+            continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 256;
+            if (!(grown = realloc(cur, cap * sizeof(lib_entry))))
+                break;
+            cur = grown;
+        }
+        e = find_entry(old, nr_old, de->d_name);
+        if (e && entry_fresh(e, &st)) {
+            cur[count++] = *e;
+        } else {
+            read_entry(dirfd, de->d_name, &st, &cur[count++]);
+            reread++;
+        }
+    }
+    closedir(d);
+
+    qsort(cur, count, sizeof(lib_entry), entry_cmp);
+    lib->entries = cur;
+    lib->count = count;
+    lib->read = reread;
+    // a file that was removed only shows up as a shorter list
+    if (reread || count != nr_old)
+        save_index(lib, dirfd);
+    free(old);
+    close(dirfd);
+    return 0;
+}
+
+
+void lib_close(library *lib) {
+    free(lib->entries);
+    memset(lib, 0, sizeof(*lib));
+}
+
+
+const lib_entry *lib_lookup(library *lib, const char *path) {
+    char dir[sizeof(lib->dir) + LIBRARY_NAME_SZ];
+    const char *name = strrchr(path, '/');
+    struct stat st;
+    lib_entry *e;
+    int dirfd;
+
+    if (!lib->entries)
+        return NULL;
+    if (name) {
+        if ((size_t)(name - path) >= sizeof(dir))
+            return NULL;
+        memcpy(dir, path, name - path);
+        dir[name - path] = '\0';
+        if (name == path)
+            strcpy(dir, "/");
+        name++;
+    } else {
+        strcpy(dir, ".");
+        name = path;
+    }
+    if (stat(dir, &st) == -1 || st.st_dev != lib->dev || st.st_ino != lib->ino)
+        return NULL;
+    if (!(e = find_entry(lib->entries, lib->count, name)) || stat(path, &st) == -1)
+        return NULL;
+
+    if (!entry_fresh(e, &st)) {
+        dirfd = open(lib->dir, O_RDONLY | O_DIRECTORY);
+        if (dirfd == -1)
+            return NULL;
+        read_entry(dirfd, name, &st, e);
+        save_index(lib, dirfd);
+        close(dirfd);
+    }
+    return lib_is_song(e) ? e : NULL;
+}
+
+
+enum lib_access lib_access(const lib_entry *e, int uid, uint32_t region_mask) {
+    if (uid < 0 || uid >= MAX_SHARED_USERS || !(e->regions & region_mask))
+        return LIB_PREVIEW;
+    return (e->owner == uid || lib_shared_with(e, uid)) ? LIB_FULL : LIB_PREVIEW;
+}
@@ -0,0 +1,83 @@
+/*
+ * library.h
+ *
+ * An index of the songs in a directory, kept on disk next to them so that
+ * listing and querying a library does not have to open every song.
+ */
+
+#ifndef SRC_LIBRARY_H_
+#define SRC_LIBRARY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "miPod.h"
+
+#define LIBRARY_INDEX_NAME ".mipod_library" // the index file, inside the library directory
+#define LIBRARY_MAGIC 0x42494c4d // "MLIB"
+#define LIBRARY_VERSION 1
+#define LIBRARY_NAME_SZ 64 // the longest song file name that is indexed, including the nul
+
+// header of the index file, followed by <count> lib_entry sorted by name
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic; // LIBRARY_MAGIC
+    uint32_t version; // LIBRARY_VERSION
+    uint32_t count;
+    uint32_t entry_size; // sizeof(lib_entry), so a changed layout is rebuilt instead of misread
+} lib_file_header;
+
+// what the library knows about one file, taken from its drm header
+typedef struct __attribute__((__packed__)) { // sizeof() = 128
+    char name[LIBRARY_NAME_SZ]; // file name within the library directory, nul padded
+    int64_t mtime_sec; // the file's mtime and size when it was read. if either changes it is read again.
+    uint32_t mtime_nsec;
+    uint32_t size;
+    uint8_t song_id[SONGID_LEN];
+    uint8_t version; // DRM_VERSION_x, 0 if the file is not a song we can read
+    uint8_t owner; // owner uid
+    uint8_t pad[2];
+    uint32_t regions; // bitmap of the rids the song may be played in
+    uint32_t shared_users[USER_BITMAP_WORDS]; // bitmap of the uids the song is shared with
+    uint32_t duration_ms;
+    uint8_t reserved[12];
+} lib_entry;
+
+typedef struct {
+    char dir[256]; // the library directory
+    dev_t dev; // and its identity, to tell whether a path is in it
+    ino_t ino;
+    lib_entry *entries; // sorted by name
+    uint32_t count;
+    uint32_t read; // headers read by the last refresh, the rest came from the index
+} library;
+
+// the access a user has to a song, see lib_access
+enum lib_access {
+    LIB_PREVIEW=0, // only the 30 second preview
+    LIB_FULL // the whole song
+};
+
+/*
+opens the library in <dir>, or refreshes the one that is open.
+the index on disk is loaded, every .drm file whose size or mtime has changed since is read again (its header only),
+and the index is written back if anything changed.
+returns 0 on success, -1 with errno set on failure.
+*/
+int lib_open(library *lib, const char *dir);
+
+// frees the in-memory index
+void lib_close(library *lib);
+
+/*
+finds the entry of the song at <path>, if <path> is in the library. the entry is refreshed first if the file has
+changed since it was indexed.
+returns NULL if <path> is not an indexed song of the library.
+*/
+const lib_entry *lib_lookup(library *lib, const char *path);
+
+// the access user <uid> gets to <e> on a device provisioned for <region_mask>
+enum lib_access lib_access(const lib_entry *e, int uid, uint32_t region_mask);
+
+#define lib_is_song(e) ((e)->version != 0)
+#define lib_shared_with(e, uid) ((e)->shared_users[(uid) >> 5] & (1u << ((uid) & 31)))
+
+#endif /* SRC_LIBRARY_H_ */
@@ -5,6 +5,8 @@
 
 
 #include "miPod.h"
+#include "library.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <sys/mman.h>
@@ -15,10 +17,29 @@
 #include <errno.h>
 #include <linux/gpio.h>
 #include <string.h>
+#include <strings.h>
 #include <stddef.h>
+#include <poll.h>
+#include <time.h>
 
 
 volatile mipod_buffer *mipod_in;
+volatile mipod_song_slot *mipod_next;
+
+// the song being streamed into a slot while it plays, see mipod_buffer.ring_head
+struct {
+    int fd; // -1 if no song is streamed
+    char *ring; // where the segments go, right after the header
+    uint32_t slots, stride, nr_segments, hdr_size;
+    uint32_t head; // the next segment to write
+} stream = { .fd = -1 };
+
+// the songs of the directory opened with "library", see library.h
+library lib;
+
+// what the DRM reported about itself at startup, used to name the ids in song headers
+mipod_query_data device;
+int current_uid = -1; // the logged in user, -1 if nobody is
 
 
 //////////////////////// UTILITY FUNCTIONS ////////////////////////
@@ -29,8 +50,20 @@ void send_command(int operation) {
     memcpy((void*)&mipod_in->operation, &operation, 1);
 
     //trigger gpio interrupt
+    trace_begin(TRACE_DOORBELL, operation);
     system("devmem 0x41200000 32 0");
     system("devmem 0x41200000 32 1");
+    trace_end(TRACE_DOORBELL, operation);
+}
+
+
+// waits for the DRM to pick up the command it was just sent, and to complete it
+// our clock is published all the while, so the DRM's trace events get fine grained timestamps
+void wait_for_drm(int operation) {
+    trace_begin(TRACE_WAIT, operation);
+    while (mipod_in->operation == MIPOD_STOP) trace_tick(); // wait for DRM to start working
+    while (mipod_in->status == STATE_WORKING) trace_tick(); // wait for DRM to finish
+    trace_end(TRACE_WAIT, operation);
 }
 
 
@@ -49,8 +82,12 @@ void print_help() {
     mp_printf("  login <username> <pin>: log on to a miPod account (must be logged out)\r\n");
     mp_printf("  logout: log off of a miPod account (must be logged in)\r\n");
     mp_printf("  query <song.drm>: display information about the song\r\n");
-    mp_printf("  share <song.drm> <username>: share the song with the specified user\r\n");
-    mp_printf("  play <song.drm>: play the song\r\n");
+    mp_printf("  share <song.drm> <username> [username ...]: share the song with the specified users\r\n");
+    mp_printf("  library <dir>: index the songs in the directory, or refresh the index\r\n");
+    mp_printf("  ls [username]: list the songs in the library and what the user may play of them\r\n");
+    mp_printf("  search <text>: list the songs in the library whose name or owner contains the text\r\n");
+    mp_printf("  trace <file.json>: write what miPod and the DRM did since the last trace, for chrome://tracing\r\n");
+    mp_printf("  play <song.drm> [next.drm]: play the song, optionally followed by another one\r\n");
     mp_printf("  digital_out <song.drm>: play the song to digital out\r\n");
     mp_printf("  exit: exit miPod\r\n");
     mp_printf("  help: display this message\r\n");
@@ -66,13 +103,52 @@ void print_playback_help() {
     mp_printf("  restart: restart the song\r\n");
     mp_printf("  ff: fast forwards 5 seconds(unsupported)\r\n");
     mp_printf("  rw: rewind 5 seconds (unsupported)\r\n");
+    mp_printf("  next <song.drm>: play the song right after the current one\r\n");
     mp_printf("  help: display this message\r\n");
 }
 
 
+// the name of <uid>, as the DRM reported it at startup
+const char *user_name(int uid) {
+    if (uid < 0 || uid >= MAX_SHARED_USERS || !device.user_names[uid][0])
+        return "<unknown user>";
+    return device.user_names[uid];
+}
+
+
+// the uid of <username>, -1 if the DRM does not know it
+int user_id(const char *username) {
+    for (int uid = 0; uid < MAX_SHARED_USERS; uid++)
+        if (device.user_names[uid][0] && !strncmp(device.user_names[uid], username, UNAME_SIZE))
+            return uid;
+    return -1;
+}
+
+
+// milliseconds since <start>, for timing the library commands
+double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+
+// whether <text> occurs in <s>, ignoring case
+int contains_nocase(const char *s, const char *text) {
+    size_t len = strlen(text);
+
+    for (; *s; s++)
+        if (!strncasecmp(s, text, len))
+            return 1;
+    return !len;
+}
+
+
 // loads a file into the song buffer with the associate
+// <room> is the size of the shared memory at <digital_data>, MAX_SONG_SZ or SONG_SLOT_SZ for a playlist slot
 // returns the size of the file or 0 on error
-size_t load_file(char *fname, mipod_digital_data *digital_data) {
+size_t load_file(char *fname, mipod_digital_data *digital_data, size_t room) {
     mipod_play_data * song_buf;
     // char *song_buf;
     int fd;
@@ -88,13 +164,21 @@ size_t load_file(char *fname, mipod_digital_data *digital_data) {
         mp_printf("Failed to stat file!\r\n");
         return 0;
     }
+    if (sb.st_size > room - offsetof(mipod_digital_data, play_data)) {
+        mp_printf("Song file is too large to load whole!\r\n");
+        close(fd);
+        return 0;
+    }
 
+    trace_begin(TRACE_LOAD, digital_data != &mipod_in->digital_data);
     ssize_t readValue = read(fd, &(digital_data->play_data), sb.st_size);
+    trace_end(TRACE_LOAD, digital_data != &mipod_in->digital_data);
     if (readValue == -1) {
         close(fd);
         return 0;
     }
-    digital_data->wav_size = digital_data->play_data.drm.wavdata.chunk_size - 44 + 8;
+    digital_data->wav_size = drm_wavdata(&digital_data->play_data.drm)->chunk_size - 44 + 8;
+    digital_data->ring_slots = 0;
     
     close(fd);
 
@@ -103,6 +187,108 @@ size_t load_file(char *fname, mipod_digital_data *digital_data) {
 }
 
 
+// stops streaming the current song
+void close_stream() {
+    if (stream.fd == -1)
+        return;
+    close(stream.fd);
+    stream.fd = -1;
+}
+
+
+// writes as many segments of the streamed song as the ring has room for
+// if the DRM has seeked, the ring is refilled from where it continues
+void stream_refill() {
+    uint32_t seek;
+    ssize_t got;
+
+    if (stream.fd == -1)
+        return;
+
+    seek = mipod_in->ring_seek;
+    if (mipod_in->ring_ack != seek) {
+        stream.head = mipod_in->ring_tail;
+        mipod_in->ring_head = stream.head;
+        __sync_synchronize(); // the DRM may only see the ack once the new head is out
+        mipod_in->ring_ack = seek;
+    }
+
+    while (stream.head < stream.nr_segments && stream.head - mipod_in->ring_tail < stream.slots) {
+        trace_begin(TRACE_REFILL, stream.head);
+        got = pread(stream.fd, stream.ring + ring_segment_offset(stream.head, stream.slots, stream.stride), stream.stride,
+                    stream.hdr_size + (off_t)stream.head * stream.stride);
+        trace_end(TRACE_REFILL, stream.head);
+        if (got <= 0) {
+            mp_printf("Failed to read song segment %u!\r\n", stream.head);
+            close_stream();
+            return;
+        }
+        __sync_synchronize(); // the segment has to be out before the head that covers it
+        if (mipod_in->ring_ack != mipod_in->ring_seek)
+            return; // the DRM seeked while we were reading, start over on the next call
+        mipod_in->ring_head = ++stream.head;
+    }
+}
+
+
+// opens a song to be streamed into <digital_data> while it plays, instead of loading all of it
+// only the header and a ring of MIPOD_RING_SZ worth of segments are kept in shared memory, so songs of any length
+// play from the same footprint. the ring is filled before returning.
+// returns the ring size or 0 on error
+size_t open_stream(char *fname, mipod_digital_data *digital_data) {
+    drm_header *drm = &digital_data->play_data.drm;
+    int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1){
+        mp_printf("Song file does not exist!\r\n");
+        return 0;
+    }
+
+    // this reads a little past a v2 header, into the ring that is filled below anyway
+    if (read(fd, drm, sizeof(drm_header)) < (ssize_t)drm_header_size(drm) || !drm_first_segment_size(drm)) {
+        mp_printf("Failed to read song header!\r\n");
+        close(fd);
+        return 0;
+    }
+    digital_data->wav_size = drm_wavdata(drm)->chunk_size - 44 + 8;
+
+    close_stream();
+    stream.fd = fd;
+    stream.hdr_size = drm_header_size(drm);
+    stream.ring = (char *)drm + stream.hdr_size;
+    stream.stride = drm_first_segment_size(drm);
+    stream.nr_segments = drm_nr_segments(drm);
+    stream.slots = MIPOD_RING_SZ / stream.stride;
+    if (stream.slots > stream.nr_segments)
+        stream.slots = stream.nr_segments;
+    if (!stream.slots)
+        stream.slots = 1;
+    stream.head = 0;
+
+    digital_data->ring_slots = stream.slots;
+    mipod_in->ring_head = mipod_in->ring_tail = 0;
+    mipod_in->ring_ack = mipod_in->ring_seek;
+    stream_refill();
+
+    mp_printf("Streaming song through shared buffer (%uB ring)\r\n", stream.slots * stream.stride);
+    return stream.slots * stream.stride;
+}
+
+
+// reads a line of input, keeping the streamed song topped up while we wait for it
+char *read_input(char *buf, int size) {
+    struct pollfd in = { .fd = STDIN_FILENO, .events = POLLIN };
+
+    // the DRM stamps its trace events with our clock, so it keeps ticking while a song plays
+    while (poll(&in, 1, TRACE_TICK_MS) == 0) {
+        trace_tick();
+        stream_refill();
+    }
+    return fgets(buf, size, stdin);
+}
+
+
 //////////////////////// COMMAND FUNCTIONS ////////////////////////
 
 
@@ -120,12 +306,12 @@ void login(char *username, char *pin) {
     strncpy((void*)mipod_in->login_data.name, username, UNAME_SIZE);
     strncpy((void*)mipod_in->login_data.pin, pin, PIN_SIZE);
     send_command(MIPOD_LOGIN);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start working
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to dump file
+    wait_for_drm(MIPOD_LOGIN);
     if (mipod_in->status == STATE_FAILED) {
         mp_printf("Login Failed\r\n");
         return;
     }
+    current_uid = user_id(username);
 }
 
 
@@ -133,8 +319,8 @@ void login(char *username, char *pin) {
 void logout() {
     // drive DRM
     send_command(MIPOD_LOGOUT);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start working
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to dump file
+    wait_for_drm(MIPOD_LOGOUT);
+    current_uid = -1;
     return;
 }
 
@@ -144,8 +330,7 @@ void logout() {
 void query_player() {
     // drive DRM
     send_command(MIPOD_QUERY);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start working
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to dump file
+    wait_for_drm(MIPOD_QUERY);
 
     mp_printf("Regions: %s", q_region_lookup(mipod_in->query_data, 0));
     if (mipod_in->query_data.users_list) {
@@ -173,53 +358,101 @@ void query_player() {
         }
     }
     printf("\r\n"); 
+
+    // keep the names, the shared buffer is reused by every other command
+    memcpy(&device, (void*)&mipod_in->query_data, sizeof(device));
+}
+
+
+// answers a song query from the library index, without loading the song
+void query_entry(const lib_entry *e) {
+    int count = 0;
+
+    mp_printf("Song Owner: %s\r\n", user_name(e->owner));
+    mp_printf("Regions: ");
+    for (int rid = 0; rid < MAX_SHARED_REGIONS; rid++)
+        if (e->regions & (1u << rid))
+            printf(count++ ? ", %s" : "%s", device.region_names[rid][0] ? device.region_names[rid] : "<unknown region>");
+    printf("\r\n");
+
+    count = 0;
+    mp_printf("Shared Users: ");
+    for (int uid = 0; uid < MAX_SHARED_USERS; uid++)
+        if (lib_shared_with(e, uid))
+            printf(count++ ? ", %s" : "%s", user_name(uid));
+    printf(count ? "\r\n" : "No Shared Users\r\n");
 }
 
 
 // queries the DRM about a song
 void query_song(char *song_name) {
+    const lib_entry *e;
+
+    // songs in the library are answered from its index
+    if (song_name && (e = lib_lookup(&lib, song_name))) {
+        query_entry(e);
+        return;
+    }
+
     // load the song into the shared buffer
-    if (!load_file(song_name, &mipod_in->digital_data)) {
+    if (!load_file(song_name, &mipod_in->digital_data, MAX_SONG_SZ)) {
         mp_printf("Failed to load song!\r\n");
         return;
     }
 
     send_command(MIPOD_QUERY_SONG);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start working
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to finish
+    wait_for_drm(MIPOD_QUERY_SONG);
 }
 
 
-// attempts to share a song with a user
-void share_song(char *song_name, char *username) {
-    int fd;
-    unsigned int length = sizeof(drm_header);
+// attempts to share a song with up to MAX_SHARE_TARGETS users in one go
+void share_song(char *song_name, char **usernames, int count) {
+    int fd, i;
+    unsigned int length;
     ssize_t wrote, written = 0;
 
-    if (!username) {
+    if (!song_name || !count) {
         mp_printf("Need song name and username\r\n");
         print_help();
         return;
     }
+    if (count > MAX_SHARE_TARGETS) {
+        mp_printf("Can only share with %d users at a time\r\n", MAX_SHARE_TARGETS);
+        return;
+    }
 
     // load the song into the shared buffer
-    if (!load_file(song_name,(void*)&mipod_in->digital_data)) {
+    if (!load_file(song_name, (void*)&mipod_in->digital_data, MAX_SONG_SZ)) {
         mp_printf("Failed to load song!\r\n");
         return;
     }
 
-    strncpy((char *)mipod_in->shared_user, username,UNAME_SIZE);
+    memset((void *)mipod_in->shared_users, 0, sizeof(mipod_in->shared_users));
+    for (i = 0; i < count; i++)
+        strncpy((char *)mipod_in->shared_users[i], usernames[i], UNAME_SIZE - 1);
+    mipod_in->share_count = count;
 
     // drive DRM
     send_command(MIPOD_SHARE);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start sorking
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to share song
+    wait_for_drm(MIPOD_SHARE);
+
+    for (i = 0; i < count; i++) {
+        switch (mipod_in->share_result[i]) {
+            case SHARE_OK: mp_printf("Shared with %s\r\n", usernames[i]); break;
+            case SHARE_ALREADY: mp_printf("Already shared with %s\r\n", usernames[i]); break;
+            case SHARE_BADUSER: mp_printf("Invalid user %s\r\n", usernames[i]); break;
+            default: break;
+        }
+    }
   
     if (mipod_in->status == STATE_FAILED) {
         mp_printf("Share rejected\r\n");
         return;
     }
 
+    // only the header changes, in whichever format the song uses
+    length = drm_header_size(&mipod_in->digital_data.play_data.drm);
+
     // open output file
     fd = open(song_name, O_WRONLY);
     if (fd == -1){
@@ -242,39 +475,96 @@ void share_song(char *song_name, char *username) {
 }
 
 
+// the shared memory slot a song is played from, see mipod_buffer.play_slot
+mipod_digital_data *song_slot(uint32_t slot) {
+    return (mipod_digital_data *)(slot ? &mipod_next->digital_data : &mipod_in->digital_data);
+}
+
+
+// loads a song into the slot the DRM is not playing from, so it can continue
+// into it without a gap once the current song ends
+// returns 1 if the song was staged
+int stage_next_song(char *song_name, char *staged_name) {
+    if (!song_name) {
+        mp_printf("Need a song name\r\n");
+        return 0;
+    }
+    if (mipod_in->next_state == NEXT_STAGED || mipod_in->next_state == NEXT_READY) {
+        mp_printf("A song is already queued\r\n");
+        return 0;
+    }
+
+    if (!load_file(song_name, song_slot(!mipod_in->play_slot), SONG_SLOT_SZ)) {
+        mp_printf("Failed to load song!\r\n");
+        return 0;
+    }
+    strncpy(staged_name, song_name, USR_CMD_SZ);
+    mipod_in->next_state = NEXT_STAGED;
+    return 1;
+}
+
+
 // plays a song and enters the playback command loop
-int play_song(char *song_name) {
+int play_song(char *song_name, char *next_name) {
     char usr_ops[USR_CMD_SZ + 1], *ops = NULL, *arg1 = NULL, *arg2 = NULL;
+    char cur_name[USR_CMD_SZ + 1], staged_name[USR_CMD_SZ + 1];
+    uint32_t cur_slot = 0;
 
-    // load song into shared buffer
-    if (!load_file(song_name, (void*)&mipod_in->digital_data)) {
+    if (!song_name) {
+        mp_printf("Need a song name\r\n");
+        return 0;
+    }
+    strncpy(cur_name, song_name, USR_CMD_SZ);
+    cur_name[USR_CMD_SZ] = staged_name[USR_CMD_SZ] = '\0';
+    song_name = cur_name;
+
+    // stream the song into the shared buffer, the DRM frees ring slots as it goes
+    mipod_in->play_slot = cur_slot;
+    mipod_in->next_state = NEXT_NONE;
+    if (!open_stream(song_name, song_slot(cur_slot))) {
         mp_printf("Failed to load song!\r\n");
         return 0;
     }
+    if (next_name)
+        stage_next_song(next_name, staged_name);
 
     // drive the DRM
     send_command(MIPOD_PLAY);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start playing
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to start playing
+    wait_for_drm(MIPOD_PLAY);
 
     // play loop
     while(1) {
         // get a valid command
         do {
             print_prompt_msg(song_name);
-            fgets(usr_ops, USR_CMD_SZ, stdin);
+            fflush(stdout);
+            read_input(usr_ops, USR_CMD_SZ);
 
             // exit playback loop if DRM has finished song
             if (mipod_in->operation == MIPOD_STOP) {
                 mp_printf("Song finished\r\n");
+                close_stream();
                 return 0;
             }
 
             if (mipod_in->status == STATE_FAILED)
             {
                 mp_printf("Play song failed.\r\n");
+                close_stream();
                 return -1;
             }
+
+            // the DRM moved on to the queued song, which was loaded whole
+            if (mipod_in->play_slot != cur_slot) {
+                close_stream();
+                cur_slot = mipod_in->play_slot;
+                strcpy(cur_name, staged_name);
+                mp_printf("Now playing %s\r\n", song_name);
+            }
+            if (mipod_in->next_state == NEXT_FAILED) {
+                mp_printf("Queued song %s was rejected\r\n", staged_name);
+                mipod_in->next_state = NEXT_NONE;
+            }
         } while (strlen(usr_ops) < 2);
 
         // parse and handle command
@@ -291,7 +581,7 @@ int play_song(char *song_name) {
             usleep(200000); // wait for DRM to print
         } else if (!strcmp(ops, "stop")) {
             send_command(MIPOD_STOP);
-            while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to start playing
+            while (mipod_in->status == STATE_WORKING) trace_tick(); // wait for DRM to stop
             break;
         } else if (!strcmp(ops, "restart")) {
             send_command(MIPOD_RESTART);
@@ -305,6 +595,9 @@ int play_song(char *song_name) {
             usleep(200000); // wait for DRM to print
             // mp_printf("Unsupported feature.\r\n\r\n");
             // print_playback_help();
+        } else if (!strcmp(ops, "next")) {
+            if (stage_next_song(arg1, staged_name))
+                mp_printf("Queued %s\r\n", staged_name);
         } else if (!strcmp(ops, "lyrics")) {
             mp_printf("Unsupported feature.\r\n\r\n");
             print_playback_help();
@@ -314,6 +607,7 @@ int play_song(char *song_name) {
         }
     }
 
+    close_stream();
     return 0;
 }
 
@@ -321,17 +615,22 @@ int play_song(char *song_name) {
 // turns DRM song into original WAV for digital output
 void digital_out(char *song_name) {
     char fname[64];
+    size_t size;
 
     // load file into shared buffer
-    if (!load_file(song_name, (void*)&mipod_in->digital_data)) {
+    if (!(size = load_file(song_name, (void*)&mipod_in->digital_data, MAX_SONG_SZ))) {
         mp_printf("Failed to load song!\r\n");
         return;
     }
+    // a coded song decodes into the next song slot, so it has to fit in front of it
+    if (drm_codec(&mipod_in->digital_data.play_data.drm) && size > SONG_SLOT_SZ - offsetof(mipod_digital_data, play_data)) {
+        mp_printf("Coded song file is too large for digital out!\r\n");
+        return;
+    }
 
     // drive DRM
     send_command(MIPOD_DIGITAL);
-    while (mipod_in->operation == MIPOD_STOP) continue; // wait for DRM to start working
-    while (mipod_in->status == STATE_WORKING) continue; // wait for DRM to dump file
+    wait_for_drm(MIPOD_DIGITAL);
 
     if (mipod_in->status == STATE_FAILED)
     {
@@ -339,6 +638,11 @@ void digital_out(char *song_name) {
         return;
     }
 
+    // the firmware writes the decrypted audio where the segments started, or for coded songs, which decode to
+    // more than the file, to the start of the next song slot
+    char *wav = drm_codec(&mipod_in->digital_data.play_data.drm) ? (char *)mipod_next->buf :
+                (char *)&mipod_in->digital_data.play_data.drm + drm_header_size(&mipod_in->digital_data.play_data.drm);
+
     // open digital output file
     int written = 0, wrote, length = mipod_in->digital_data.wav_size + 8;   // 44 for wav header, this 8???
     sprintf(fname, "%s.dout", song_name);
@@ -351,9 +655,9 @@ void digital_out(char *song_name) {
     // write song dump to file
     mp_printf("Writing song to file '%s' (%dB)\r\n", fname, length + 44);
     // write song header to file
-    write(fd, (char *)&mipod_in->digital_data.play_data.drm.wavdata, 44);
+    write(fd, (char *)drm_wavdata(&mipod_in->digital_data.play_data.drm), 44);
     while (written < length) {
-        wrote = write(fd, (char *)&mipod_in->digital_data.play_data.filedata[0] + written, length - written);
+        wrote = write(fd, wav + written, length - written);
         if (wrote == -1) {
             mp_printf("Error in writing file! Error = %d \r\n", errno);
             return;
@@ -364,6 +668,69 @@ void digital_out(char *song_name) {
     mp_printf("Finished writing file\r\n");
 }
 
+// opens the song library in <dir>, or refreshes it
+void open_library(char *dir) {
+    struct timespec start;
+
+    if (!dir) {
+        mp_printf("No library directory given\r\n");
+        print_help();
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (lib_open(&lib, dir) == -1) {
+        mp_printf("Failed to open library! Error = %d\r\n", errno);
+        return;
+    }
+    mp_printf("Library '%s': %u files, %u headers read (%.1fms)\r\n", lib.dir, lib.count, lib.read, elapsed_ms(&start));
+}
+
+
+// lists the songs of the library whose name or owner contains <text>, all of them if <text> is NULL.
+// if <uid> is a user, each song says whether the user may play all of it or only the preview.
+void list_songs(const char *text, int uid) {
+    struct timespec start;
+    const lib_entry *e;
+    uint32_t shown = 0, secs;
+
+    if (!lib.entries) {
+        mp_printf("No library open, use library <dir>\r\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (e = lib.entries; e < lib.entries + lib.count; e++) {
+        if (!lib_is_song(e))
+            continue;
+        if (text && !contains_nocase(e->name, text) && !contains_nocase(user_name(e->owner), text))
+            continue;
+        secs = (e->duration_ms + 500) / 1000;
+        mp_printf("%-32s %3u:%02u  %-15s %s\r\n", e->name, secs / 60, secs % 60, user_name(e->owner),
+                  uid < 0 ? "" : lib_access(e, uid, device.region_mask) == LIB_FULL ? "full" : "preview");
+        shown++;
+    }
+    mp_printf("%u of %u songs (%.1fms)\r\n", shown, lib.count, elapsed_ms(&start));
+}
+
+
+// writes the trace events since the last dump to <fname>
+void dump_trace(char *fname) {
+    int n;
+
+    if (!fname) {
+        mp_printf("No trace file given\r\n");
+        print_help();
+        return;
+    }
+    if ((n = trace_dump(fname)) < 0) {
+        mp_printf("Failed to write trace! Error = %d\r\n", errno);
+        return;
+    }
+    mp_printf("Wrote %d trace events to '%s'\r\n", n, fname);
+}
+
+
 //////////////////////// MAIN ////////////////////////
 
 
@@ -380,7 +747,9 @@ int main(int argc, char** argv)
         mp_printf("MMAP Failed! Error = %d\r\n", errno);
         return -1;
     }
-    memset(mipod_in, 0, sizeof(mipod_buffer));
+    mipod_next = &mipod_in->next;
+    memset((void *)mipod_in, 0, offsetof(mipod_buffer, trace));
+    trace_init(&mipod_in->trace);
     mp_printf("Command channel open at %p (%dB)\r\n", mipod_in, sizeof(mipod_buffer));
 
     // dump player information before command loop
@@ -406,13 +775,32 @@ int main(int argc, char** argv)
         	query_song(arg1);
         } else if (!strcmp(ops, "play")) {
             // break if exit was commanded in play loop
-            if (play_song(arg1) < 0) {
+            if (play_song(arg1, arg2) < 0) {
                 break;
             }
         } else if (!strcmp(ops, "digital_out")) {
         	digital_out(arg1);
         } else if (!strcmp(ops, "share")) {
-            share_song(arg1, arg2);
+            // every remaining word is another user to share with
+            char *names[MAX_SHARE_TARGETS + 1];
+            int nr_names = 0;
+            for (char *name = arg2; name && nr_names <= MAX_SHARE_TARGETS; name = strtok(NULL, " \r\n"))
+                names[nr_names++] = name;
+            share_song(arg1, names, nr_names);
+        } else if (!strcmp(ops, "library")) {
+            open_library(arg1);
+        } else if (!strcmp(ops, "ls")) {
+            if (arg1 && user_id(arg1) < 0)
+                mp_printf("Unknown user '%s'\r\n", arg1);
+            else
+                list_songs(NULL, arg1 ? user_id(arg1) : current_uid);
+        } else if (!strcmp(ops, "search")) {
+            if (arg1)
+                list_songs(arg1, current_uid);
+            else
+                print_help();
+        } else if (!strcmp(ops, "trace")) {
+            dump_trace(arg1);
         } else if (!strcmp(ops, "exit")) {
             mp_printf("Exiting...\r\n");
             break;
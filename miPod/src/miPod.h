@@ -11,7 +11,9 @@
 #include <stdint.h>
 
 #define TOTAL_USERS 64
-#define MAX_SONG_SZ (1<<25) //33554432 == 32 mib
+#define SHARED_DDR_SIZE (1<<25) //all of /dev/uio0 there is to map. mipod_buffer has to fit in it.
+#define MAX_SONG_SZ ((1<<25) - (1<<16)) //the largest file we load whole. the rest of SHARED_DDR_SIZE holds the control words and the trace.
+#define SONG_SLOT_SZ (MAX_SONG_SZ / 2) //each of the two slots a playlist alternates between, see mipod_song_slot
 
 #define SONGID_LEN 16
 #define REGION_NAME_SZ 64
@@ -24,8 +26,16 @@
 #define REGION_NAME_SZ 64
 #define MAX_QUERY_REGIONS MAX_SHARED_REGIONS /*TOTAL_REGIONS*/
 
+// drm file format versions
+#define DRM_VERSION_1 1 //original format: byte-per-entry acls, 84 byte segment trailers
+#define DRM_VERSION_2 2 //compact format: bitmap acls, 28 byte segment trailers
+#define DRM_MAGIC_V2 0x324d5244 //"DRM2". v1 headers start with the ascii song id, so they never match.
+#define USER_BITMAP_WORDS (MAX_SHARED_USERS / 32)
+#define MAX_SHARE_TARGETS 16 //the most users a single share command can take
+
 // miPod constants
 #define USR_CMD_SZ 100
+#define MIPOD_RING_SZ (1<<23) //the shared memory a song is streamed through while it plays, see mipod_buffer.ring_head
 
 // printing utility
 #define MP_PROMPT "mP> "
@@ -82,6 +92,33 @@ typedef struct __attribute__((__packed__)) { //sizeof() = 297
     uint8_t owner_sig[HMAC_SIG_SIZE]; //a signature (using the owner's private key) for all preceeding data. resets whenever new user is shared with.
 } drm_header;
 
+typedef struct __attribute__((__packed__)) { //sizeof() = 220
+    uint32_t magic; //DRM_MAGIC_V2
+    uint8_t version; //DRM_VERSION_2
+    uint8_t ownerID;
+    uint8_t segment_units; //the data size of a full segment, in 128 byte units
+    uint8_t seg_format; //the segment mac algorithm (0 hmac-sha1, 1 keyed blake2s) | the codec << 4 (0 pcm, 1 lpc)
+    uint8_t song_id[SONGID_LEN];
+    uint32_t regions; //bitmap, bit <rid> is set if the song may be played in region <rid>.
+    //song metadata
+    uint32_t len_250ms;
+    uint32_t nr_segments;
+    uint32_t first_segment_size;
+    wav_header wavdata;
+    //validation and sharing
+    uint8_t mp_sig[HMAC_SIG_SIZE];
+    uint32_t shared_users[USER_BITMAP_WORDS]; //bitmap, bit <uid> is set if the owner has shared the song with <uid>.
+    uint8_t owner_sig[HMAC_SIG_SIZE];
+} drm_header_v2;
+
+// the on-disk header size and wav header of a loaded song, in either format
+#define drm_is_v2(drm) (((drm_header_v2 *)(drm))->magic == DRM_MAGIC_V2)
+#define drm_header_size(drm) (drm_is_v2(drm) ? sizeof(drm_header_v2) : sizeof(drm_header))
+#define drm_wavdata(drm) (drm_is_v2(drm) ? &((drm_header_v2 *)(drm))->wavdata : &((drm_header *)(drm))->wavdata)
+#define drm_nr_segments(drm) (drm_is_v2(drm) ? ((drm_header_v2 *)(drm))->nr_segments : ((drm_header *)(drm))->nr_segments)
+#define drm_first_segment_size(drm) (drm_is_v2(drm) ? ((drm_header_v2 *)(drm))->first_segment_size : ((drm_header *)(drm))->first_segment_size)
+#define drm_codec(drm) (drm_is_v2(drm) ? ((drm_header_v2 *)(drm))->seg_format >> 4 : 0) //0 if the audio is raw pcm
+
 struct segment_trailer {
     uint8_t id[SONGID_LEN];
     uint32_t idx;
@@ -90,6 +127,12 @@ struct segment_trailer {
     char _pad_[40]; //do not use this. for cryptographic padding purposes only.
 };
 
+struct segment_trailer_v2 {
+    uint32_t idx;
+    uint32_t next_segment_size;
+    uint8_t sig[20]; //mac of data || idx || next_segment_size || song id
+};
+
 // struct {
 //     char a[0-!(sizeof(struct segment_trailer) == 128 && CIPHER_BLOCKSIZE == 64)]; //if the segment trailer requirements fail, this will break.
 // };
@@ -118,7 +161,24 @@ enum mipod_state {
     STATE_SUCCESS, //indicates an operation has completed successfully
     STATE_FAILED, //indicates an operation has failed
     STATE_PLAYING, //indicates that the firmware has started playing audio
-	STATE_PAUSED
+	STATE_PAUSED,
+    STATE_REJECTED //a command other than a playback one was sent while a song plays. it was not run, the song goes on.
+};
+
+// per-user outcome of a share command, see mipod_buffer.share_result
+enum share_result {
+    SHARE_NOT_DONE=0, //the command failed before this user was looked at
+    SHARE_OK, //the song is now shared with the user
+    SHARE_ALREADY, //the song was already shared with the user
+    SHARE_BADUSER //the user does not exist on this device, or owns the song
+};
+
+// playlist handshake for gapless playback, see mipod_buffer.next_state
+enum mipod_next_state {
+    NEXT_NONE=0, //nothing staged. set by us before play, and by the DRM once it has switched to the staged song
+    NEXT_STAGED, //set by us once the next song is loaded into the free slot
+    NEXT_READY, //set by the DRM once the staged header has been verified
+    NEXT_FAILED //set by the DRM if the staged song is invalid
 };
 
 /*
@@ -144,6 +204,10 @@ typedef struct {
     char song_regions[MAX_SHARED_REGIONS * REGION_NAME_SZ];
     // uint32_t rids[MAX_QUERY_REGIONS]; //holds all valid region IDS. the actual region strings should be stored client-side.
     char users_list[TOTAL_USERS][UNAME_SIZE]; //holds all valid users.
+    //every user and region the device knows by id, "" for unused ids. used to name the acls in song headers.
+    char user_names[MAX_SHARED_USERS][UNAME_SIZE];
+    char region_names[MAX_SHARED_REGIONS][REGION_NAME_SZ];
+    uint32_t region_mask; //the rids the device is provisioned for
     /*
     Initial boot output :
         mP> Regions: USA, Canada, Mexico\r\n` `mP> Authorized users: alice, bob, charlie, donna\r\n
@@ -155,6 +219,7 @@ typedef struct {
 
 typedef struct __attribute__((__packed__)) {
     uint32_t wav_size; //OUT: the used size. will always be <= the file size.
+    uint32_t ring_slots; //IN, 0 if the whole file is loaded. otherwise the song is streamed, see mipod_buffer.ring_head.
     // drm_header drm;
     // uint8_t filedata[]; //on input, the file that we want to write out. on output, the raw WAV file.
     mipod_play_data play_data;
@@ -165,10 +230,68 @@ typedef struct __attribute__((__packed__)) {
     drm_header drm; //we don't actually need anything but the file header for this.
 } mipod_share_data;
 
+// trace events both sides record for the client to dump, see mipod_buffer.trace
+#define TRACE_EVENTS 1024 //per processor
+#define TRACE_TICK_MS 1 //how often the client publishes its clock while a song plays, see mipod_trace
+enum trace_id {
+    TRACE_DOORBELL=0, //the client ringing the gpio interrupt, arg is the operation
+    TRACE_WAIT, //the client waiting for a command to complete, arg is the operation
+    TRACE_LOAD, //the client reading a song into shared memory, arg is the slot
+    TRACE_REFILL, //the client streaming a segment into the ring, arg is its index
+    TRACE_COMMAND, //the firmware handling a command, from picking it up to completing it. arg is the operation.
+    TRACE_HEADER, //the firmware verifying a song header
+    TRACE_SEGMENT, //the firmware copying in and authenticating a segment, arg is its index
+    TRACE_FIRST_DMA, //the firmware starting the first dma transfer of a play command
+    TRACE_FIRST_SAMPLE, //that transfer is done, ie the first audio is in the codec's fifo
+    TRACE_PLAYBACK, //the firmware playing a song, arg is its slot
+    NR_TRACE_IDS
+};
+enum trace_phase { //the "ph" of the event in a chrome trace
+    TRACE_BEGIN='B',
+    TRACE_END='E',
+    TRACE_INSTANT='i'
+};
+
+typedef struct __attribute__((__packed__)) { //sizeof() = 12
+    uint32_t ts; //microseconds on the client's clock, see mipod_trace.clock
+    uint16_t id; //enum trace_id
+    uint8_t ph; //enum trace_phase
+    uint8_t pad;
+    uint32_t arg;
+} trace_record;
+
+/*
+one ring of events per processor, each with a single writer. the firmware has no timer, so the client publishes its
+clock in <clock> whenever it waits on the firmware, and the firmware stamps its events with the last value it saw.
+*/
+typedef struct __attribute__((__packed__)) {
+    uint32_t clock; //IN, microseconds since the client started
+    uint32_t arm_head; //IN, the number of events the client has recorded. event i is in arm[i % TRACE_EVENTS].
+    uint32_t mb_head; //OUT, the same for the firmware's events
+    trace_record arm[TRACE_EVENTS];
+    trace_record mb[TRACE_EVENTS];
+} mipod_trace;
+
+// the next song of a playlist, staged while the current one plays. see mipod_buffer.play_slot.
+typedef volatile struct __attribute__((__packed__)) {
+    union {
+        mipod_digital_data digital_data;
+        char buf[SONG_SLOT_SZ];
+    };
+}mipod_song_slot;
+
 typedef volatile struct __attribute__((__packed__)) {
     uint32_t operation; //IN, the operation id from enum mipod_ops
     uint32_t status; //OUT, the completion status of the command. DO NOT read this field.
-    char shared_user[UNAME_SIZE];
+    uint32_t share_count; //IN, the number of names in shared_users
+    char shared_users[MAX_SHARE_TARGETS][UNAME_SIZE]; //IN, the users to share the song with
+    uint8_t share_result[MAX_SHARE_TARGETS]; //OUT, enum share_result for each of shared_users
+    uint32_t play_slot; //OUT, the slot the song being played is in. 0 is digital_data below, 1 is the mipod_song_slot.
+    uint32_t next_state; //IN/OUT, enum mipod_next_state
+    uint32_t ring_head; //IN, the segments of a streamed song before this one are in the ring
+    uint32_t ring_tail; //OUT, the first segment still needed. the ring slots of the ones before it may be refilled.
+    uint32_t ring_seek; //OUT, bumped when playback jumps to ring_tail. ring_head is not trusted until it is acked.
+    uint32_t ring_ack; //IN, set to ring_seek once ring_head has been moved to ring_tail
     union {
         mipod_login_data login_data;
         // struct mipod_play_data play_data;
@@ -176,7 +299,16 @@ typedef volatile struct __attribute__((__packed__)) {
       //  mipod_share_data share_data;
         mipod_digital_data digital_data;
         char buf[MAX_SONG_SZ];
+        struct __attribute__((__packed__)) {
+            char slot0[SONG_SLOT_SZ]; // digital_data, when it is slot 0 of a playlist
+            mipod_song_slot next; // slot 1. a song loaded whole outside of a playlist may run into it.
+        };
     };
+    mipod_trace trace; //IN/OUT, see mipod_trace. the client does not clear it at startup.
 }mipod_buffer;
+_Static_assert(sizeof(mipod_buffer) <= SHARED_DDR_SIZE, "the shared buffer does not fit the uio region");
+
+// a streamed song keeps its header and <ring_slots> full size segments in its slot. segment i is in slot i % ring_slots.
+#define ring_segment_offset(idx, slots, stride) ((size_t)((idx) % (slots)) * (stride))
 
 #endif /* SRC_MIPOD_H_ */
@@ -0,0 +1,139 @@
+/*
+ * trace.c
+ *
+ * The client's half of the cross processor trace, see trace.h.
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+static volatile mipod_trace *trace;
+static struct timespec epoch; // the trace clock counts microseconds from here
+static uint32_t dumped_arm, dumped_mb; // the heads of both rings at the last dump
+
+static const char *trace_names[NR_TRACE_IDS] = {
+    [TRACE_DOORBELL] = "doorbell",
+    [TRACE_WAIT] = "wait",
+    [TRACE_LOAD] = "load song",
+    [TRACE_REFILL] = "refill ring",
+    [TRACE_COMMAND] = "command",
+    [TRACE_HEADER] = "verify header",
+    [TRACE_SEGMENT] = "load segment",
+    [TRACE_FIRST_DMA] = "first dma",
+    [TRACE_FIRST_SAMPLE] = "first sample",
+    [TRACE_PLAYBACK] = "playback"
+};
+
+static const char *op_names[] = {
+    [MIPOD_PLAY] = "play",
+    [MIPOD_PAUSE] = "pause",
+    [MIPOD_RESUME] = "resume",
+    [MIPOD_STOP] = "stop",
+    [MIPOD_RESTART] = "restart",
+    [MIPOD_FORWARD] = "forward",
+    [MIPOD_REWIND] = "rewind",
+    [MIPOD_LOGIN] = "login",
+    [MIPOD_LOGOUT] = "logout",
+    [MIPOD_QUERY] = "query",
+    [MIPOD_QUERY_SONG] = "query song",
+    [MIPOD_DIGITAL] = "digital out",
+    [MIPOD_SHARE] = "share"
+};
+
+
+static uint32_t trace_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec - epoch.tv_sec) * 1000000 + (now.tv_nsec - epoch.tv_nsec) / 1000);
+}
+
+
+void trace_init(volatile mipod_trace *t) {
+    clock_gettime(CLOCK_MONOTONIC, &epoch);
+    trace = t;
+    trace->clock = 0;
+    dumped_arm = trace->arm_head;
+    dumped_mb = trace->mb_head;
+}
+
+
+void trace_tick(void) {
+    if (trace)
+        trace->clock = trace_now();
+}
+
+
+void trace_event(uint16_t id, uint8_t ph, uint32_t arg) {
+    volatile trace_record *rec;
+    uint32_t head;
+
+    if (!trace)
+        return;
+    head = trace->arm_head;
+    rec = &trace->arm[head % TRACE_EVENTS];
+    rec->ts = trace->clock = trace_now();
+    rec->id = id;
+    rec->ph = ph;
+    rec->arg = arg;
+    __sync_synchronize(); // the record has to be out before the head that covers it
+    trace->arm_head = head + 1;
+}
+
+
+// writes the events of one ring from <from> up to <head>. returns the new number of events written so far, <n>.
+static int dump_ring(FILE *f, volatile trace_record *ring, uint32_t from, uint32_t head, int tid, int n) {
+    trace_record rec;
+
+    if (head - from > TRACE_EVENTS) // the older ones have been overwritten
+        from = head - TRACE_EVENTS;
+    for (; from != head; from++) {
+        rec = *(trace_record *)&ring[from % TRACE_EVENTS];
+        if (rec.id >= NR_TRACE_IDS)
+            continue;
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%d", trace_names[rec.id], rec.ph,
+                rec.ts, tid);
+        if (rec.ph == TRACE_INSTANT)
+            fprintf(f, ",\"s\":\"t\"");
+        if ((rec.id == TRACE_DOORBELL || rec.id == TRACE_WAIT || rec.id == TRACE_COMMAND) &&
+            rec.arg < sizeof(op_names) / sizeof(op_names[0]))
+            fprintf(f, ",\"args\":{\"op\":\"%s\"}}", op_names[rec.arg]);
+        else
+            fprintf(f, ",\"args\":{\"arg\":%u}}", rec.arg);
+        n++;
+    }
+    return n;
+}
+
+
+int trace_dump(const char *path) {
+    uint32_t arm_head, mb_head;
+    int n = 0;
+    FILE *f;
+
+    if (!trace) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(f = fopen(path, "w")))
+        return -1;
+    arm_head = trace->arm_head;
+    mb_head = trace->mb_head;
+    __sync_synchronize(); // only read records the heads cover
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"miPod (arm)\"}},\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"DRM (microblaze)\"}}");
+    n = dump_ring(f, trace->arm, dumped_arm, arm_head, 1, n);
+    n = dump_ring(f, trace->mb, dumped_mb, mb_head, 2, n);
+    fprintf(f, "\n]}\n");
+    if (fclose(f))
+        return -1;
+
+    dumped_arm = arm_head;
+    dumped_mb = mb_head;
+    return n;
+}
@@ -0,0 +1,31 @@
+/*
+ * trace.h
+ *
+ * The client's half of the cross processor trace, see mipod_trace in miPod.h.
+ */
+
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <stdint.h>
+#include "miPod.h"
+
+// starts recording into <t>. events already in the rings, eg from an earlier run, are left out of the next dump.
+void trace_init(volatile mipod_trace *t);
+
+// publishes our clock, which is all the DRM has to stamp its events with. call it whenever we wait on the DRM.
+void trace_tick(void);
+
+// records an event in our ring
+void trace_event(uint16_t id, uint8_t ph, uint32_t arg);
+#define trace_begin(id, arg) trace_event((id), TRACE_BEGIN, (arg))
+#define trace_end(id, arg) trace_event((id), TRACE_END, (arg))
+
+/*
+writes the events of both rings recorded since the last dump to <path>, as chrome trace json
+(load it in chrome://tracing or https://ui.perfetto.dev).
+returns the number of events written, -1 with errno set on failure.
+*/
+int trace_dump(const char *path);
+
+#endif /* SRC_TRACE_H_ */
@@ -0,0 +1,225 @@
+/*
+ * library_test.c
+ *
+ * Tests the song library index (library.c) on a directory of synthetic
+ * songs, and times it.
+ *
+ * Each song is a v1 or v2 header followed by a little audio, with owner,
+ * regions, shared users and length derived from its number, so every entry
+ * can be checked against what was written. The test checks:
+ * - a cold scan reads every song and writes the index;
+ * - an unchanged refresh reads nothing;
+ * - only songs whose size or mtime changed are read again;
+ * - removed songs drop out;
+ * - files that are not songs are kept out of lookups;
+ * - lib_lookup refreshes a stale entry;
+ * - lib_access.
+ * It prints the cold scan, warm refresh and lookup times.
+ *
+ * usage: library_test [songs], 2000 by default.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "library.h"
+#include "test.h"
+
+#define BYTERATE 192000 // 48 kHz 16 bit stereo
+
+static char dir[] = "/tmp/library_test_XXXXXX";
+static char path[sizeof(dir) + LIBRARY_NAME_SZ];
+
+static const char *song_name(uint32_t i) {
+    static char name[LIBRARY_NAME_SZ];
+    snprintf(name, sizeof(name), "song%05u.drm", i);
+    return name;
+}
+
+static const char *song_path(const char *name) {
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return path;
+}
+
+// what song <i> says about itself
+static uint8_t owner_of(uint32_t i) { return i % MAX_SHARED_USERS; }
+static uint32_t regions_of(uint32_t i) { return (i * 2654435761u) | 1; }
+static uint32_t shared_word_of(uint32_t i, int w) { return (i * 40503u) ^ (w ? 0x12345678 : 0); }
+static uint32_t seconds_of(uint32_t i) { return 30 + i % 300; }
+static int is_v1(uint32_t i) { return i % 5 == 0; }
+
+static void fill_wav(wav_header *wav, uint32_t i) {
+    memcpy(wav->chunkID, "RIFF", 4);
+    memcpy(wav->format, "WAVE", 4);
+    wav->byterate = BYTERATE;
+    wav->chunk_size = seconds_of(i) * BYTERATE + 44 - 8;
+}
+
+// writes song <i> with <audio> bytes after its header to <name>, its own name if NULL
+static int write_song(uint32_t i, size_t audio, const char *name) {
+    static uint8_t buf[sizeof(drm_header) + 4096];
+    size_t len;
+    int fd, ok;
+
+    memset(buf, 0, sizeof(buf));
+    if (is_v1(i)) {
+        drm_header *h = (drm_header *)buf;
+        uint32_t r = regions_of(i);
+        int n = 0;
+        memset(h->song_id, i & 0xff, SONGID_LEN);
+        h->ownerID = owner_of(i);
+        // v1 lists region ids in bytes, padded with an id no device has
+        memset(h->regions, 0xff, sizeof(h->regions));
+        for (int b = 0; b < MAX_SHARED_REGIONS; b++)
+            if (r & (1u << b))
+                h->regions[n++] = b;
+        for (int u = 0; u < MAX_SHARED_USERS; u++)
+            h->shared_users[u] = (shared_word_of(i, u >> 5) >> (u & 31)) & 1;
+        fill_wav(&h->wavdata, i);
+        len = sizeof(drm_header);
+    } else {
+        drm_header_v2 *h = (drm_header_v2 *)buf;
+        h->magic = DRM_MAGIC_V2;
+        h->version = DRM_VERSION_2;
+        memset(h->song_id, i & 0xff, SONGID_LEN);
+        h->ownerID = owner_of(i);
+        h->regions = regions_of(i);
+        for (int w = 0; w < USER_BITMAP_WORDS; w++)
+            h->shared_users[w] = shared_word_of(i, w);
+        fill_wav(&h->wavdata, i);
+        len = sizeof(drm_header_v2);
+    }
+    fd = open(song_path(name ? name : song_name(i)), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    ok = write(fd, buf, len + audio) == (ssize_t)(len + audio);
+    return close(fd) || !ok ? -1 : 0;
+}
+
+static void check_entry(const lib_entry *e, uint32_t i) {
+    CHECK(e && !strcmp(e->name, song_name(i)), "song %u: no entry", i);
+    if (!e)
+        return;
+    CHECK(e->version == (is_v1(i) ? DRM_VERSION_1 : DRM_VERSION_2), "song %u: version %u", i, e->version);
+    CHECK(e->owner == owner_of(i), "song %u: owner %u", i, e->owner);
+    CHECK(e->regions == regions_of(i), "song %u: regions %08x", i, e->regions);
+    for (int w = 0; w < USER_BITMAP_WORDS; w++)
+        CHECK(e->shared_users[w] == shared_word_of(i, w), "song %u: shared users word %d %08x", i, w,
+              e->shared_users[w]);
+    CHECK(e->duration_ms == seconds_of(i) * 1000, "song %u: %u ms", i, e->duration_ms);
+}
+
+// overwrites the "RIFF" of a song's wav header
+static void break_wav(const char *name, int v1) {
+    int fd = open(song_path(name), O_WRONLY);
+
+    if (fd == -1 || pwrite(fd, "XXXX", 4, v1 ? offsetof(drm_header, wavdata) : offsetof(drm_header_v2, wavdata)) != 4)
+        printf("could not change %s\n", name);
+    close(fd);
+}
+
+static void remove_dir(void) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+
+    while (d && (de = readdir(d)))
+        if (de->d_name[0] != '.' || strlen(de->d_name) > 2)
+            unlink(song_path(de->d_name));
+    if (d)
+        closedir(d);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = argc > 1 ? (uint32_t)atoi(argv[1]) : 2000, i;
+    uint64_t t, cold_us, warm_us, lookup_ns;
+    struct timespec old[2] = { { 0, 0 }, { 1000000000, 0 } };
+    const lib_entry *e;
+    library lib;
+
+    memset(&lib, 0, sizeof(lib));
+    if (n < 10 || !mkdtemp(dir)) {
+        printf("usage: library_test [songs >= 10]\n");
+        return 1;
+    }
+    for (i = 0; i < n; i++)
+        if (write_song(i, i % 7 * 100, NULL)) {
+            printf("could not write %s: %s\n", path, strerror(errno));
+            remove_dir();
+            return 1;
+        }
+    // not songs: a header too short for either format, one without a wav header, and a file without .drm
+    close(open(song_path("short.drm"), O_WRONLY | O_CREAT, 0644));
+    write_song(n, 0, "nowav.drm");
+    break_wav("nowav.drm", is_v1(n));
+    write_song(n + 1, 0, "notes.txt");
+
+    // cold: no index yet, every header is read
+    t = test_us();
+    CHECK(!lib_open(&lib, dir), "lib_open: %s", strerror(errno));
+    cold_us = test_us() - t;
+    CHECK(lib.count == n + 2 && lib.read == n + 2, "cold scan: %u entries, %u read, want %u", lib.count, lib.read, n + 2);
+    CHECK(!access(song_path(LIBRARY_INDEX_NAME), F_OK), "no index was written");
+    for (i = 0; i < n; i++)
+        check_entry(lib_lookup(&lib, song_path(song_name(i))), i);
+    CHECK(!lib_lookup(&lib, song_path("short.drm")) && !lib_lookup(&lib, song_path("nowav.drm")),
+          "a file that is not a song was looked up");
+    CHECK(!lib_lookup(&lib, song_path("notes.txt")), "a file without .drm was indexed");
+    CHECK(!lib_lookup(&lib, "/tmp/song00001.drm"), "a song outside the library was looked up");
+
+    // warm: everything comes from the index
+    lib_close(&lib);
+    t = test_us();
+    CHECK(!lib_open(&lib, dir), "lib_open warm");
+    warm_us = test_us() - t;
+    CHECK(lib.count == n + 2 && lib.read == 0, "warm refresh: %u entries, %u read", lib.count, lib.read);
+    for (i = 0; i < n; i++)
+        check_entry(lib_lookup(&lib, song_path(song_name(i))), i);
+
+    // lookups of unchanged songs
+    t = test_us();
+    for (int rep = 0; rep < 4; rep++)
+        for (i = 0; i < n; i++)
+            e = lib_lookup(&lib, song_path(song_name(i)));
+    lookup_ns = (test_us() - t) * 1000 / (4 * n);
+
+    // one song grows, one gets a new mtime, one goes away: only the first two are read again
+    write_song(1, 4000, NULL);
+    utimensat(AT_FDCWD, song_path(song_name(2)), old, 0);
+    unlink(song_path(song_name(3)));
+    CHECK(!lib_open(&lib, dir), "lib_open after changes");
+    CHECK(lib.count == n + 1 && lib.read == 2, "refresh after changes: %u entries, %u read", lib.count, lib.read);
+    CHECK(!lib_lookup(&lib, song_path(song_name(3))), "a removed song was looked up");
+    e = lib_lookup(&lib, song_path(song_name(1)));
+    CHECK(e && e->size == sizeof(drm_header_v2) + 4000, "song 1: size %u after it grew", e ? e->size : 0);
+
+    // a lookup re-reads a song that changed behind the library's back
+    write_song(4, 0, NULL);
+    utimensat(AT_FDCWD, song_path(song_name(4)), old, 0);
+    e = lib_lookup(&lib, song_path(song_name(4)));
+    CHECK(e && e->mtime_sec == 1000000000, "lookup did not refresh a changed song");
+    lib_close(&lib);
+    CHECK(!lib_open(&lib, dir) && lib.read == 0, "the refreshed entry was not saved, %u read", lib.read);
+
+    // access: owner and shared users get all of it, in a region the song may be played in
+    e = lib_lookup(&lib, song_path(song_name(6)));
+    CHECK(e && lib_access(e, owner_of(6), regions_of(6)) == LIB_FULL, "the owner only gets a preview");
+    CHECK(e && lib_access(e, owner_of(6), ~regions_of(6)) == LIB_PREVIEW, "the owner plays outside the regions");
+    for (int u = 0; e && u < MAX_SHARED_USERS; u++)
+        if (u != owner_of(6))
+            CHECK(lib_access(e, u, regions_of(6)) == (lib_shared_with(e, u) ? LIB_FULL : LIB_PREVIEW),
+                  "user %d", u);
+    CHECK(e && lib_access(e, -1, ~0u) == LIB_PREVIEW && lib_access(e, MAX_SHARED_USERS, ~0u) == LIB_PREVIEW,
+          "nobody gets more than a preview");
+
+    lib_close(&lib);
+    remove_dir();
+    printf("library_test: %u songs, cold scan %.1f ms, warm refresh %.1f ms, lookup %.1f us\n", n, cold_us / 1e3,
+           warm_us / 1e3, lookup_ns / 1e3);
+    return test_done("library_test");
+}
@@ -0,0 +1,174 @@
+/*
+ * ring_soak.c
+ *
+ * Soak test of the segment ring a song is streamed through while it plays,
+ * see mipod_buffer.ring_head.
+ *
+ * The client side is miPod's own open_stream and stream_refill, linked in
+ * from main.c. The DRM side runs in a second thread and follows the
+ * firmware's playback_segment_ready, playback_segment_release and
+ * playback_seek. It takes segments in order and jumps to a random segment
+ * every so often, as ff, rw and restart do. Every segment in the song file
+ * is stamped with its index, so a segment that was overwritten while it
+ * was being copied, or that came from the wrong slot, shows up as a
+ * mismatch. The test also fails if either side stops making progress.
+ *
+ * usage: ring_soak [seconds], 2 by default. The request's soak was 7200.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "miPod.h"
+#include "test.h"
+
+#define NR_SEGMENTS 1000
+#define SEGMENT_DATA 32000 // a full segment
+#define STRIDE (SEGMENT_DATA + sizeof(struct segment_trailer_v2))
+#define STALL_US 1000000 // no progress for this long is a deadlock
+#define INGEST_PIECE 4096 // the firmware's segment copy gives the cpu away this often
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// the parts of miPod's main.c under test
+extern volatile mipod_buffer *mipod_in;
+size_t open_stream(char *fname, mipod_digital_data *digital_data);
+void stream_refill();
+void close_stream();
+
+static volatile int done;
+static volatile uint64_t fw_segments, fw_seeks, client_passes;
+static uint8_t copy[STRIDE]; // the firmware's segment_buffer
+
+// what the song file holds at byte <k> of segment <idx>
+static uint8_t stamp(uint32_t idx, uint32_t k) {
+    uint32_t x = (idx + 1) * 2654435761u + k * 40503u;
+    return (uint8_t)(x >> 24);
+}
+
+static int write_song(const char *path) {
+    drm_header_v2 hdr;
+    static uint8_t seg[STRIDE];
+    FILE *f = fopen(path, "wb");
+
+    if (!f)
+        return -1;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DRM_MAGIC_V2;
+    hdr.version = 2;
+    hdr.segment_units = SEGMENT_DATA / 128 + 1; // nothing reads it here
+    hdr.nr_segments = NR_SEGMENTS;
+    hdr.first_segment_size = STRIDE;
+    hdr.wavdata.chunk_size = NR_SEGMENTS * SEGMENT_DATA + 36;
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    for (uint32_t i = 0; i < NR_SEGMENTS; i++) {
+        for (uint32_t k = 0; k < STRIDE; k++)
+            seg[k] = stamp(i, k);
+        memcpy(seg, &i, sizeof(i));
+        fwrite(seg, STRIDE, 1, f);
+    }
+    return fclose(f);
+}
+
+// the firmware's playback_segment_ready
+static int segment_ready(uint32_t idx) {
+    return mipod_in->ring_ack == mipod_in->ring_seek && idx < mipod_in->ring_head;
+}
+
+// the firmware's playback_seek, as far as the ring is concerned
+static void seek(uint32_t idx) {
+    mipod_in->ring_tail = idx;
+    mipod_in->ring_seek++;
+}
+
+static void *firmware(void *arg) {
+    volatile mipod_digital_data *data = &mipod_in->digital_data;
+    uint32_t slots = data->ring_slots, idx = 0, got;
+    uint8_t *ring = (uint8_t *)&data->play_data.drm + sizeof(drm_header_v2);
+    uint64_t last = test_us();
+    unsigned int seed = 1;
+
+    while (!done) {
+        if (!segment_ready(idx)) {
+            if (test_us() - last > STALL_US) {
+                CHECK(0, "firmware waited on segment %u for a second: head %u tail %u seek %u ack %u", idx,
+                      mipod_in->ring_head, mipod_in->ring_tail, mipod_in->ring_seek, mipod_in->ring_ack);
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        // start_segment_ingest. the copy runs in the background while the other tasks get their turn.
+        for (uint32_t k = 0; k < STRIDE; k += INGEST_PIECE) {
+            memcpy(copy + k, ring + ring_segment_offset(idx, slots, STRIDE) + k, min(INGEST_PIECE, STRIDE - k));
+            sched_yield();
+        }
+        mipod_in->ring_tail = idx + 1; // playback_segment_release, once the copy is done
+        memcpy(&got, copy, sizeof(got));
+        CHECK(got == idx, "ring slot of segment %u held segment %u", idx, got);
+        for (uint32_t k = sizeof(got); k < STRIDE; k += 97) // enough to catch a slot rewritten under the copy
+            if (copy[k] != stamp(idx, k)) {
+                CHECK(0, "segment %u was changed while it was copied (byte %u)", idx, k);
+                break;
+            }
+        if (test_failures)
+            break;
+        fw_segments++;
+        last = test_us();
+        idx++;
+        if (idx == NR_SEGMENTS || rand_r(&seed) % 64 == 0) {
+            idx = rand_r(&seed) % NR_SEGMENTS;
+            seek(idx);
+            fw_seeks++;
+        }
+    }
+    done = 1;
+    return arg;
+}
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/ring_soak_XXXXXX";
+    int secs = argc > 1 ? atoi(argv[1]) : 2, fd;
+    uint64_t end, last_segments = 0, last = test_us();
+    unsigned int seed = 2;
+    pthread_t fw;
+
+    fd = mkstemp(path);
+    if (fd == -1 || close(fd) || write_song(path)) {
+        printf("could not write %s\n", path);
+        return 1;
+    }
+    mipod_in = calloc(1, sizeof(mipod_buffer));
+    CHECK(open_stream(path, (mipod_digital_data *)&mipod_in->digital_data), "open_stream");
+    CHECK(mipod_in->digital_data.ring_slots > 1 && mipod_in->digital_data.ring_slots < NR_SEGMENTS,
+          "%u ring slots for %u segments, the ring never wraps", mipod_in->digital_data.ring_slots, NR_SEGMENTS);
+    if (test_failures)
+        return test_done("ring_soak");
+
+    pthread_create(&fw, NULL, firmware, NULL);
+    end = test_us() + (uint64_t)secs * 1000000;
+    while (!done && test_us() < end) {
+        stream_refill();
+        client_passes++;
+        if (rand_r(&seed) % 4 == 0) // read_input refills between polls of stdin
+            usleep(rand_r(&seed) % 200);
+        if (fw_segments != last_segments) {
+            last_segments = fw_segments;
+            last = test_us();
+        } else if (test_us() - last > 2 * STALL_US) {
+            CHECK(0, "no segment was played for two seconds");
+            break;
+        }
+    }
+    done = 1;
+    pthread_join(fw, NULL);
+    close_stream();
+    unlink(path);
+
+    printf("ring_soak: %d s, %u slots, %llu segments, %llu seeks, %llu refills\n", secs,
+           mipod_in->digital_data.ring_slots, (unsigned long long)fw_segments, (unsigned long long)fw_seeks,
+           (unsigned long long)client_passes);
+    CHECK(test_failures || fw_seeks > 0, "never seeked");
+    return test_done("ring_soak");
+}
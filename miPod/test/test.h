@@ -0,0 +1,39 @@
+/*
+ * test.h
+ *
+ * Bits shared by the host tests of the miPod sources. A test prints one
+ * line per failed check and exits non zero if there was any.
+ */
+
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static int test_failures;
+
+#define CHECK(cond_, ...) do { \
+    if (!(cond_)) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        test_failures++; \
+    } \
+} while (0)
+
+// returns 0 if no check failed, after printing a summary for <name>
+static inline int test_done(const char *name) {
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+    return test_failures != 0;
+}
+
+// monotonic clock in microseconds
+static inline uint64_t test_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif /* TEST_TEST_H_ */
@@ -0,0 +1,69 @@
+"""
+Description: Reads and writes the user secrets file made by createUsers
+Use: Imported by createUsers, createDevice, protectSong and genSongs
+
+The file is a header followed by one fixed size record per user, in id order:
+    header: magic "USEC", format version, number of users, record size (all little endian uint32 but the magic)
+    record: name (nul padded to UNAME_SIZE), id (uint32), salt (SALT_SIZE bytes), pbkdf2 key (PKEY_SIZE bytes)
+so it can be written as the keys come in and read back without parsing any text.
+The json files older versions of createUsers wrote are still read.
+"""
+import json
+import struct
+
+MAGIC = b"USEC"
+VERSION = 1
+UNAME_SIZE = 16  # see constants.h, names are at most 15 characters
+SALT_SIZE = 16
+PKEY_SIZE = 64
+HEADER = struct.Struct("<4sIII")
+RECORD = struct.Struct("<%dsI%ds%ds" % (UNAME_SIZE, SALT_SIZE, PKEY_SIZE))
+
+
+class UserSecretsWriter(object):
+    """writes <count> records to <path> one at a time, see add"""
+
+    def __init__(self, path, count):
+        self.file = open(path, "wb")
+        self.count = count
+        self.written = 0
+        self.file.write(HEADER.pack(MAGIC, VERSION, count, RECORD.size))
+
+    def add(self, name, uid, salt, key):
+        self.file.write(RECORD.pack(name.encode(), uid, salt, key))
+        self.written += 1
+
+    def close(self):
+        self.file.close()
+        if self.written != self.count:
+            raise ValueError("wrote %d of %d users" % (self.written, self.count))
+
+
+def load(path):
+    """returns {name: {"id": uid, "salt": bytes, "hash": bytes}}, in id order"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:1] == b"{":
+        return load_json(data)
+
+    if len(data) < HEADER.size:
+        raise ValueError("%s is not a user secrets file" % path)
+    magic, version, count, record_size = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        raise ValueError("%s is not a user secrets file, or from another version of createUsers" % path)
+    if len(data) != HEADER.size + count * RECORD.size:
+        raise ValueError("%s is truncated" % path)
+
+    users = {}
+    for name, uid, salt, key in RECORD.iter_unpack(memoryview(data)[HEADER.size:]):
+        users[name.rstrip(b"\0").decode()] = {"id": uid, "salt": salt, "hash": key}
+    return users
+
+
+def load_json(data):
+    """the old format, with the bytes as comma separated decimal strings"""
+    users = json.loads(data)
+    for user in users.values():
+        user["salt"] = bytes(int(b) for b in user["salt"].split(","))
+        user["hash"] = bytes(int(b) for b in user["hash"].split(","))
+    return users